@@ -18,16 +18,62 @@
 
 #include "Application.h"
 
+#include <iostream>
+
 #include <QMessageBox>
 
 #include <Config.h>
 #include "Logger.h"
 #include "Error.h"
+#include "Utils.h"
+#include "Core/AirPods.h"
+#include "Core/AppleCPStats.h"
 #include "Core/Bluetooth.h"
+#include "Core/BtSnoop.h"
+#include "Core/Capture.h"
 #include "Core/GlobalMedia.h"
 #include "Core/Settings.h"
 #include "Core/Update.h"
 
+namespace {
+
+// Aggregates the AirPods frames of a capture or a btsnoop HCI log, without scanning
+//
+bool PrintStats(const QString &path)
+{
+    Core::AppleCP::Stats::Aggregator aggregator;
+
+    const auto add = [&](const Core::Bluetooth::AdvertisementWatcher::ReceivedData &data) {
+        const auto adv = Core::AirPods::Details::Advertisement::TryDecode(data);
+        if (adv.has_value()) {
+            aggregator.Add(data.address, adv->GetProtocol());
+        }
+    };
+
+    if (Core::Capture::BtSnoopImporter::IsBtSnoop(path)) {
+        Core::Capture::BtSnoopImporter importer;
+        if (!importer.Open(path)) {
+            return false;
+        }
+        while (const auto data = importer.Next()) {
+            add(data.value());
+        }
+    }
+    else {
+        Core::Capture::Reader reader;
+        if (!reader.Open(path)) {
+            return false;
+        }
+        while (const auto record = reader.Next()) {
+            add(Core::Capture::ToReceivedData(record.value()));
+        }
+    }
+
+    std::cout << Helper::ToString(aggregator.GetReport()).toStdString() << std::flush;
+    return true;
+}
+} // namespace
+
 void ApdApplication::PreConstruction()
 {
     setAttribute(Qt::AA_DisableWindowContextHelpButton);
@@ -56,6 +102,19 @@ void ApdApplication::InitSettings(Core::Settings::LoadResult loadResult)
         FatalError(std::format("Unhandled LoadResult: '{}'", Helper::ToUnderlying(result)), true);
     }
 
+    const auto &optProximityKey = _launchOptsMgr.GetOpts().proximityKey;
+    if (optProximityKey.has_value()) {
+        const auto key = QString::fromStdString(optProximityKey.value());
+
+        if (Core::AirPods::Details::Decryptor::ParseKey(key).has_value()) {
+            Core::Settings::ModifiableAccess()->proximity_key = key;
+            LOG(Info, "The proximity key has been imported.");
+        }
+        else {
+            LOG(Warn, "The proximity key to import is invalid, it should be 32 hex digits.");
+        }
+    }
+
     Core::Settings::Apply();
 }
 
@@ -130,6 +189,10 @@ bool ApdApplication::Prepare(int argc, char *argv[])
 
     LOG(Info, "Opts: {}", opts);
 
+    if (opts.stats.has_value()) {
+        std::exit(PrintStats(QString::fromStdString(opts.stats.value())) ? 0 : 1);
+    }
+
     Logger::CleanUpOldLogFiles();
 
     QFont font;
@@ -165,7 +228,26 @@ bool ApdApplication::Prepare(int argc, char *argv[])
 int ApdApplication::Run()
 {
     _mainWindow->GetApdMgr().StartScanner();
-    return exec();
+
+    const auto &loadTestOpts = _launchOptsMgr.GetOpts().loadTest;
+    if (loadTestOpts.devices != 0) {
+        Core::LoadTest::Config config;
+        config.devices = loadTestOpts.devices;
+        config.advertisementsPerSecond = loadTestOpts.rate;
+        config.duration = std::chrono::seconds{loadTestOpts.seconds};
+        config.maxSpeed = loadTestOpts.maxSpeed;
+
+        _loadGenerator = std::make_unique<Core::LoadTest::Generator>(std::move(config));
+        _loadGenerator->Start(_mainWindow->GetApdMgr(), nullptr);
+    }
+
+    const int result = exec();
+
+    const auto &taskQueue = Utils::Qt::TaskQueue::GetInstance();
+    LOG(Info, "TaskQueue: Stopped. Depth: {}, max depth: {}", taskQueue.GetDepth(),
+        taskQueue.GetMaxDepth());
+
+    return result;
 }
 
 const QVector<QLocale> &ApdApplication::AvailableLocales()
@@ -29,6 +29,7 @@
 #include "Gui/DownloadWindow.h"
 #include "Core/AirPods.h"
 #include "Core/LowAudioLatency.h"
+#include "Core/LoadTest.h"
 #include "Opts.h"
 
 class ApdApplication : public SingleApplication
@@ -66,6 +67,11 @@ public:
 
     const QVector<QLocale> &AvailableLocales();
 
+    static inline const Opts::LaunchOpts &GetLaunchOpts()
+    {
+        return _launchOptsMgr.GetOpts();
+    }
+
     static void QuitSafely();
 
 Q_SIGNALS:
@@ -80,6 +86,7 @@ private:
     std::unique_ptr<Gui::MainWindow> _mainWindow;
     std::unique_ptr<Gui::DownloadWindow> _downloadWindow;
     std::unique_ptr<Core::LowAudioLatency::Controller> _lowAudioLatencyController;
+    std::unique_ptr<Core::LoadTest::Generator> _loadGenerator;
 
     void InitSettings(Core::Settings::LoadResult loadResult);
     void FirstTimeUse();
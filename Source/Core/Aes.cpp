@@ -0,0 +1,82 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Aes.h"
+
+#include "Cpu.h"
+
+namespace Core::Aes {
+
+namespace {
+
+#if defined APD_ARCH_X86
+APD_TARGET_AESNI __m128i LoadBlock(const Block &block)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(block.data()));
+}
+
+APD_TARGET_AESNI Block StoreBlock(__m128i value)
+{
+    Block result;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(result.data()), value);
+    return result;
+}
+
+APD_TARGET_AESNI Block EncryptAesNi(const Aes128::RoundKeys &roundKeys, const Block &plaintext)
+{
+    __m128i state = _mm_xor_si128(LoadBlock(plaintext), LoadBlock(roundKeys[0]));
+    for (size_t round = 1; round < Aes128::kRounds; ++round) {
+        state = _mm_aesenc_si128(state, LoadBlock(roundKeys[round]));
+    }
+    return StoreBlock(_mm_aesenclast_si128(state, LoadBlock(roundKeys[Aes128::kRounds])));
+}
+
+// The equivalent inverse cipher, the middle round keys go through InvMixColumns first. This is
+// redone per block, it's cheap compared to keeping a second key schedule around.
+//
+APD_TARGET_AESNI Block DecryptAesNi(const Aes128::RoundKeys &roundKeys, const Block &ciphertext)
+{
+    __m128i state = _mm_xor_si128(LoadBlock(ciphertext), LoadBlock(roundKeys[Aes128::kRounds]));
+    for (size_t round = Aes128::kRounds - 1; round > 0; --round) {
+        state = _mm_aesdec_si128(state, _mm_aesimc_si128(LoadBlock(roundKeys[round])));
+    }
+    return StoreBlock(_mm_aesdeclast_si128(state, LoadBlock(roundKeys[0])));
+}
+#endif
+} // namespace
+
+Block Aes128::Encrypt(const Block &plaintext) const
+{
+#if defined APD_ARCH_X86
+    if (Cpu::GetFeatures().aesni) {
+        return EncryptAesNi(_roundKeys, plaintext);
+    }
+#endif
+    return EncryptPortable(plaintext);
+}
+
+Block Aes128::Decrypt(const Block &ciphertext) const
+{
+#if defined APD_ARCH_X86
+    if (Cpu::GetFeatures().aesni) {
+        return DecryptAesNi(_roundKeys, ciphertext);
+    }
+#endif
+    return DecryptPortable(ciphertext);
+}
+} // namespace Core::Aes
@@ -0,0 +1,264 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// AES-128 (FIPS-197) for single blocks.
+//
+// The portable implementation is constexpr so that the test vectors are checked at compile time.
+// At runtime `Encrypt` and `Decrypt` use AES-NI if the CPU supports it.
+//
+namespace Core::Aes {
+
+using Block = std::array<uint8_t, 16>;
+using Key128 = std::array<uint8_t, 16>;
+
+namespace Details {
+
+// clang-format off
+constexpr inline std::array<uint8_t, 256> kSBox{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+constexpr inline std::array<uint8_t, 256> kInvSBox{
+    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d,
+};
+// clang-format on
+
+constexpr uint8_t XTime(uint8_t value)
+{
+    return static_cast<uint8_t>((value << 1) ^ ((value & 0x80) != 0 ? 0x1B : 0x00));
+}
+
+constexpr uint8_t Multiply(uint8_t lhs, uint8_t rhs)
+{
+    uint8_t result = 0;
+    while (rhs != 0) {
+        if ((rhs & 1) != 0) {
+            result ^= lhs;
+        }
+        lhs = XTime(lhs);
+        rhs >>= 1;
+    }
+    return result;
+}
+
+constexpr void AddRoundKey(Block &state, const Block &roundKey)
+{
+    for (size_t i = 0; i < state.size(); ++i) {
+        state[i] ^= roundKey[i];
+    }
+}
+
+// The state is stored column by column, as the input bytes are
+//
+constexpr void SubBytes(Block &state, const std::array<uint8_t, 256> &box)
+{
+    for (auto &byte : state) {
+        byte = box[byte];
+    }
+}
+
+constexpr void ShiftRows(Block &state)
+{
+    const Block copy = state;
+    for (size_t column = 0; column < 4; ++column) {
+        for (size_t row = 0; row < 4; ++row) {
+            state[column * 4 + row] = copy[((column + row) % 4) * 4 + row];
+        }
+    }
+}
+
+constexpr void InvShiftRows(Block &state)
+{
+    const Block copy = state;
+    for (size_t column = 0; column < 4; ++column) {
+        for (size_t row = 0; row < 4; ++row) {
+            state[((column + row) % 4) * 4 + row] = copy[column * 4 + row];
+        }
+    }
+}
+
+constexpr void MixColumns(Block &state, const std::array<uint8_t, 4> &coefficients)
+{
+    for (size_t column = 0; column < 4; ++column) {
+        const std::array<uint8_t, 4> c{
+            state[column * 4], state[column * 4 + 1], state[column * 4 + 2],
+            state[column * 4 + 3]};
+
+        for (size_t row = 0; row < 4; ++row) {
+            uint8_t value = 0;
+            for (size_t i = 0; i < 4; ++i) {
+                value ^= Multiply(c[i], coefficients[(i + 4 - row) % 4]);
+            }
+            state[column * 4 + row] = value;
+        }
+    }
+}
+
+constexpr std::array<uint8_t, 4> kMix{0x02, 0x03, 0x01, 0x01};
+constexpr std::array<uint8_t, 4> kInvMix{0x0E, 0x0B, 0x0D, 0x09};
+
+} // namespace Details
+
+class Aes128
+{
+public:
+    static constexpr size_t kRounds = 10;
+
+    using RoundKeys = std::array<Block, kRounds + 1>;
+
+    constexpr explicit Aes128(const Key128 &key) : _roundKeys{ExpandKey(key)} {}
+
+    Block Encrypt(const Block &plaintext) const;
+    Block Decrypt(const Block &ciphertext) const;
+
+    constexpr Block EncryptPortable(Block state) const
+    {
+        using namespace Details;
+
+        AddRoundKey(state, _roundKeys[0]);
+        for (size_t round = 1; round < kRounds; ++round) {
+            SubBytes(state, kSBox);
+            ShiftRows(state);
+            MixColumns(state, kMix);
+            AddRoundKey(state, _roundKeys[round]);
+        }
+        SubBytes(state, kSBox);
+        ShiftRows(state);
+        AddRoundKey(state, _roundKeys[kRounds]);
+        return state;
+    }
+
+    constexpr Block DecryptPortable(Block state) const
+    {
+        using namespace Details;
+
+        AddRoundKey(state, _roundKeys[kRounds]);
+        for (size_t round = kRounds - 1; round > 0; --round) {
+            InvShiftRows(state);
+            SubBytes(state, kInvSBox);
+            AddRoundKey(state, _roundKeys[round]);
+            MixColumns(state, kInvMix);
+        }
+        InvShiftRows(state);
+        SubBytes(state, kInvSBox);
+        AddRoundKey(state, _roundKeys[0]);
+        return state;
+    }
+
+    constexpr const RoundKeys &GetRoundKeys() const
+    {
+        return _roundKeys;
+    }
+
+private:
+    RoundKeys _roundKeys;
+
+    static constexpr RoundKeys ExpandKey(const Key128 &key)
+    {
+        RoundKeys result{};
+        result[0] = key;
+
+        uint8_t rcon = 0x01;
+        for (size_t round = 1; round <= kRounds; ++round) {
+            const Block &prev = result[round - 1];
+            Block &curr = result[round];
+
+            // RotWord + SubWord + Rcon on the last word of the previous round key
+            //
+            const std::array<uint8_t, 4> temp{
+                static_cast<uint8_t>(Details::kSBox[prev[13]] ^ rcon), Details::kSBox[prev[14]],
+                Details::kSBox[prev[15]], Details::kSBox[prev[12]]};
+
+            for (size_t i = 0; i < 4; ++i) {
+                curr[i] = prev[i] ^ temp[i];
+            }
+            for (size_t i = 4; i < curr.size(); ++i) {
+                curr[i] = prev[i] ^ curr[i - 4];
+            }
+            rcon = Details::XTime(rcon);
+        }
+        return result;
+    }
+};
+
+namespace Details {
+
+// FIPS-197 Appendix A.1, the last round key
+//
+static_assert(
+    Aes128{Key128{
+               0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+               0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C}}
+        .GetRoundKeys()[Aes128::kRounds] ==
+    Block{
+        0xD0, 0x14, 0xF9, 0xA8, 0xC9, 0xEE, 0x25, 0x89,
+        0xE1, 0x3F, 0x0C, 0xC8, 0xB6, 0x63, 0x0C, 0xA6});
+
+// FIPS-197 Appendix C.1
+//
+constexpr inline Key128 kTestKey{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+constexpr inline Block kTestPlaintext{
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+constexpr inline Block kTestCiphertext{
+    0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+    0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+
+static_assert(Aes128{kTestKey}.EncryptPortable(kTestPlaintext) == kTestCiphertext);
+static_assert(Aes128{kTestKey}.DecryptPortable(kTestCiphertext) == kTestPlaintext);
+
+} // namespace Details
+} // namespace Core::Aes
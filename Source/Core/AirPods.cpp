@@ -19,7 +19,10 @@
 #include "AirPods.h"
 
 #include <mutex>
+#include <format>
 #include <chrono>
+#include <cstring>
+#include <algorithm>
 #include <thread>
 #include <QVector>
 #include <QMetaObject>
@@ -36,109 +39,657 @@ using namespace Core;
 using namespace std::chrono_literals;
 
 namespace Core::AirPods {
-namespace Details {
 
 //
-// Advertisement
+// PackedState
 //
 
-bool Advertisement::IsDesiredAdv(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+namespace {
+
+constexpr uint8_t kBatteryValid = 0x80;
+
+constexpr uint32_t kLeftBatteryShift = 0;
+constexpr uint32_t kRightBatteryShift = 8;
+constexpr uint32_t kCaseBatteryShift = 16;
+constexpr uint32_t kFlagsShift = 24;
+constexpr uint32_t kModelShift = 32;
+constexpr uint32_t kDisplayNameShift = 48;
+
+uint64_t PackBattery(const Battery &battery)
 {
-    auto iter = data.manufacturerDataMap.find(AppleCP::VendorId);
-    if (iter == data.manufacturerDataMap.end()) {
-        return false;
+    if (!battery.Available()) {
+        return 0;
     }
+    return kBatteryValid | std::min<Battery::ValueType>(battery.Value(), 0x7F);
+}
 
-    const auto &manufacturerData = (*iter).second;
-    if (!AppleCP::AirPods::IsValid(manufacturerData)) {
-        return false;
+Battery UnpackBattery(uint8_t byte)
+{
+    if ((byte & kBatteryValid) == 0) {
+        return Battery{};
     }
+    return Battery{static_cast<Battery::ValueType>(byte & 0x7F)};
+}
 
-    return true;
+struct DisplayNames {
+    std::mutex mutex;
+    std::vector<QString> names{QString{}};
+};
+
+DisplayNames &GetDisplayNames()
+{
+    static DisplayNames i;
+    return i;
+}
+} // namespace
+
+auto PackedState::InternDisplayName(const QString &name) -> NameId
+{
+    if (name.isEmpty()) {
+        return 0;
+    }
+
+    auto &displayNames = GetDisplayNames();
+    std::lock_guard<std::mutex> lock{displayNames.mutex};
+
+    auto &names = displayNames.names;
+    const auto iter = std::find(names.begin(), names.end(), name);
+    if (iter != names.end()) {
+        return static_cast<NameId>(iter - names.begin());
+    }
+
+    if (names.size() > std::numeric_limits<NameId>::max()) {
+        LOG(Warn, "PackedState: Too many display names, '{}' is dropped.", name);
+        return 0;
+    }
+
+    names.push_back(name);
+    return static_cast<NameId>(names.size() - 1);
+}
+
+QString PackedState::GetDisplayName(NameId id)
+{
+    auto &displayNames = GetDisplayNames();
+    std::lock_guard<std::mutex> lock{displayNames.mutex};
+
+    return id < displayNames.names.size() ? displayNames.names[id] : QString{};
+}
+
+PackedState::PackedState(uint64_t bits) : _bits{bits} {}
+
+PackedState PackedState::Pack(const State &state)
+{
+    uint8_t flags = 0;
+    flags |= state.pods.left.isCharging ? LeftCharging : 0;
+    flags |= state.pods.left.isInEar ? LeftInEar : 0;
+    flags |= state.pods.right.isCharging ? RightCharging : 0;
+    flags |= state.pods.right.isInEar ? RightInEar : 0;
+    flags |= state.caseBox.isCharging ? CaseCharging : 0;
+    flags |= state.caseBox.isBothPodsInCase ? BothPodsInCase : 0;
+    flags |= state.caseBox.isLidOpened ? LidOpened : 0;
+
+    return PackedState{
+        PackBattery(state.pods.left.battery) << kLeftBatteryShift |
+        PackBattery(state.pods.right.battery) << kRightBatteryShift |
+        PackBattery(state.caseBox.battery) << kCaseBatteryShift |
+        uint64_t{flags} << kFlagsShift |
+        uint64_t{static_cast<uint8_t>(Helper::ToUnderlying(state.model))} << kModelShift |
+        uint64_t{InternDisplayName(state.displayName)} << kDisplayNameShift};
+}
+
+State PackedState::Unpack() const
+{
+    State result;
+
+    result.model = GetModel();
+    result.pods = GetPods();
+    result.caseBox = GetCase();
+    result.displayName = GetDisplayName(GetDisplayNameId());
+    return result;
 }
 
-Advertisement::Advertisement(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+PodsState PackedState::GetPods() const
 {
-    APD_ASSERT(IsDesiredAdv(data));
-    _data = data;
+    PodsState result;
 
-    auto protocol = AppleCP::As<AppleCP::AirPods>(GetMfrData());
-    APD_ASSERT(protocol.has_value());
-    _protocol = std::move(protocol.value());
+    result.left.battery = UnpackBattery(static_cast<uint8_t>(_bits >> kLeftBatteryShift));
+    result.left.isCharging = Has(LeftCharging);
+    result.left.isInEar = Has(LeftInEar);
 
+    result.right.battery = UnpackBattery(static_cast<uint8_t>(_bits >> kRightBatteryShift));
+    result.right.isCharging = Has(RightCharging);
+    result.right.isInEar = Has(RightInEar);
+
+    return result;
+}
+
+CaseState PackedState::GetCase() const
+{
+    CaseState result;
+
+    result.battery = UnpackBattery(static_cast<uint8_t>(_bits >> kCaseBatteryShift));
+    result.isCharging = Has(CaseCharging);
+    result.isBothPodsInCase = Has(BothPodsInCase);
+    result.isLidOpened = Has(LidOpened);
+
+    return result;
+}
+
+Model PackedState::GetModel() const
+{
+    return static_cast<Model>(static_cast<uint8_t>(_bits >> kModelShift));
+}
+
+bool PackedState::Has(Flag flag) const
+{
+    return (static_cast<uint8_t>(_bits >> kFlagsShift) & flag) != 0;
+}
+
+auto PackedState::GetDisplayNameId() const -> NameId
+{
+    return static_cast<NameId>(_bits >> kDisplayNameShift);
+}
+
+PackedState PackedState::WithDisplayName(NameId id) const
+{
+    constexpr uint64_t kMask = uint64_t{std::numeric_limits<NameId>::max()} << kDisplayNameShift;
+    return PackedState{(_bits & ~kMask) | uint64_t{id} << kDisplayNameShift};
+}
+
+namespace Details {
+
+//
+// Advertisement
+//
+
+auto Advertisement::TryDecode(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+    -> std::optional<Advertisement>
+{
+    struct Messages {
+        const AppleCP::AirPods *proximityPairing{nullptr};
+    };
+
+    constexpr static auto kDispatcher = AppleCP::MessageDispatcher<Messages>{}.Register(
+        AppleCP::PacketType::ProximityPairing,
+        [](Messages &messages, std::span<const uint8_t> message) {
+            if (messages.proximityPairing == nullptr) {
+                messages.proximityPairing = AppleCP::AsView<AppleCP::AirPods>(message);
+            }
+        });
+
+    const auto optAppleData = data.manufacturerDataMap.Find(AppleCP::VendorId);
+    if (!optAppleData.has_value()) {
+        return std::nullopt;
+    }
+
+    // The ProximityPairing message isn't necessarily the only one in the payload
+    //
+    Messages messages;
+    kDispatcher.Walk(optAppleData.value(), messages);
+
+    if (messages.proximityPairing == nullptr) {
+        return std::nullopt;
+    }
+
+    return Advertisement{data, *messages.proximityPairing};
+}
+
+Advertisement::Advertisement(
+    const Bluetooth::AdvertisementWatcher::ReceivedData &data, const AppleCP::AirPods &protocol)
+    : _timestamp{data.timestamp}, _address{data.address}, _rssi{data.rssi}, _protocol{protocol}
+{
     // Store state
     //
 
-    _state.model = _protocol.GetModel();
-    _state.side = _protocol.GetBroadcastedSide();
+    State state;
+    state.model = _protocol.GetModel();
 
-    _state.pods.left.battery = _protocol.GetLeftBattery();
-    _state.pods.left.isCharging = _protocol.IsLeftCharging();
-    _state.pods.left.isInEar = _protocol.IsLeftInEar();
+    state.pods.left.battery = _protocol.GetLeftBattery();
+    state.pods.left.isCharging = _protocol.IsLeftCharging();
+    state.pods.left.isInEar = _protocol.IsLeftInEar();
 
-    _state.pods.right.battery = _protocol.GetRightBattery();
-    _state.pods.right.isCharging = _protocol.IsRightCharging();
-    _state.pods.right.isInEar = _protocol.IsRightInEar();
+    state.pods.right.battery = _protocol.GetRightBattery();
+    state.pods.right.isCharging = _protocol.IsRightCharging();
+    state.pods.right.isInEar = _protocol.IsRightInEar();
 
-    _state.caseBox.battery = _protocol.GetCaseBattery();
-    _state.caseBox.isCharging = _protocol.IsCaseCharging();
+    state.caseBox.battery = _protocol.GetCaseBattery();
+    state.caseBox.isCharging = _protocol.IsCaseCharging();
 
-    _state.caseBox.isBothPodsInCase = _protocol.IsBothPodsInCase();
-    _state.caseBox.isLidOpened = _protocol.IsLidOpened();
+    state.caseBox.isBothPodsInCase = _protocol.IsBothPodsInCase();
+    state.caseBox.isLidOpened = _protocol.IsLidOpened();
 
-    if (_state.pods.left.battery.Available()) {
-        _state.pods.left.battery = _state.pods.left.battery.Value() * 10;
+    if (state.pods.left.battery.Available()) {
+        state.pods.left.battery = state.pods.left.battery.Value() * 10;
     }
-    if (_state.pods.right.battery.Available()) {
-        _state.pods.right.battery = _state.pods.right.battery.Value() * 10;
+    if (state.pods.right.battery.Available()) {
+        state.pods.right.battery = state.pods.right.battery.Value() * 10;
     }
-    if (_state.caseBox.battery.Available()) {
-        _state.caseBox.battery = _state.caseBox.battery.Value() * 10;
+    if (state.caseBox.battery.Available()) {
+        state.caseBox.battery = state.caseBox.battery.Value() * 10;
     }
+
+    _state = PackedState::Pack(state);
 }
 
 int16_t Advertisement::GetRssi() const
 {
-    return _data.rssi;
+    return _rssi;
 }
 
-const auto &Advertisement::GetTimestamp() const
+auto Advertisement::GetTimestamp() const -> Timestamp
 {
-    return _data.timestamp;
+    return _timestamp;
 }
 
 auto Advertisement::GetAddress() const -> AddressType
 {
-    return _data.address;
+    return _address;
 }
 
 std::vector<uint8_t> Advertisement::GetDesensitizedData() const
 {
-    auto desensitizedData = _protocol.Desensitize();
+    const auto desensitizedData = _protocol.Desensitize();
+    const auto bytes = desensitizedData.Bytes();
+
+    return std::vector<uint8_t>{bytes.begin(), bytes.end()};
+}
+
+const AppleCP::AirPods &Advertisement::GetProtocol() const
+{
+    return _protocol;
+}
+
+// The side is a bit of the frame, it isn't stored twice
+//
+auto Advertisement::GetAdvState() const -> AdvState
+{
+    return AdvState{
+        .model = _state.GetModel(),
+        .pods = _state.GetPods(),
+        .caseBox = _state.GetCase(),
+        .side = _protocol.GetBroadcastedSide(),
+    };
+}
+
+void Advertisement::ApplyDecrypted(const DecryptedState &decrypted)
+{
+    const auto apply = [](BasicState &state, const BasicState &decrypted) {
+        state.battery = decrypted.battery;
+        state.isCharging = decrypted.isCharging;
+    };
+
+    State state;
+    state.model = _state.GetModel();
+    state.pods = _state.GetPods();
+    state.caseBox = _state.GetCase();
+
+    apply(state.pods.left, decrypted.left);
+    apply(state.pods.right, decrypted.right);
+    apply(state.caseBox, decrypted.caseBox);
+
+    _state = PackedState::Pack(state);
+
+    _identified = true;
+}
+
+bool Advertisement::IsIdentified() const
+{
+    return _identified;
+}
+
+//
+// Decryptor
+//
+
+std::optional<Aes::Key128> Decryptor::ParseKey(const QString &hex)
+{
+    Aes::Key128 result{};
+    size_t digits = 0;
+
+    for (const QChar ch : hex) {
+        if (ch.isSpace() || ch == ':') {
+            continue;
+        }
+
+        const char c = ch.toLatin1();
+        int value;
+        if (c >= '0' && c <= '9') {
+            value = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f') {
+            value = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F') {
+            value = c - 'A' + 10;
+        }
+        else {
+            return std::nullopt;
+        }
+
+        if (digits >= result.size() * 2) {
+            return std::nullopt;
+        }
+
+        result[digits / 2] |= static_cast<uint8_t>(value << (digits % 2 == 0 ? 4 : 0));
+        ++digits;
+    }
+
+    if (digits != result.size() * 2) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+void Decryptor::SetKey(const std::optional<Aes::Key128> &key)
+{
+    _cache = {};
+    _cacheNext = 0;
+
+    if (key.has_value()) {
+        _aes.emplace(key.value());
+    }
+    else {
+        _aes.reset();
+    }
+}
+
+bool Decryptor::HasKey() const
+{
+    return _aes.has_value();
+}
+
+void Decryptor::Apply(Advertisement &adv)
+{
+    if (!_aes.has_value()) {
+        return;
+    }
+
+    const auto &protocol = adv.GetProtocol();
+    const auto ciphertext = protocol.GetEncryptedPayload();
+    const auto address = adv.GetAddress();
+
+    auto iter = std::find_if(_cache.begin(), _cache.end(), [&](const CacheEntry &entry) {
+        return entry.used && entry.address == address;
+    });
+
+    if (iter == _cache.end()) {
+        iter = _cache.begin() + _cacheNext;
+        _cacheNext = (_cacheNext + 1) % kCacheCapacity;
+
+        *iter = CacheEntry{address, ciphertext, _aes->Decrypt(ciphertext), true};
+    }
+    else if (iter->ciphertext != ciphertext) {
+        iter->ciphertext = ciphertext;
+        iter->plaintext = _aes->Decrypt(ciphertext);
+    }
+
+    // A payload decrypted with a wrong key is just random bytes
+    //
+    const auto &plaintext = iter->plaintext;
+    if (protocol.IsConsistentPayload(plaintext)) {
+        adv.ApplyDecrypted(Decode(plaintext));
+    }
+}
+
+DecryptedState Decryptor::Decode(const Aes::Block &plaintext)
+{
+    namespace PL = AppleCP::AirPodsPayloadLayout;
+
+    const auto decode = [&]<const AppleCP::Layout::Field &kBattery,
+                            const AppleCP::Layout::Field &kCharging>() {
+        BasicState result;
+
+        const auto battery = AppleCP::Layout::Extract<kBattery>(plaintext);
+        if (battery <= 100) {
+            result.battery = battery;
+        }
+        result.isCharging = AppleCP::Layout::Extract<kCharging>(plaintext) != 0;
+        return result;
+    };
+
+    DecryptedState result;
+    result.left = decode.template operator()<PL::kLeftBattery, PL::kLeftCharging>();
+    result.right = decode.template operator()<PL::kRightBattery, PL::kRightCharging>();
+    result.caseBox = decode.template operator()<PL::kCaseBattery, PL::kCaseCharging>();
+    return result;
+}
+
+//
+// RepeatFilter
+//
+
+// Not a cryptographic hash, a collision only makes a changed payload be taken as a repeat until
+// the next change.
+//
+uint64_t RepeatFilter::HashPayload(std::span<const uint8_t> payload)
+{
+    constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15;
+
+    const auto mix = [](uint64_t value) {
+        value ^= value >> 32;
+        value *= kMultiplier;
+        return value ^ (value >> 29);
+    };
+
+    uint64_t result = payload.size() * kMultiplier;
+
+    while (payload.size() >= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, payload.data(), sizeof(word));
+        result = mix(result ^ word);
+        payload = payload.subspan(sizeof(word));
+    }
+
+    // `data()` may be null for an empty span, which `memcpy` doesn't allow even with a size of 0
+    //
+    uint64_t tail = 0;
+    if (!payload.empty()) {
+        std::memcpy(&tail, payload.data(), payload.size());
+    }
+    return mix(result ^ tail);
+}
+
+std::optional<Side> RepeatFilter::Lookup(AddressType address, uint64_t payloadHash, int16_t rssi)
+{
+    const size_t home = HomeIndex(address);
 
-    std::vector<uint8_t> result(sizeof(desensitizedData), 0);
-    std::memcpy(result.data(), &desensitizedData, sizeof(desensitizedData));
+    for (size_t i = 0; i < kMaxProbes; ++i) {
+        const auto &slot = _slots[(home + i) % kCapacity];
+        if (!slot.used) {
+            break;
+        }
+        if (slot.address == address) {
+            if (slot.payloadHash != payloadHash || slot.rssiBucket != RssiBucket(rssi)) {
+                break;
+            }
+            ++_counters.hits;
+            return slot.side;
+        }
+    }
+
+    ++_counters.misses;
+    return std::nullopt;
+}
+
+void RepeatFilter::Remember(AddressType address, uint64_t payloadHash, int16_t rssi, Side side)
+{
+    const size_t home = HomeIndex(address);
+
+    Slot *target = &_slots[home];
+    for (size_t i = 0; i < kMaxProbes; ++i) {
+        auto &slot = _slots[(home + i) % kCapacity];
+        if (!slot.used || slot.address == address) {
+            target = &slot;
+            break;
+        }
+    }
+
+    *target = Slot{
+        .address = address,
+        .payloadHash = payloadHash,
+        .rssiBucket = RssiBucket(rssi),
+        .side = side,
+        .used = true,
+    };
+}
+
+void RepeatFilter::Clear()
+{
+    _slots.fill(Slot{});
+}
+
+auto RepeatFilter::GetCounters() const -> const Counters &
+{
+    return _counters;
+}
+
+size_t RepeatFilter::HomeIndex(AddressType address)
+{
+    return static_cast<size_t>((address * 0x9E3779B97F4A7C15) >> 58) % kCapacity;
+}
+
+int16_t RepeatFilter::RssiBucket(int16_t rssi)
+{
+    return static_cast<int16_t>(
+        (rssi >= 0 ? rssi : rssi - (kRssiBucketWidth - 1)) / kRssiBucketWidth);
+}
+
+//
+// ActionExecutor
+//
+
+void ActionExecutor::Latency::Add(Clock::duration duration)
+{
+    count += 1;
+    total += duration;
+    max = std::max(max, duration);
+}
+
+ActionExecutor::ActionExecutor() : _thread{&ActionExecutor::Thread, this} {}
+
+ActionExecutor::~ActionExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stop = true;
+    }
+    _conVar.notify_one();
+    _thread.join();
+
+    LOG(Info, "ActionExecutor: Stopped. {}", FormatMetrics(GetMetrics()));
+}
+
+void ActionExecutor::Post(Action action)
+{
+    const auto posted = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _queue.push_back(Pending{std::move(action), posted});
+        _metrics.post.Add(Clock::now() - posted);
+    }
+    _conVar.notify_one();
+}
+
+auto ActionExecutor::GetMetrics() const -> Metrics
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _metrics;
+}
+
+std::string ActionExecutor::FormatMetrics(const Metrics &metrics)
+{
+    const auto toMicroseconds = [](Clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    };
+
+    std::string result = std::format("Post max: {}us", toMicroseconds(metrics.post.max));
+    for (size_t i = 0; i < metrics.run.size(); ++i) {
+        if (metrics.run[i].count == 0) {
+            continue;
+        }
+        result += std::format(
+            ", action {} count: {} wait max: {}us run avg: {}us run max: {}us", i,
+            metrics.run[i].count, toMicroseconds(metrics.wait[i].max),
+            toMicroseconds(metrics.run[i].total / metrics.run[i].count),
+            toMicroseconds(metrics.run[i].max));
+    }
     return result;
 }
 
-auto Advertisement::GetAdvState() const -> const AdvState &
+// The metrics are also logged every `kMetricsInterval` while any action has run since the last
+// time, the process may not exit cleanly to log them at the end
+//
+void ActionExecutor::Thread()
 {
-    return _state;
+    std::unique_lock<std::mutex> lock{_mutex};
+
+    auto nextLog = Clock::now() + kMetricsInterval;
+    uint64_t loggedRuns = 0;
+
+    while (true) {
+        _conVar.wait_until(lock, nextLog, [this] { return _stop || !_queue.empty(); });
+        if (_stop) {
+            break;
+        }
+
+        if (Clock::now() >= nextLog) {
+            nextLog = Clock::now() + kMetricsInterval;
+
+            uint64_t runs = 0;
+            for (const auto &run : _metrics.run) {
+                runs += run.count;
+            }
+            if (runs != loggedRuns) {
+                loggedRuns = runs;
+
+                const auto metrics = _metrics;
+                lock.unlock();
+                LOG(Trace, "ActionExecutor: {}", FormatMetrics(metrics));
+                lock.lock();
+            }
+        }
+
+        if (_queue.empty()) {
+            continue;
+        }
+
+        auto pending = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+
+        const auto started = Clock::now();
+        Execute(pending.action);
+        const auto finished = Clock::now();
+
+        lock.lock();
+        _metrics.wait[pending.action.index()].Add(started - pending.posted);
+        _metrics.run[pending.action.index()].Add(finished - started);
+    }
 }
 
-const std::vector<uint8_t> &Advertisement::GetMfrData() const
+void ActionExecutor::Execute(const Action &action)
 {
-    auto iter = _data.manufacturerDataMap.find(AppleCP::VendorId);
-    APD_ASSERT(iter != _data.manufacturerDataMap.end());
+    auto &mainWindow = ApdApp->GetMainWindow();
 
-    return (*iter).second;
+    std::visit(
+        Helper::Overloaded{
+            [&](const Actions::UpdateState &updateState) {
+                mainWindow->PostState(updateState.state);
+            },
+            [&](const Actions::ShowPopup &) { mainWindow->ShowSafely(); },
+            [&](const Actions::HidePopup &) { mainWindow->HideSafely(); },
+            [&](const Actions::MediaPlay &) { Helper::Spawn(Core::GlobalMedia::Play()); },
+            [&](const Actions::MediaPause &) { Helper::Spawn(Core::GlobalMedia::Pause()); },
+            [&](const Actions::Disconnect &) { mainWindow->PostState(std::nullopt); },
+        },
+        action);
 }
 
 //
 // StateManager
 //
 
-StateManager::StateManager()
+StateManager::StateManager(ActionExecutor &executor) : _executor{executor}
 {
     _lostTimer.Start(10s, [this] {
         std::lock_guard<std::mutex> lock{_mutex};
@@ -158,11 +709,24 @@ StateManager::StateManager()
 
 std::optional<State> StateManager::GetCurrentState() const
 {
-    std::lock_guard<std::mutex> lock{_mutex};
-    return _cachedState;
+    const auto snapshot = GetSnapshot();
+    if (!snapshot->value.has_value()) {
+        return std::nullopt;
+    }
+    return snapshot->value->Unpack();
+}
+
+auto StateManager::GetSnapshot() const -> std::shared_ptr<const Snapshot>
+{
+    return _published.Load();
 }
 
-auto StateManager::OnAdvReceived(Advertisement adv) -> std::optional<UpdateEvent>
+uint64_t StateManager::GetVersion() const
+{
+    return _published.GetVersion();
+}
+
+auto StateManager::OnAdvReceived(Advertisement adv) -> std::optional<std::optional<UpdateEvent>>
 {
     std::lock_guard<std::mutex> lock{_mutex};
 
@@ -172,7 +736,36 @@ auto StateManager::OnAdvReceived(Advertisement adv) -> std::optional<UpdateEvent
     }
 
     UpdateAdv(std::move(adv));
-    return UpdateState();
+    return std::make_optional(UpdateState());
+}
+
+auto StateManager::OnAdvRepeated(Side side, Advertisement::AddressType address, int16_t rssi)
+    -> std::optional<std::optional<UpdateEvent>>
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    // The last adv of this side may have been reset by a timer meanwhile, or replaced by an adv
+    // from another address. Then it takes the full path.
+    //
+    auto &lastAdv = side == Side::Left ? _adv.left : _adv.right;
+    if (rssi < _rssiMin || !lastAdv.has_value() || lastAdv->first.GetAddress() != address) {
+        return std::nullopt;
+    }
+
+    // Same as `IsPossibleDesiredAdv`
+    //
+    const auto &lastAnotherAdv = side == Side::Left ? _adv.right : _adv.left;
+    if (lastAnotherAdv.has_value() && std::abs(rssi - lastAnotherAdv->first.GetRssi()) > 50) {
+        return std::nullopt;
+    }
+
+    // Same as `UpdateAdv`, the side that is heard last is preferred when picking the state
+    //
+    _lostTimer.Reset();
+    (side == Side::Left ? _stateResetTimer.left : _stateResetTimer.right).Reset();
+    lastAdv->second = Helper::GetClock().Now();
+
+    return std::make_optional(UpdateState());
 }
 
 void StateManager::Disconnect()
@@ -200,7 +793,23 @@ bool StateManager::IsPossibleDesiredAdv(const Advertisement &adv) const
         return false;
     }
 
-    const auto &advState = adv.GetAdvState();
+    // An adv decrypted with the user's key is broadcast from the user's device, whatever its
+    // address, model, batteries and RSSI say. Once the device is identified, the others are
+    // ignored until it's lost.
+    //
+    if (adv.IsIdentified()) {
+        return true;
+    }
+
+    const auto isIdentified = [](const auto &optAdv) {
+        return optAdv.has_value() && optAdv->first.IsIdentified();
+    };
+    if (isIdentified(_adv.left) || isIdentified(_adv.right)) {
+        LOG(Warn, "IsPossibleDesiredAdv returns false. Reason: Not the identified device.");
+        return false;
+    }
+
+    const auto advState = adv.GetAdvState();
 
     auto &lastAdv = advState.side == Side::Left ? _adv.left : _adv.right;
     auto &lastAnotherAdv = advState.side == Side::Left ? _adv.right : _adv.left;
@@ -209,7 +818,7 @@ bool StateManager::IsPossibleDesiredAdv(const Advertisement &adv) const
     // or the packet is sent from another device that it isn't ours
     //
     if (lastAdv.has_value() && lastAdv->first.GetAddress() != adv.GetAddress()) {
-        const auto &lastAdvState = lastAdv->first.GetAdvState();
+        const auto lastAdvState = lastAdv->first.GetAdvState();
 
         if (advState.model != lastAdvState.model) {
             LOG(Warn, "IsPossibleDesiredAdv returns false. Reason: model new='{}' old='{}'",
@@ -217,26 +826,27 @@ bool StateManager::IsPossibleDesiredAdv(const Advertisement &adv) const
             return false;
         }
 
-        Battery::ValueType leftBatteryDiff = 0, rightBatteryDiff = 0, caseBatteryDiff = 0;
-
-        using SignedBatteryValueT = std::make_signed_t<Battery::ValueType>;
-
-        if (advState.pods.left.battery.Available() && lastAdvState.pods.left.battery.Available()) {
-            leftBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.pods.left.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.pods.left.battery.Value()));
-        }
-        if (advState.pods.right.battery.Available() && lastAdvState.pods.right.battery.Available())
-        {
-            rightBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.pods.right.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.pods.right.battery.Value()));
-        }
-        if (advState.caseBox.battery.Available() && lastAdvState.caseBox.battery.Available()) {
-            caseBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.caseBox.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.caseBox.battery.Value()));
-        }
+        // Identified advs carry batteries in 1% and the others in steps of 10%, so compare them
+        // in steps
+        //
+        const auto batteryDiff = [](const Battery &lhs, const Battery &rhs) -> Battery::ValueType {
+            if (!lhs.Available() || !rhs.Available()) {
+                return 0;
+            }
+
+            using SignedBatteryValueT = std::make_signed_t<Battery::ValueType>;
+            const auto toStep = [](const Battery &battery) {
+                return static_cast<SignedBatteryValueT>((battery.Value() + 5) / 10);
+            };
+            return std::abs(toStep(lhs) - toStep(rhs));
+        };
+
+        const auto leftBatteryDiff =
+            batteryDiff(advState.pods.left.battery, lastAdvState.pods.left.battery);
+        const auto rightBatteryDiff =
+            batteryDiff(advState.pods.right.battery, lastAdvState.pods.right.battery);
+        const auto caseBatteryDiff =
+            batteryDiff(advState.caseBox.battery, lastAdvState.caseBox.battery);
 
         // The battery changes in steps of 1, so the data of two packets in a short time
         // can not exceed 1, otherwise it is not our device
@@ -274,15 +884,15 @@ void StateManager::UpdateAdv(Advertisement adv)
 {
     _lostTimer.Reset();
 
-    const auto &advState = adv.GetAdvState();
+    const auto advState = adv.GetAdvState();
 
     if (advState.side == Side::Left) {
         _stateResetTimer.left.Reset();
-        _adv.left = std::make_pair(std::move(adv), Clock::now());
+        _adv.left = std::make_pair(std::move(adv), Helper::GetClock().Now());
     }
     else if (advState.side == Side::Right) {
         _stateResetTimer.right.Reset();
-        _adv.right = std::make_pair(std::move(adv), Clock::now());
+        _adv.right = std::make_pair(std::move(adv), Helper::GetClock().Now());
     }
 }
 
@@ -322,25 +932,28 @@ auto StateManager::UpdateState() -> std::optional<UpdateEvent>
 
 #undef PICK_SIDE
 
-    if (newState == _cachedState) {
+    const auto packedState = PackedState::Pack(newState);
+    if (packedState == _cachedState) {
         return std::nullopt;
     }
 
-    auto oldState = std::move(_cachedState);
-    _cachedState = std::move(newState);
+    const auto oldState = _cachedState;
+    _cachedState = packedState;
+    _published.Publish(_cachedState);
 
-    return UpdateEvent{.oldState = std::move(oldState), .newState = _cachedState.value()};
+    return UpdateEvent{.oldState = oldState, .newState = packedState};
 }
 
 void StateManager::ResetAll()
 {
-    if (_cachedState.has_value()) {
-        ApdApp->GetMainWindow()->DisconnectSafely();
-    }
-
     _adv.left.reset();
     _adv.right.reset();
-    _cachedState.reset();
+
+    if (_cachedState.has_value()) {
+        _cachedState.reset();
+        _published.Publish(_cachedState);
+        _executor.Post(Actions::Disconnect{});
+    }
 }
 
 void StateManager::DoLost()
@@ -367,20 +980,62 @@ void StateManager::DoStateReset(Side side)
 
 Manager::Manager()
 {
-    _adWatcher.CbReceived() += [this](auto &&...args) {
-        std::lock_guard<std::mutex> lock{_mutex};
-        OnAdvertisementReceived(std::forward<decltype(args)>(args)...);
-    };
+    const auto &opts = ApdApplication::GetLaunchOpts();
+
+    if (opts.replay.has_value()) {
+        LOG(Info, "Replaying a capture instead of scanning.");
+        _adWatcher = std::make_unique<Capture::ReplayAdvertisementWatcher>(
+            QString::fromStdString(opts.replay.value()), opts.replaySpeed);
+    }
+    else {
+        _adWatcher = std::make_unique<Bluetooth::AdvertisementWatcher>();
+    }
+
+    Ingest::Queue::FnBatch onDrained;
+    if (opts.record.has_value() && _recorder.Open(QString::fromStdString(opts.record.value()))) {
+        LOG(Info, "Recording advertisements.");
+        onDrained = [this](std::span<const Bluetooth::AdvertisementWatcher::ReceivedData> batch) {
+            _recorder.Write(batch);
+        };
+    }
+
+    // The watcher thread only queues the advertisement, everything else, recording included, is
+    // done on the ingest thread
+    //
+    _ingest.Start(
+        [this](std::span<const Bluetooth::AdvertisementWatcher::ReceivedData> batch) {
+            OnIngestBatch(batch);
+        },
+        std::move(onDrained));
 
-    _adWatcher.CbStateChanged() += [this](auto &&...args) {
+    _adWatcher->CbReceived() += [this](const auto &data) { _ingest.Push(data); };
+
+    _adWatcher->CbStateChanged() += [this](auto &&...args) {
         std::lock_guard<std::mutex> lock{_mutex};
         OnAdvWatcherStateChanged(std::forward<decltype(args)>(args)...);
     };
 }
 
+Manager::~Manager()
+{
+    // The watcher is declared before the members its handlers use, so it would be destroyed after
+    // them. It's stopped and destroyed first, without reporting to the GUI that goes away too.
+    //
+    _adWatcher->CbStateChanged().UnregisterAll();
+    _adWatcher->Stop();
+    _adWatcher.reset();
+
+    // The ingest thread uses the other members, it must be gone before they are destroyed
+    //
+    _ingest.Stop();
+
+    const auto &counters = _repeatFilter.GetCounters();
+    LOG(Info, "RepeatFilter: Stopped. Hits: {}, misses: {}", counters.hits, counters.misses);
+}
+
 void Manager::StartScanner()
 {
-    if (!_adWatcher.Start()) {
+    if (!_adWatcher->Start()) {
         LOG(Warn, "Bluetooth AdvWatcher start failed.");
     }
     else {
@@ -390,7 +1045,7 @@ void Manager::StartScanner()
 
 void Manager::StopScanner()
 {
-    if (!_adWatcher.Stop()) {
+    if (!_adWatcher->Stop()) {
         LOG(Warn, "AsyncScanner::Stop() failed.");
     }
     else {
@@ -402,6 +1057,32 @@ void Manager::OnRssiMinChanged(int16_t rssiMin)
 {
     std::lock_guard<std::mutex> lock{_mutex};
     _stateMgr.OnRssiMinChanged(rssiMin);
+    _repeatFilter.Clear();
+}
+
+void Manager::OnProximityKeyChanged(const QString &key)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    // Whether an advertisement is identified depends on the key
+    //
+    _repeatFilter.Clear();
+
+    if (key.isEmpty()) {
+        _decryptor.SetKey(std::nullopt);
+        return;
+    }
+
+    auto optKey = Details::Decryptor::ParseKey(key);
+    if (!optKey.has_value()) {
+        LOG(Warn, "The proximity key is invalid, it should be 32 hex digits.");
+    }
+    _decryptor.SetKey(optKey);
+}
+
+auto Manager::GetStateSnapshot() const -> std::shared_ptr<const Details::StateManager::Snapshot>
+{
+    return _stateMgr.GetSnapshot();
 }
 
 void Manager::OnAutomaticEarDetectionChanged(bool enable)
@@ -465,91 +1146,130 @@ void Manager::OnBoundDeviceConnectionStateChanged(Bluetooth::DeviceState state)
         newDeviceConnected);
 }
 
+// Only computes the actions, they are run by `_executor` so that the ingest thread never waits
+// on the GUI or the media control
+//
 void Manager::OnStateChanged(Details::StateManager::UpdateEvent updateEvent)
 {
     const auto &oldState = updateEvent.oldState;
-    auto &newState = updateEvent.newState;
+    const auto &newState = updateEvent.newState;
+
+    const auto displayName = PackedState::InternDisplayName(
+        _deviceName.isEmpty() ? Helper::ToString(newState.GetModel())
+                              : _deviceName.remove(" - Find My"));
 
-    newState.displayName =
-        _deviceName.isEmpty() ? Helper::ToString(newState.model) : _deviceName.remove(" - Find My");
+    _executor.Post(Details::Actions::UpdateState{newState.WithDisplayName(displayName)});
 
-    ApdApp->GetMainWindow()->UpdateStateSafely(newState);
+    const auto isLidOpened = [](const PackedState &state) {
+        return state.Has(PackedState::LidOpened) && state.Has(PackedState::BothPodsInCase);
+    };
+    const auto isBothInEar = [](const PackedState &state) {
+        return state.Has(PackedState::LeftInEar) && state.Has(PackedState::RightInEar);
+    };
 
     // Lid opened
     //
-    bool newLidOpened = newState.caseBox.isLidOpened && newState.caseBox.isBothPodsInCase;
+    bool newLidOpened = isLidOpened(newState);
     bool lidStateSwitched;
     if (!oldState.has_value()) {
         lidStateSwitched = newLidOpened;
     }
     else {
-        bool oldLidOpened = oldState->caseBox.isLidOpened && oldState->caseBox.isBothPodsInCase;
-        lidStateSwitched = oldLidOpened != newLidOpened;
+        lidStateSwitched = isLidOpened(oldState.value()) != newLidOpened;
     }
     if (lidStateSwitched) {
-        OnLidOpened(newLidOpened);
+        if (newLidOpened) {
+            _executor.Post(Details::Actions::ShowPopup{});
+        }
+        else {
+            _executor.Post(Details::Actions::HidePopup{});
+        }
     }
 
     // Both in ear
     //
     if (oldState.has_value()) {
-        bool oldBothInEar = oldState->pods.left.isInEar && oldState->pods.right.isInEar;
-        bool newBothInEar = newState.pods.left.isInEar && newState.pods.right.isInEar;
+        bool oldBothInEar = isBothInEar(oldState.value());
+        bool newBothInEar = isBothInEar(newState);
         if (oldBothInEar != newBothInEar) {
-            OnBothInEar(newBothInEar);
+            if (!_automaticEarDetection) {
+                LOG(Info, "automatic_ear_detection: Do nothing because it is disabled. ({})",
+                    newBothInEar);
+            }
+            else if (newBothInEar) {
+                _executor.Post(Details::Actions::MediaPlay{});
+            }
+            else {
+                _executor.Post(Details::Actions::MediaPause{});
+            }
         }
     }
 }
 
-void Manager::OnLidOpened(bool opened)
-{
-    auto &mainWindow = ApdApp->GetMainWindow();
-    if (opened) {
-        mainWindow->ShowSafely();
-    }
-    else {
-        mainWindow->HideSafely();
-    }
-}
-
-void Manager::OnBothInEar(bool isBothInEar)
+bool Manager::OnAdvertisementReceived(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
 {
-    if (!_automaticEarDetection) {
-        LOG(Info, "automatic_ear_detection: Do nothing because it is disabled. ({})", isBothInEar);
-        return;
+    const auto optAppleData = data.manufacturerDataMap.Find(AppleCP::VendorId);
+    if (!optAppleData.has_value()) {
+        return false;
     }
 
-    if (isBothInEar) {
-        Core::GlobalMedia::Play();
-    }
-    else {
-        Core::GlobalMedia::Pause();
+    const auto payloadHash = Details::RepeatFilter::HashPayload(optAppleData.value());
+
+    if (_deviceConnected) {
+        const auto optSide = _repeatFilter.Lookup(data.address, payloadHash, data.rssi);
+        if (optSide.has_value()) {
+            auto optResult = _stateMgr.OnAdvRepeated(optSide.value(), data.address, data.rssi);
+            if (optResult.has_value()) {
+                if (optResult->has_value()) {
+                    OnStateChanged(std::move(optResult->value()));
+                }
+                return true;
+            }
+        }
     }
-}
 
-bool Manager::OnAdvertisementReceived(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
-{
-    if (!Details::Advertisement::IsDesiredAdv(data)) {
+    auto optAdv = Details::Advertisement::TryDecode(data);
+    if (!optAdv.has_value()) {
         return false;
     }
 
-    Details::Advertisement adv{data};
+    _decryptor.Apply(optAdv.value());
 
-    LOG(Trace, "AirPods advertisement received. Data: {}, Address Hash: {}, RSSI: {}",
-        Helper::ToString(adv.GetDesensitizedData()), Helper::Hash(data.address), data.rssi);
+    LOG(Trace,
+        "AirPods advertisement received. Data: {}, Fields: {{{}}}, Identified: {}, "
+        "Address Hash: {}, RSSI: {}",
+        Helper::ToString(optAdv->GetDesensitizedData()), Helper::ToString(optAdv->GetProtocol()),
+        optAdv->IsIdentified(), Helper::Hash(data.address), data.rssi);
 
     if (!_deviceConnected) {
         LOG(Info, "AirPods advertisement received, but device disconnected.");
         return false;
     }
 
-    auto optUpdateEvent = _stateMgr.OnAdvReceived(Details::Advertisement{data});
-    if (optUpdateEvent.has_value()) {
-        OnStateChanged(std::move(optUpdateEvent.value()));
+    const auto side = optAdv->GetAdvState().side;
+
+    auto optResult = _stateMgr.OnAdvReceived(std::move(optAdv.value()));
+    if (optResult.has_value()) {
+        _repeatFilter.Remember(data.address, payloadHash, data.rssi, side);
+
+        if (optResult->has_value()) {
+            OnStateChanged(std::move(optResult->value()));
+        }
     }
     return true;
 }
 
+size_t Manager::OnIngestBatch(std::span<const Bluetooth::AdvertisementWatcher::ReceivedData> batch)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    size_t accepted = 0;
+    for (const auto &data : batch) {
+        accepted += OnAdvertisementReceived(data) ? 1 : 0;
+    }
+    return accepted;
+}
+
 void Manager::OnAdvWatcherStateChanged(
     Bluetooth::AdvertisementWatcher::State state, const std::optional<std::string> &optError)
 {
@@ -585,7 +1305,7 @@ std::vector<Bluetooth::Device> GetDevices()
 
                 const auto doErase =
                     vendorId != AppleCP::VendorId ||
-                    AppleCP::AirPods::GetModel(productId) == AirPods::Model::Unknown;
+                    GetModelByModelId(productId) == Model::Unknown;
 
                 LOG(Trace, "Device VendorId: '{}', ProductId: '{}', doErase: {}", vendorId,
                     productId, doErase);
@@ -18,10 +18,26 @@
 
 #pragma once
 
+#include <array>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <variant>
 #include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <condition_variable>
 
 #include "Bluetooth.h"
 #include "AppleCP.h"
+#include "Ingest.h"
+#include "Capture.h"
+
+namespace Core::LoadTest {
+class Generator;
+} // namespace Core::LoadTest
 
 namespace Core::AirPods {
 
@@ -67,72 +83,339 @@ struct State {
     bool operator==(const State &rhs) const = default;
 };
 
+// `State` packed into a single integer, for the ingest path and for crossing threads. Copying
+// doesn't allocate and comparing is one integer compare. Convert it to `State` only where the
+// rich type is needed, i.e. at the GUI edge.
+//
+//   bits  0..7   left battery    bit 7 is the valid bit, bits 0..6 the value
+//   bits  8..15  right battery
+//   bits 16..23  case battery
+//   bits 24..31  `Flag`s
+//   bits 32..39  model
+//   bits 48..63  display name, an id interned by `InternDisplayName`
+//
+class PackedState
+{
+public:
+    using NameId = uint16_t;
+
+    enum Flag : uint8_t {
+        LeftCharging = 1 << 0,
+        LeftInEar = 1 << 1,
+        RightCharging = 1 << 2,
+        RightInEar = 1 << 3,
+        CaseCharging = 1 << 4,
+        BothPodsInCase = 1 << 5,
+        LidOpened = 1 << 6,
+    };
+
+    // Id 0 is always the empty name. Names are never removed, there are only a few of them.
+    //
+    static NameId InternDisplayName(const QString &name);
+    static QString GetDisplayName(NameId id);
+
+    PackedState() = default;
+
+    static PackedState Pack(const State &state);
+    State Unpack() const;
+
+    // Unlike `Unpack`, these don't look up the display name
+    //
+    Model GetModel() const;
+    PodsState GetPods() const;
+    CaseState GetCase() const;
+    bool Has(Flag flag) const;
+    NameId GetDisplayNameId() const;
+    PackedState WithDisplayName(NameId id) const;
+
+    bool operator==(const PackedState &rhs) const = default;
+
+private:
+    uint64_t _bits{0};
+
+    explicit PackedState(uint64_t bits);
+};
+static_assert(sizeof(PackedState) <= 16 && std::is_trivially_copyable_v<PackedState>);
+
 //
 // Classes
 //
 
 namespace Details {
 
+struct DecryptedState {
+    BasicState left, right, caseBox;
+
+    bool operator==(const DecryptedState &rhs) const = default;
+};
+
+// The decoded form of an AirPods advertisement, built once per received frame.
+//
+// Only the fields the state manager needs and the raw frame (for desensitized logging) are kept,
+// so it is trivially copyable and cheap to pass around by value. The state is kept packed, the
+// raw frame takes about half of the size.
+//
 class Advertisement
 {
 public:
     using AddressType = decltype(Bluetooth::AdvertisementWatcher::ReceivedData::address);
+    using Timestamp = Bluetooth::AdvertisementWatcher::Timestamp;
 
-    struct AdvState : AirPods::State {
+    struct AdvState {
+        Model model{Model::Unknown};
+        PodsState pods;
+        CaseState caseBox;
         Side side;
     };
 
-    static bool IsDesiredAdv(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
-
-    Advertisement(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
+    // Looks up the Apple manufacturer data once, validates it once and decodes the state
+    // straight from the received bytes. Returns `std::nullopt` if it isn't an AirPods adv.
+    //
+    static std::optional<Advertisement>
+    TryDecode(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
 
     int16_t GetRssi() const;
-    const auto &GetTimestamp() const;
+    Timestamp GetTimestamp() const;
     AddressType GetAddress() const;
     std::vector<uint8_t> GetDesensitizedData() const;
-    const AdvState &GetAdvState() const;
+    const AppleCP::AirPods &GetProtocol() const;
+    AdvState GetAdvState() const;
+
+    // Replaces the coarse battery levels with the decrypted ones. Only called when the payload
+    // decrypted with the user's key agrees with the cleartext, i.e. it's broadcast from the user's
+    // device. The state manager binds to identified advertisements instead of guessing.
+    //
+    void ApplyDecrypted(const DecryptedState &decrypted);
+    bool IsIdentified() const;
 
 private:
-    Bluetooth::AdvertisementWatcher::ReceivedData _data;
+    Timestamp _timestamp;
+    AddressType _address;
+    PackedState _state;
+    int16_t _rssi;
+    bool _identified{false};
     AppleCP::AirPods _protocol;
-    AdvState _state;
 
-    const std::vector<uint8_t> &GetMfrData() const;
+    Advertisement(
+        const Bluetooth::AdvertisementWatcher::ReceivedData &data,
+        const AppleCP::AirPods &protocol);
+};
+static_assert(sizeof(Advertisement) <= 56 && std::is_trivially_copyable_v<Advertisement>);
+
+// Decrypts the encrypted payload of advertisements with the key of the user's device.
+//
+// A device keeps broadcasting the same payload until its state changes, so the last result is
+// cached per address to avoid decrypting every advertisement. The cache is a fixed ring, a new
+// address replaces the oldest one.
+//
+// It isn't thread-safe, the manager only uses it under its lock.
+//
+class Decryptor
+{
+public:
+    using AddressType = Advertisement::AddressType;
+
+    // The key is 32 hex digits, whitespace and colons are ignored
+    //
+    static std::optional<Aes::Key128> ParseKey(const QString &hex);
+
+    void SetKey(const std::optional<Aes::Key128> &key);
+    bool HasKey() const;
+
+    void Apply(Advertisement &adv);
+
+private:
+    constexpr static size_t kCacheCapacity = 32;
+
+    struct CacheEntry {
+        AddressType address{0};
+        Aes::Block ciphertext{};
+        Aes::Block plaintext{};
+        bool used{false};
+    };
+
+    std::optional<Aes::Aes128> _aes;
+    std::array<CacheEntry, kCacheCapacity> _cache;
+    size_t _cacheNext{0};
+
+    static DecryptedState Decode(const Aes::Block &plaintext);
+};
+
+// AirPods rebroadcast the same payload many times per second. This remembers the last accepted
+// Apple payload of each address, so a repeat can skip decoding, logging and most of the state
+// manager.
+//
+// It is a small open-addressing table, a full probe window overwrites its home slot, so the
+// memory use stays fixed no matter how many devices are around.
+//
+class RepeatFilter
+{
+public:
+    using AddressType = Advertisement::AddressType;
+
+    struct Counters {
+        uint64_t hits{0};
+        uint64_t misses{0};
+    };
+
+    static uint64_t HashPayload(std::span<const uint8_t> payload);
+
+    // Returns the side of the last accepted advertisement if the payload is unchanged and the
+    // RSSI is still in the same bucket
+    //
+    std::optional<Side> Lookup(AddressType address, uint64_t payloadHash, int16_t rssi);
+    void Remember(AddressType address, uint64_t payloadHash, int16_t rssi, Side side);
+    void Clear();
+
+    const Counters &GetCounters() const;
+
+private:
+    constexpr static size_t kCapacity = 64;
+    constexpr static size_t kMaxProbes = 4;
+    constexpr static int16_t kRssiBucketWidth = 4;
+
+    struct Slot {
+        AddressType address{0};
+        uint64_t payloadHash{0};
+        int16_t rssiBucket{0};
+        Side side{Side::Left};
+        bool used{false};
+    };
+
+    std::array<Slot, kCapacity> _slots;
+    Counters _counters;
+
+    static size_t HomeIndex(AddressType address);
+    static int16_t RssiBucket(int16_t rssi);
+};
+
+// Side effects of state transitions. They may be slow (media control starts WinRT calls), so
+// they are only emitted by the ingest path and run by `ActionExecutor` on its own thread.
+//
+namespace Actions {
+
+struct UpdateState {
+    PackedState state;
+};
+struct ShowPopup {
+};
+struct HidePopup {
+};
+struct MediaPlay {
+};
+struct MediaPause {
+};
+struct Disconnect {
+};
+} // namespace Actions
+
+using Action = std::variant<
+    Actions::UpdateState, Actions::ShowPopup, Actions::HidePopup, Actions::MediaPlay,
+    Actions::MediaPause, Actions::Disconnect>;
+
+// Runs actions one by one in the order they are posted
+//
+class ActionExecutor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Latency {
+        uint64_t count{0};
+        Clock::duration total{}, max{};
+
+        void Add(Clock::duration duration);
+    };
+
+    using PerAction = std::array<Latency, std::variant_size_v<Action>>;
+
+    struct Metrics {
+        Latency post;   // On the posting thread
+        PerAction wait; // Queued until started
+        PerAction run;  // Executing, the media actions only until they first suspend
+    };
+
+    ActionExecutor();
+    ~ActionExecutor();
+
+    void Post(Action action);
+
+    Metrics GetMetrics() const;
+
+private:
+    constexpr static auto kMetricsInterval = std::chrono::minutes{1};
+
+    struct Pending {
+        Action action;
+        Clock::time_point posted;
+    };
+
+    mutable std::mutex _mutex;
+    std::condition_variable _conVar;
+    std::deque<Pending> _queue;
+    Metrics _metrics;
+    bool _stop{false};
+    std::thread _thread;
+
+    void Thread();
+    static void Execute(const Action &action);
+    static std::string FormatMetrics(const Metrics &metrics);
 };
 
 // AirPods use Random Non-resolvable device addresses for privacy reasons. This means we
 // can't "Remember" the user's AirPods by any device property. Here we track our desired
-// devices in some non-elegant ways, but obviously it is sometimes unreliable.
+// devices in some non-elegant ways, but obviously it is sometimes unreliable. With the user's
+// proximity key the device is identified by its decrypted advs instead, see `Decryptor`.
 //
 class StateManager
 {
 public:
     struct UpdateEvent {
-        std::optional<State> oldState;
-        State newState;
+        std::optional<PackedState> oldState;
+        PackedState newState;
     };
 
-    StateManager();
+    // Published after every change of the current state
+    //
+    using Snapshot = Helper::Published<std::optional<PackedState>>::Snapshot;
 
-    std::optional<State> GetCurrentState() const;
+    explicit StateManager(ActionExecutor &executor);
 
-    std::optional<UpdateEvent> OnAdvReceived(Advertisement adv);
+    std::optional<State> GetCurrentState() const;
+    std::shared_ptr<const Snapshot> GetSnapshot() const;
+
+    // Cheaper than `GetSnapshot` for readers that poll for changes
+    //
+    uint64_t GetVersion() const;
+
+    // Returns `std::nullopt` if the adv is rejected, otherwise the update event if the state
+    // changed.
+    //
+    std::optional<std::optional<UpdateEvent>> OnAdvReceived(Advertisement adv);
+
+    // For an advertisement with the same payload as the last accepted one of its side. Returns
+    // `std::nullopt` if it can't be taken as a repeat and has to go through `OnAdvReceived`.
+    //
+    std::optional<std::optional<UpdateEvent>>
+    OnAdvRepeated(Side side, Advertisement::AddressType address, int16_t rssi);
     void Disconnect();
 
     void OnRssiMinChanged(int16_t rssiMin);
 
 private:
-    using Clock = std::chrono::steady_clock;
-    using Timestamp = std::chrono::time_point<Clock>;
+    using Timestamp = Helper::ClockSource::TimePoint;
 
     mutable std::mutex _mutex;
 
+    ActionExecutor &_executor;
     Helper::Timer _lostTimer;
     Helper::Sides<Helper::Timer> _stateResetTimer;
     Helper::Sides<std::optional<std::pair<Advertisement, Timestamp>>> _adv;
-    std::optional<State> _cachedState;
+    std::optional<PackedState> _cachedState;
     int16_t _rssiMin{std::numeric_limits<int16_t>::max()};
 
+    Helper::Published<std::optional<PackedState>> _published; // Only published under `_mutex`
+
     bool IsPossibleDesiredAdv(const Advertisement &adv) const;
     void UpdateAdv(Advertisement adv);
     std::optional<UpdateEvent> UpdateState();
@@ -147,6 +430,7 @@ class Manager
 {
 public:
     Manager();
+    ~Manager();
 
     void StartScanner();
     void StopScanner();
@@ -154,11 +438,21 @@ public:
     void OnRssiMinChanged(int16_t rssiMin);
     void OnAutomaticEarDetectionChanged(bool enable);
     void OnBoundDeviceAddressChanged(uint64_t address);
+    void OnProximityKeyChanged(const QString &key);
+
+    std::shared_ptr<const Details::StateManager::Snapshot> GetStateSnapshot() const;
 
 private:
+    friend class LoadTest::Generator;
+
     std::mutex _mutex;
-    Bluetooth::AdvertisementWatcher _adWatcher;
-    Details::StateManager _stateMgr;
+    Capture::Writer _recorder;
+    Ingest::Queue _ingest;
+    std::unique_ptr<Bluetooth::AdvertisementWatcherInterface> _adWatcher;
+    Details::Decryptor _decryptor;
+    Details::RepeatFilter _repeatFilter;
+    Details::ActionExecutor _executor;
+    Details::StateManager _stateMgr{_executor};
     std::optional<Bluetooth::Device> _boundDevice;
     QString _deviceName;
     bool _deviceConnected{false};
@@ -166,9 +460,10 @@ private:
 
     void OnBoundDeviceConnectionStateChanged(Bluetooth::DeviceState state);
     void OnStateChanged(Details::StateManager::UpdateEvent updateEvent);
-    void OnLidOpened(bool opened);
-    void OnBothInEar(bool isBothInEar);
     bool OnAdvertisementReceived(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
+    // Handles a batch of the ingest queue, returns how many advertisements were accepted
+    //
+    size_t OnIngestBatch(std::span<const Bluetooth::AdvertisementWatcher::ReceivedData> batch);
     void OnAdvWatcherStateChanged(
         Bluetooth::AdvertisementWatcher::State state, const std::optional<std::string> &optError);
 };
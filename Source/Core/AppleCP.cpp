@@ -18,9 +18,13 @@
 
 #include "AppleCP.h"
 
+#include <algorithm>
+
+#include "../Assert.h"
+
 namespace Core::AppleCP {
 
-bool AirPods::IsValid(const std::vector<uint8_t> &data)
+bool AirPods::IsValid(std::span<const uint8_t> data)
 {
     if (data.size() != sizeof(AirPods)) {
         return false;
@@ -29,7 +33,7 @@ bool AirPods::IsValid(const std::vector<uint8_t> &data)
     constexpr uint8_t shouldRemainingLength =
         sizeof(AirPods) - (offsetof(Header, remainingLength) + sizeof(Header::remainingLength));
 
-    Header *packet = (Header *)(data.data());
+    const Header *packet = (const Header *)(data.data());
     if (packet->packetType != PacketType::ProximityPairing ||
         packet->remainingLength != shouldRemainingLength)
     {
@@ -39,37 +43,66 @@ bool AirPods::IsValid(const std::vector<uint8_t> &data)
     return true;
 }
 
+AirPods AirPods::Encode(const Content &content)
+{
+    using Core::AirPods::Side;
+    namespace L = AirPodsLayout;
+
+    std::array<uint8_t, L::kSize> bytes{};
+
+    const auto set = [&](const Layout::Field &field, uint32_t value) {
+        Layout::Insert(field, bytes, value);
+    };
+    const auto battery = [](const Core::AirPods::Battery &battery) -> uint32_t {
+        return battery.Available() ? battery.Value() : 0xF;
+    };
+
+    const bool leftBroadcasted = content.broadcastedSide == Side::Left;
+    const auto &curr = [&](const auto &left, const auto &right) -> const auto & {
+        return leftBroadcasted ? left : right;
+    };
+    const auto &anot = [&](const auto &left, const auto &right) -> const auto & {
+        return leftBroadcasted ? right : left;
+    };
+
+    set(L::kPacketType, static_cast<uint32_t>(PacketType::ProximityPairing));
+    set(L::kRemainingLength, L::kSize - sizeof(Header));
+    set(L::kUnk1, 1);
+    set(L::kModelId, Core::AirPods::GetModelDescriptor(content.model).modelId);
+
+    set(L::kBroadcastFrom, leftBroadcasted ? 1 : 0);
+    set(L::kCurrInEar, curr(content.leftInEar, content.rightInEar));
+    set(L::kAnotInEar, anot(content.leftInEar, content.rightInEar));
+    set(L::kBothInCase, content.bothPodsInCase);
+
+    set(L::kCurrBattery, battery(curr(content.leftBattery, content.rightBattery)));
+    set(L::kAnotBattery, battery(anot(content.leftBattery, content.rightBattery)));
+    set(L::kCaseBattery, battery(content.caseBattery));
+    set(L::kCurrCharging, curr(content.leftCharging, content.rightCharging));
+    set(L::kAnotCharging, anot(content.leftCharging, content.rightCharging));
+    set(L::kCaseCharging, content.caseCharging);
+
+    set(L::kLidSwitchCount, content.lidSwitchCount);
+    set(L::kLidClosed, !content.lidOpened);
+
+    std::copy(
+        content.encryptedPayload.begin(), content.encryptedPayload.end(),
+        bytes.begin() + L::kUnk12.byteOffset);
+
+    const auto *result = AsView<AirPods>(bytes);
+    APD_ASSERT(result != nullptr);
+    return *result;
+}
+
 Core::AirPods::Model AirPods::GetModel(uint16_t modelId)
 {
-    switch (modelId) {
-    case 0x2002:
-        return Core::AirPods::Model::AirPods_1;
-    case 0x200F:
-        return Core::AirPods::Model::AirPods_2;
-    case 0x2013:
-        return Core::AirPods::Model::AirPods_3;
-    case 0x200E:
-        return Core::AirPods::Model::AirPods_Pro;
-    case 0x2014:
-        return Core::AirPods::Model::AirPods_Pro_2;
-    case 0x200A:
-        return Core::AirPods::Model::AirPods_Max;
-        // case 0x2003:
-        //    return Core::AirPods::Model::Powerbeats_3;
-        // case 0x2005:
-        //    return Core::AirPods::Model::Beats_X;
-        // case 0x2006:
-        //    return Core::AirPods::Model::Beats_Solo3;
-    case 0x2012:
-        return Core::AirPods::Model::Beats_Fit_Pro;
-    default:
-        return Core::AirPods::Model::Unknown;
-    }
+    return Core::AirPods::GetModelByModelId(modelId);
 }
 
 Core::AirPods::Side AirPods::GetBroadcastedSide() const
 {
-    return broadcastFrom == 1 ? Core::AirPods::Side::Left : Core::AirPods::Side::Right;
+    return Get<AirPodsLayout::kBroadcastFrom>() == 1 ? Core::AirPods::Side::Left
+                                                     : Core::AirPods::Side::Right;
 }
 
 bool AirPods::IsLeftBroadcasted() const
@@ -84,50 +117,54 @@ bool AirPods::IsRightBroadcasted() const
 
 Core::AirPods::Model AirPods::GetModel() const
 {
-    return GetModel(modelId);
+    return GetModel(static_cast<uint16_t>(Get<AirPodsLayout::kModelId>()));
 }
 
 Core::AirPods::Battery AirPods::GetLeftBattery() const
 {
-    const auto val = (IsLeftBroadcasted() ? battery.curr : battery.anot);
-    return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
+    const auto val = IsLeftBroadcasted() ? Get<AirPodsLayout::kCurrBattery>()
+                                         : Get<AirPodsLayout::kAnotBattery>();
+    return val <= 10 ? Core::AirPods::Battery{val} : Core::AirPods::Battery{};
 }
 
 Core::AirPods::Battery AirPods::GetRightBattery() const
 {
-    const auto val = (IsRightBroadcasted() ? battery.curr : battery.anot);
-    return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
+    const auto val = IsRightBroadcasted() ? Get<AirPodsLayout::kCurrBattery>()
+                                          : Get<AirPodsLayout::kAnotBattery>();
+    return val <= 10 ? Core::AirPods::Battery{val} : Core::AirPods::Battery{};
 }
 
 Core::AirPods::Battery AirPods::GetCaseBattery() const
 {
-    const auto val = battery.caseBox;
-    return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
+    const auto val = Get<AirPodsLayout::kCaseBattery>();
+    return val <= 10 ? Core::AirPods::Battery{val} : Core::AirPods::Battery{};
 }
 
 bool AirPods::IsLeftCharging() const
 {
-    return (IsLeftBroadcasted() ? battery.currCharging : battery.anotCharging) != 0;
+    return (IsLeftBroadcasted() ? Get<AirPodsLayout::kCurrCharging>()
+                                : Get<AirPodsLayout::kAnotCharging>()) != 0;
 }
 
 bool AirPods::IsRightCharging() const
 {
-    return (IsRightBroadcasted() ? battery.currCharging : battery.anotCharging) != 0;
+    return (IsRightBroadcasted() ? Get<AirPodsLayout::kCurrCharging>()
+                                 : Get<AirPodsLayout::kAnotCharging>()) != 0;
 }
 
 bool AirPods::IsBothPodsInCase() const
 {
-    return bothInCase;
+    return Get<AirPodsLayout::kBothInCase>() != 0;
 }
 
 bool AirPods::IsLidOpened() const
 {
-    return lid.closed == 0;
+    return Get<AirPodsLayout::kLidClosed>() == 0;
 }
 
 bool AirPods::IsCaseCharging() const
 {
-    return battery.caseCharging;
+    return Get<AirPodsLayout::kCaseCharging>() != 0;
 }
 
 bool AirPods::IsLeftInEar() const
@@ -135,23 +172,75 @@ bool AirPods::IsLeftInEar() const
     // If it's charging, the "ear" will be set in one of the multiple devices, idk why..
     // so we need to filter it
     //     vvvvvvvvvvvvvvvvvvvv
-    return !IsLeftCharging() && (IsLeftBroadcasted() ? currInEar : anotInEar);
+    return !IsLeftCharging() && (IsLeftBroadcasted() ? Get<AirPodsLayout::kCurrInEar>()
+                                                      : Get<AirPodsLayout::kAnotInEar>()) != 0;
 }
 
 bool AirPods::IsRightInEar() const
 {
-    return !IsRightCharging() && (IsRightBroadcasted() ? currInEar : anotInEar);
+    return !IsRightCharging() && (IsRightBroadcasted() ? Get<AirPodsLayout::kCurrInEar>()
+                                                        : Get<AirPodsLayout::kAnotInEar>()) != 0;
 }
 
 AirPods AirPods::Desensitize() const
 {
     auto result = *this;
 
-    // This field may be some kind of hash or encrypted payload.
-    // So it may contain personal information about the user.
+    // Some fields may be some kind of hash or encrypted payload.
+    // So they may contain personal information about the user.
     //
-    std::memset(result.unk12, 0, sizeof(result.unk12));
+    std::span<uint8_t> bytes{reinterpret_cast<uint8_t *>(&result), sizeof(result)};
+    for (const auto *field : AirPodsLayout::kFields) {
+        if (!field->sensitive) {
+            continue;
+        }
+        if (field->width > 32) {
+            std::fill_n(bytes.begin() + field->byteOffset, field->ByteSize(), 0);
+        }
+        else {
+            Layout::Insert(*field, bytes, 0);
+        }
+    }
+
+    return result;
+}
+
+Aes::Block AirPods::GetEncryptedPayload() const
+{
+    static_assert(AirPodsLayout::kUnk12.ByteSize() == sizeof(Aes::Block));
 
+    Aes::Block result;
+    const auto bytes = Bytes().subspan(AirPodsLayout::kUnk12.byteOffset, result.size());
+    std::copy(bytes.begin(), bytes.end(), result.begin());
     return result;
 }
+
+bool AirPods::IsConsistentPayload(const Aes::Block &plaintext) const
+{
+    namespace PL = AirPodsPayloadLayout;
+
+    const auto consistent = [&]<const Layout::Field &kBattery, const Layout::Field &kCharging>(
+                                const Core::AirPods::Battery &battery, bool isCharging) {
+        if ((Layout::Extract<kCharging>(plaintext) != 0) != isCharging) {
+            return false;
+        }
+
+        const auto percent = Layout::Extract<kBattery>(plaintext);
+        if (!battery.Available()) {
+            return percent == PL::kBatteryUnavailable;
+        }
+
+        // The cleartext is in steps of 10%, whether it's rounded up or down is unknown
+        //
+        const auto step = battery.Value() * 10;
+        return percent <= 100 && percent + 10 > step && percent < step + 10;
+    };
+
+    return consistent.template operator()<PL::kLeftBattery, PL::kLeftCharging>(
+               GetLeftBattery(), IsLeftCharging()) &&
+           consistent.template operator()<PL::kRightBattery, PL::kRightCharging>(
+               GetRightBattery(), IsRightCharging()) &&
+           consistent.template operator()<PL::kCaseBattery, PL::kCaseCharging>(
+               GetCaseBattery(), IsCaseCharging());
+}
 } // namespace Core::AppleCP
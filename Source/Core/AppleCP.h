@@ -18,16 +18,19 @@
 
 #pragma once
 
+#include <span>
+#include <array>
 #include <vector>
+#include <limits>
+#include <string_view>
 
+#include "Aes.h"
 #include "Base.h"
 
 // AppleCP = Apple Continuity Protocols
 //
 namespace Core::AppleCP {
 
-#pragma pack(push)
-#pragma pack(1)
 enum class PacketType : uint8_t {
     AirPrint = 0x3,
     AirDrop = 0x5,
@@ -66,6 +69,62 @@ struct Header {
 
 constexpr uint16_t VendorId = 76;
 
+// Protocol structures are described field by field as (byte offset, bit offset, width) instead of
+// packed bitfields, so that decoding doesn't depend on how a compiler lays out bitfields or on
+// the endianness of the host. Multi-byte fields are little-endian.
+//
+// Extracting a field is a handful of loads, shifts and masks that the compiler folds into
+// constants, and the same descriptions drive the desensitizer and the pretty printer.
+//
+namespace Layout {
+
+struct Field {
+    std::string_view name;
+    uint8_t byteOffset;
+    uint8_t bitOffset; // From the least significant bit of the byte at `byteOffset`
+    uint16_t width;    // In bits. Fields wider than 32 bits must be whole bytes
+    bool sensitive{false};
+
+    constexpr size_t ByteSize() const
+    {
+        return (bitOffset + width + 7) / 8;
+    }
+};
+
+template <const Field &kField>
+constexpr uint32_t Extract(std::span<const uint8_t> bytes)
+{
+    static_assert(kField.width > 0 && kField.width <= 32);
+
+    uint64_t word = 0;
+    for (size_t i = 0; i < kField.ByteSize(); ++i) {
+        word |= static_cast<uint64_t>(bytes[kField.byteOffset + i]) << (i * 8);
+    }
+    return static_cast<uint32_t>((word >> kField.bitOffset) & ((uint64_t{1} << kField.width) - 1));
+}
+
+inline uint32_t Extract(const Field &field, std::span<const uint8_t> bytes)
+{
+    uint64_t word = 0;
+    for (size_t i = 0; i < field.ByteSize(); ++i) {
+        word |= static_cast<uint64_t>(bytes[field.byteOffset + i]) << (i * 8);
+    }
+    return static_cast<uint32_t>((word >> field.bitOffset) & ((uint64_t{1} << field.width) - 1));
+}
+
+inline void Insert(const Field &field, std::span<uint8_t> bytes, uint32_t value)
+{
+    const uint64_t mask = ((uint64_t{1} << field.width) - 1) << field.bitOffset;
+    const uint64_t bits = (static_cast<uint64_t>(value) << field.bitOffset) & mask;
+
+    for (size_t i = 0; i < field.ByteSize(); ++i) {
+        auto &byte = bytes[field.byteOffset + i];
+        const auto byteMask = static_cast<uint8_t>(mask >> (i * 8));
+        byte = static_cast<uint8_t>((byte & ~byteMask) | static_cast<uint8_t>(bits >> (i * 8)));
+    }
+}
+} // namespace Layout
+
 // About "Flipped":
 //
 //      In other similar projects, you may see a variable called "IsFlipped".
@@ -97,10 +156,84 @@ constexpr uint16_t VendorId = 76;
 //      one earphone is working and the other is charging (lid opened), the Bluetooth device in
 //      both earphones is made discoverable, and the battery of the case is sent and synced.
 //
+namespace AirPodsLayout {
+
+// clang-format off
+inline constexpr Layout::Field kPacketType     {"packetType",      0, 0, 8};
+inline constexpr Layout::Field kRemainingLength{"remainingLength", 1, 0, 8};
+inline constexpr Layout::Field kUnk1           {"unk1",            2, 0, 8};
+inline constexpr Layout::Field kModelId        {"modelId",         3, 0, 16};
+inline constexpr Layout::Field kUnk4           {"unk4",            5, 0, 1};
+inline constexpr Layout::Field kCurrInEar      {"currInEar",       5, 1, 1};
+inline constexpr Layout::Field kBothInCase     {"bothInCase",      5, 2, 1};
+inline constexpr Layout::Field kAnotInEar      {"anotInEar",       5, 3, 1};
+inline constexpr Layout::Field kUnk6           {"unk6",            5, 4, 1};
+inline constexpr Layout::Field kBroadcastFrom  {"broadcastFrom",   5, 5, 1}; // This advertisement is broadcast from which earphone.
+inline constexpr Layout::Field kUnk7           {"unk7",            5, 6, 1};
+inline constexpr Layout::Field kUnk8           {"unk8",            5, 7, 1};
+inline constexpr Layout::Field kCurrBattery    {"currBattery",     6, 0, 4}; // Battery remaining [0, 10], otherwise unavailable
+inline constexpr Layout::Field kAnotBattery    {"anotBattery",     6, 4, 4}; // Battery remaining [0, 10], otherwise unavailable
+inline constexpr Layout::Field kCaseBattery    {"caseBattery",     7, 0, 4}; // Battery remaining [0, 10], otherwise unavailable
+inline constexpr Layout::Field kCurrCharging   {"currCharging",    7, 4, 1};
+inline constexpr Layout::Field kAnotCharging   {"anotCharging",    7, 5, 1};
+inline constexpr Layout::Field kCaseCharging   {"caseCharging",    7, 6, 1};
+inline constexpr Layout::Field kUnk9           {"unk9",            7, 7, 1};
+inline constexpr Layout::Field kLidSwitchCount {"lidSwitchCount",  8, 0, 3}; // This count increases if the lid opened or closed once, and
+                                                                             // resets if overflow or no longer broadcasting advertisements
+inline constexpr Layout::Field kLidClosed      {"lidClosed",       8, 3, 1};
+inline constexpr Layout::Field kUnk10          {"unk10",           8, 4, 4};
+inline constexpr Layout::Field kColor          {"color",           9, 0, 8}; // Untested because I don't have a device other than white
+inline constexpr Layout::Field kUnk11          {"unk11",          10, 0, 8};
+inline constexpr Layout::Field kUnk12          {"unk12",          11, 0, 128, true}; // Hash or encrypted payload
+// clang-format on
+
+inline constexpr std::array kFields{
+    &kPacketType,  &kRemainingLength, &kUnk1,         &kModelId,        &kUnk4,
+    &kCurrInEar,   &kBothInCase,      &kAnotInEar,    &kUnk6,           &kBroadcastFrom,
+    &kUnk7,        &kUnk8,            &kCurrBattery,  &kAnotBattery,    &kCaseBattery,
+    &kCurrCharging, &kAnotCharging,   &kCaseCharging, &kUnk9,           &kLidSwitchCount,
+    &kLidClosed,   &kUnk10,           &kColor,        &kUnk11,          &kUnk12,
+};
+
+inline constexpr size_t kSize = 27;
+
+static_assert(
+    [] {
+        // Every bit is described exactly once
+        //
+        size_t bits = 0, nextByte = 0, nextBit = 0;
+        for (const auto *field : kFields) {
+            if (field->byteOffset != nextByte || field->bitOffset != nextBit) {
+                return false;
+            }
+            bits += field->width;
+            nextByte = bits / 8;
+            nextBit = bits % 8;
+        }
+        return bits == kSize * 8;
+    }(),
+    "The AirPods layout has gaps or overlaps.");
+} // namespace AirPodsLayout
+
 class AirPods : Header
 {
 public:
-    static bool IsValid(const std::vector<uint8_t> &data);
+    // The inverse of the accessors below. Batteries are in [0, 10] like `Get*Battery()` return.
+    //
+    struct Content {
+        Core::AirPods::Model model{Core::AirPods::Model::Unknown};
+        Core::AirPods::Side broadcastedSide{Core::AirPods::Side::Left};
+        Core::AirPods::Battery leftBattery, rightBattery, caseBattery;
+        bool leftCharging{false}, rightCharging{false}, caseCharging{false};
+        bool leftInEar{false}, rightInEar{false};
+        bool bothPodsInCase{false};
+        bool lidOpened{false};
+        uint8_t lidSwitchCount{0};
+        Aes::Block encryptedPayload{};
+    };
+
+    static bool IsValid(std::span<const uint8_t> data);
+    static AirPods Encode(const Content &content);
     static Core::AirPods::Model GetModel(uint16_t modelId);
 
     Core::AirPods::Side GetBroadcastedSide() const;
@@ -125,51 +258,152 @@ public:
 
     AirPods Desensitize() const;
 
+    // The `unk12` field, which is encrypted with a key exchanged while pairing. See
+    // `AirPodsPayloadLayout` for the decrypted content.
+    //
+    Aes::Block GetEncryptedPayload() const;
+
+    // Whether a decrypted payload agrees with the cleartext batteries and charging bits of this
+    // frame. AES has no integrity check and no constant of the plaintext is known, so this is
+    // what tells a payload decrypted with the right key from random bytes.
+    //
+    bool IsConsistentPayload(const Aes::Block &plaintext) const;
+
+    inline std::span<const uint8_t, AirPodsLayout::kSize> Bytes() const
+    {
+        return std::span<const uint8_t, AirPodsLayout::kSize>{
+            reinterpret_cast<const uint8_t *>(this), AirPodsLayout::kSize};
+    }
+
 private:
-    uint8_t unk1[1];
-    uint16_t modelId;
-    struct {
-        uint8_t unk4 : 1;
-        uint8_t currInEar : 1;
-        uint8_t bothInCase : 1;
-        uint8_t anotInEar : 1;
-        uint8_t unk6 : 1;
-        uint8_t broadcastFrom : 1; // This advertisement is broadcast from which earphone.
-        uint8_t unk7 : 1;
-        uint8_t unk8 : 1;
-    };
-    struct {
-        uint8_t curr : 4;         // Battery remaining [0, 10], otherwise unavailable
-        uint8_t anot : 4;         // Battery remaining [0, 10], otherwise unavailable
-        uint8_t caseBox : 4;      // Battery remaining [0, 10], otherwise unavailable
-        uint8_t currCharging : 1; // If it's charging (value != 0)
-        uint8_t anotCharging : 1; // If it's charging (value != 0)
-        uint8_t caseCharging : 1; // If it's charging (value != 0)
-        uint8_t unk9 : 1;
-    } battery;
-    struct {
-        uint8_t switchCount : 3; // This count increases if the lid opened or closed once, and
-                                 // resets if overflow or no longer broadcasting advertisements
-        uint8_t closed : 1;
-        uint8_t unk10 : 4;
-    } lid;
-    Color color; // Untested because I don't have a device other than white
-    uint8_t unk11[1];
-    uint8_t unk12[16]; // Hash or encrypted payload
+    uint8_t _body[AirPodsLayout::kSize - sizeof(Header)];
+
+    template <const Layout::Field &kField>
+    inline uint32_t Get() const
+    {
+        return Layout::Extract<kField>(Bytes());
+    }
 };
 static_assert(sizeof(AirPods) == 27);
-#pragma pack(pop)
+
+// The decrypted `AirPods::GetEncryptedPayload()`.
+//
+// Only the battery bytes are known, from community reverse engineering. Untested with a real key.
+// Batteries are in percent, 0x7F means unavailable.
+//
+namespace AirPodsPayloadLayout {
+
+// clang-format off
+inline constexpr Layout::Field kLeftBattery  {"leftBattery",  1, 0, 7};
+inline constexpr Layout::Field kLeftCharging {"leftCharging", 1, 7, 1};
+inline constexpr Layout::Field kRightBattery {"rightBattery", 2, 0, 7};
+inline constexpr Layout::Field kRightCharging{"rightCharging",2, 7, 1};
+inline constexpr Layout::Field kCaseBattery  {"caseBattery",  3, 0, 7};
+inline constexpr Layout::Field kCaseCharging {"caseCharging", 3, 7, 1};
+// clang-format on
+
+inline constexpr uint32_t kBatteryUnavailable = 0x7F;
+
+} // namespace AirPodsPayloadLayout
 
 template <class T>
 concept KindOfACPStruct = std::is_base_of_v<Header, T>;
 
+// Returns a non-owning view of the data, or `nullptr` if it's invalid.
+// The view is valid as long as the underlying buffer is alive and unmodified.
+//
 template <KindOfACPStruct T>
-std::optional<T> As(const std::vector<uint8_t> &data)
+const T *AsView(std::span<const uint8_t> data)
 {
     if (!T::IsValid(data)) {
+        return nullptr;
+    }
+
+    static_assert(alignof(T) == 1);
+    return reinterpret_cast<const T *>(data.data());
+}
+
+template <KindOfACPStruct T>
+std::optional<T> As(std::span<const uint8_t> data)
+{
+    const T *view = AsView<T>(data);
+    if (view == nullptr) {
         return std::nullopt;
     }
 
-    return *(T *)data.data();
+    return *view;
 }
+
+// An Apple manufacturer data payload is a sequence of type-length-value messages, each one
+// starts with a `Header`. `MessageDispatcher` walks through a payload once and dispatches each
+// message (including its header) to the decoder registered for its type through a jump table.
+// It never allocates.
+//
+template <class Context>
+class MessageDispatcher
+{
+public:
+    using FnDecoder = void (*)(Context &context, std::span<const uint8_t> message);
+
+    constexpr MessageDispatcher &Register(PacketType type, FnDecoder decoder)
+    {
+        _decoders[Helper::ToUnderlying(type)] = decoder;
+        return *this;
+    }
+
+    // Returns false if the payload is malformed. The messages before the malformed one are
+    // still dispatched.
+    //
+    bool Walk(std::span<const uint8_t> payload, Context &context) const
+    {
+        while (!payload.empty()) {
+            if (payload.size() < sizeof(Header)) {
+                return false;
+            }
+
+            const size_t messageSize =
+                sizeof(Header) + payload[offsetof(Header, remainingLength)];
+            if (payload.size() < messageSize) {
+                return false;
+            }
+
+            const auto decoder = _decoders[payload[offsetof(Header, packetType)]];
+            if (decoder != nullptr) {
+                decoder(context, payload.first(messageSize));
+            }
+            payload = payload.subspan(messageSize);
+        }
+        return true;
+    }
+
+private:
+    std::array<FnDecoder, std::numeric_limits<uint8_t>::max() + 1> _decoders{};
+};
 } // namespace Core::AppleCP
+
+template <>
+inline QString Helper::ToString<Core::AppleCP::AirPods>(const Core::AppleCP::AirPods &value)
+{
+    QString result;
+
+    for (const auto *field : Core::AppleCP::AirPodsLayout::kFields) {
+        if (!result.isEmpty()) {
+            result += ' ';
+        }
+        result += QString::fromUtf8(field->name.data(), static_cast<int>(field->name.size()));
+        result += '=';
+
+        if (field->sensitive) {
+            result += "**";
+        }
+        else if (field->width > 32) {
+            const auto bytes = value.Bytes().subspan(field->byteOffset, field->ByteSize());
+            result += ToString(std::vector<uint8_t>{bytes.begin(), bytes.end()});
+        }
+        else {
+            result += QString::number(Core::AppleCP::Layout::Extract(*field, value.Bytes()));
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,410 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "AppleCPBatch.h"
+
+#include <cstring>
+
+#include "Cpu.h"
+
+namespace Core::AppleCP::Batch {
+
+namespace {
+
+// The SIMD kernels work on two little-endian dwords of each frame:
+//
+//   head     The 4 bytes starting at `kHeadOffset`, whose high word is the model id.
+//   status   The 4 bytes right after it, which cover the in-ear bits, the battery nibbles, the
+//            charging bits and the lid byte.
+//
+// Bit positions below are relative to the status dword and derived from `AirPodsLayout`.
+//
+constexpr size_t kHeadOffset = 1;
+constexpr size_t kStatusOffset = kHeadOffset + 4;
+
+static_assert(
+    AirPodsLayout::kModelId.byteOffset == kHeadOffset + 2 &&
+        AirPodsLayout::kModelId.bitOffset == 0 && AirPodsLayout::kModelId.width == 16,
+    "The model id must be the high word of the head dword.");
+
+constexpr int StatusBit(const Layout::Field &field)
+{
+    return (field.byteOffset - static_cast<int>(kStatusOffset)) * 8 + field.bitOffset;
+}
+
+constexpr int kBitCurrInEar = StatusBit(AirPodsLayout::kCurrInEar);
+constexpr int kBitBothInCase = StatusBit(AirPodsLayout::kBothInCase);
+constexpr int kBitAnotInEar = StatusBit(AirPodsLayout::kAnotInEar);
+constexpr int kBitBroadcastFrom = StatusBit(AirPodsLayout::kBroadcastFrom);
+constexpr int kBitCurrBattery = StatusBit(AirPodsLayout::kCurrBattery);
+constexpr int kBitAnotBattery = StatusBit(AirPodsLayout::kAnotBattery);
+constexpr int kBitCaseBattery = StatusBit(AirPodsLayout::kCaseBattery);
+constexpr int kBitCurrCharging = StatusBit(AirPodsLayout::kCurrCharging);
+constexpr int kBitAnotCharging = StatusBit(AirPodsLayout::kAnotCharging);
+constexpr int kBitCaseCharging = StatusBit(AirPodsLayout::kCaseCharging);
+constexpr int kBitLidClosed = StatusBit(AirPodsLayout::kLidClosed);
+
+static_assert(
+    [] {
+        for (int bit : {kBitCurrInEar, kBitBothInCase, kBitAnotInEar, kBitBroadcastFrom,
+                        kBitCurrBattery + 3, kBitAnotBattery + 3, kBitCaseBattery + 3,
+                        kBitCurrCharging, kBitAnotCharging, kBitCaseCharging, kBitLidClosed})
+        {
+            if (bit < 0 || bit >= 32) {
+                return false;
+            }
+        }
+        return true;
+    }(),
+    "The fields used by the SIMD kernels must lie in the status dword.");
+
+// Model values are the indices of the descriptor table, see `kModelDescriptors`
+//
+static_assert(Helper::ToUnderlying(Core::AirPods::Model::Unknown) == 0);
+static_assert(Helper::ToUnderlying(Core::AirPods::Model::_Max) <= 0xFF);
+static_assert(sizeof(Core::AirPods::Model) == sizeof(uint32_t));
+static_assert(sizeof(Core::AirPods::Side) == sizeof(uint32_t));
+
+uint8_t ToColumn(const Core::AirPods::Battery &battery)
+{
+    return battery.Available() ? static_cast<uint8_t>(battery.Value()) : kBatteryUnavailable;
+}
+
+// The scalar kernel goes through the per-packet accessors, so it's the reference for the others
+//
+void DecodeScalar(const AirPods *frames, size_t begin, size_t end, const Columns &columns)
+{
+    for (size_t i = begin; i < end; ++i) {
+        const auto &frame = frames[i];
+
+        columns.model[i] = frame.GetModel();
+        columns.leftBattery[i] = ToColumn(frame.GetLeftBattery());
+        columns.rightBattery[i] = ToColumn(frame.GetRightBattery());
+        columns.caseBattery[i] = ToColumn(frame.GetCaseBattery());
+        columns.charging[i] = (frame.IsLeftCharging() ? LeftCharging : 0) |
+                              (frame.IsRightCharging() ? RightCharging : 0) |
+                              (frame.IsCaseCharging() ? CaseCharging : 0);
+        columns.inEar[i] =
+            (frame.IsLeftInEar() ? LeftInEar : 0) | (frame.IsRightInEar() ? RightInEar : 0);
+        columns.bothInCase[i] = frame.IsBothPodsInCase();
+        columns.lidOpened[i] = frame.IsLidOpened();
+        columns.side[i] = frame.GetBroadcastedSide();
+    }
+}
+
+#if defined APD_ARCH_X86
+
+//
+// SSE2
+//
+
+// Transposes the 8 bytes starting at `kHeadOffset` of 4 frames into a vector of head dwords and
+// a vector of status dwords
+//
+inline void Load128(const AirPods *frames, __m128i &head, __m128i &status)
+{
+    const auto load = [](const AirPods &frame) {
+        return _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+            reinterpret_cast<const uint8_t *>(&frame) + kHeadOffset));
+    };
+
+    // h0 h1 s0 s1, h2 h3 s2 s3
+    //
+    const __m128i low = _mm_unpacklo_epi32(load(frames[0]), load(frames[1]));
+    const __m128i high = _mm_unpacklo_epi32(load(frames[2]), load(frames[3]));
+
+    head = _mm_unpacklo_epi64(low, high);
+    status = _mm_unpackhi_epi64(low, high);
+}
+
+// `GetModelByModelId` for each lane. There are only a handful of known model ids, so comparing
+// with all of them is cheaper than looking up the hash table lane by lane.
+//
+inline __m128i Model128(__m128i head)
+{
+    const __m128i modelId = _mm_srli_epi32(head, 16);
+
+    __m128i result = _mm_setzero_si128();
+    for (const auto &descriptor : Core::AirPods::Details::kModelDescriptors) {
+        if (descriptor.modelId != 0) {
+            const __m128i matched = _mm_cmpeq_epi32(modelId, _mm_set1_epi32(descriptor.modelId));
+            result = _mm_or_si128(
+                result,
+                _mm_and_si128(matched, _mm_set1_epi32(Helper::ToUnderlying(descriptor.model))));
+        }
+    }
+    return result;
+}
+
+inline __m128i Bit128(__m128i value, int bit)
+{
+    return _mm_and_si128(_mm_srl_epi32(value, _mm_cvtsi32_si128(bit)), _mm_set1_epi32(1));
+}
+
+inline __m128i Nibble128(__m128i value, int bit)
+{
+    return _mm_and_si128(_mm_srl_epi32(value, _mm_cvtsi32_si128(bit)), _mm_set1_epi32(0xF));
+}
+
+inline __m128i Select128(__m128i mask, __m128i ifSet, __m128i ifUnset)
+{
+    return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifUnset));
+}
+
+inline __m128i Battery128(__m128i value)
+{
+    const __m128i unavailable = _mm_cmpgt_epi32(value, _mm_set1_epi32(10));
+    return Select128(unavailable, _mm_set1_epi32(kBatteryUnavailable), value);
+}
+
+inline void StoreBytes128(uint8_t *dest, __m128i value)
+{
+    const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(value, value), _mm_setzero_si128());
+    const uint32_t bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+    std::memcpy(dest, &bytes, sizeof(bytes));
+}
+
+size_t DecodeSse2(const AirPods *frames, size_t count, const Columns &columns)
+{
+    constexpr size_t kLanes = 4;
+
+    const __m128i one = _mm_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + kLanes <= count; i += kLanes) {
+        __m128i head, status;
+        Load128(&frames[i], head, status);
+
+        const __m128i broadcastFrom = Bit128(status, kBitBroadcastFrom);
+        const __m128i leftBroadcasted = _mm_sub_epi32(_mm_setzero_si128(), broadcastFrom);
+
+        const __m128i currBattery = Nibble128(status, kBitCurrBattery);
+        const __m128i anotBattery = Nibble128(status, kBitAnotBattery);
+        const __m128i currCharging = Bit128(status, kBitCurrCharging);
+        const __m128i anotCharging = Bit128(status, kBitAnotCharging);
+        const __m128i currInEar = Bit128(status, kBitCurrInEar);
+        const __m128i anotInEar = Bit128(status, kBitAnotInEar);
+
+        const __m128i leftCharging = Select128(leftBroadcasted, currCharging, anotCharging);
+        const __m128i rightCharging = Select128(leftBroadcasted, anotCharging, currCharging);
+        const __m128i caseCharging = Bit128(status, kBitCaseCharging);
+
+        const __m128i leftInEar =
+            _mm_andnot_si128(leftCharging, Select128(leftBroadcasted, currInEar, anotInEar));
+        const __m128i rightInEar =
+            _mm_andnot_si128(rightCharging, Select128(leftBroadcasted, anotInEar, currInEar));
+
+        StoreBytes128(
+            columns.leftBattery + i,
+            Battery128(Select128(leftBroadcasted, currBattery, anotBattery)));
+        StoreBytes128(
+            columns.rightBattery + i,
+            Battery128(Select128(leftBroadcasted, anotBattery, currBattery)));
+        StoreBytes128(columns.caseBattery + i, Battery128(Nibble128(status, kBitCaseBattery)));
+        StoreBytes128(
+            columns.charging + i,
+            _mm_or_si128(
+                leftCharging,
+                _mm_or_si128(_mm_slli_epi32(rightCharging, 1), _mm_slli_epi32(caseCharging, 2))));
+        StoreBytes128(columns.inEar + i, _mm_or_si128(leftInEar, _mm_slli_epi32(rightInEar, 1)));
+        StoreBytes128(columns.bothInCase + i, Bit128(status, kBitBothInCase));
+        StoreBytes128(columns.lidOpened + i, _mm_xor_si128(Bit128(status, kBitLidClosed), one));
+
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(columns.side + i), _mm_xor_si128(broadcastFrom, one));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(columns.model + i), Model128(head));
+    }
+    return i;
+}
+
+//
+// AVX2
+//
+
+// The model id hash table widened to dwords of `modelId << 8 | model`, so a gathered lane can be
+// verified against the model id it was looked up with
+//
+constexpr auto kWideModelIdHashTable = [] {
+    using namespace Core::AirPods::Details;
+
+    std::array<uint32_t, kModelIdHashTable.size()> result{};
+    for (size_t i = 0; i < result.size(); ++i) {
+        const auto &descriptor = kModelDescriptors[kModelIdHashTable[i]];
+        result[i] = static_cast<uint32_t>(descriptor.modelId) << 8 |
+                    Helper::ToUnderlying(descriptor.model);
+    }
+    return result;
+}();
+
+APD_TARGET_AVX2 inline __m256i Model256(__m256i head)
+{
+    const __m256i modelId = _mm256_srli_epi32(head, 16);
+    const __m256i entry = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(kWideModelIdHashTable.data()),
+        _mm256_and_si256(
+            modelId, _mm256_set1_epi32(static_cast<int>(kWideModelIdHashTable.size() - 1))),
+        sizeof(uint32_t));
+
+    const __m256i matched = _mm256_cmpeq_epi32(_mm256_srli_epi32(entry, 8), modelId);
+    return _mm256_and_si256(matched, _mm256_and_si256(entry, _mm256_set1_epi32(0xFF)));
+}
+
+APD_TARGET_AVX2 inline __m256i Bit256(__m256i value, int bit)
+{
+    return _mm256_and_si256(_mm256_srl_epi32(value, _mm_cvtsi32_si128(bit)), _mm256_set1_epi32(1));
+}
+
+APD_TARGET_AVX2 inline __m256i Nibble256(__m256i value, int bit)
+{
+    return _mm256_and_si256(
+        _mm256_srl_epi32(value, _mm_cvtsi32_si128(bit)), _mm256_set1_epi32(0xF));
+}
+
+APD_TARGET_AVX2 inline __m256i Select256(__m256i mask, __m256i ifSet, __m256i ifUnset)
+{
+    return _mm256_or_si256(_mm256_and_si256(mask, ifSet), _mm256_andnot_si256(mask, ifUnset));
+}
+
+APD_TARGET_AVX2 inline __m256i Battery256(__m256i value)
+{
+    const __m256i unavailable = _mm256_cmpgt_epi32(value, _mm256_set1_epi32(10));
+    return Select256(unavailable, _mm256_set1_epi32(kBatteryUnavailable), value);
+}
+
+APD_TARGET_AVX2 inline void StoreBytes256(uint8_t *dest, __m256i value)
+{
+    // Packing works within 128-bit lanes, so the low 4 bytes of each lane are what we want
+    //
+    const __m256i packed =
+        _mm256_packus_epi16(_mm256_packs_epi32(value, value), _mm256_setzero_si256());
+    const uint32_t low = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(packed)));
+    const uint32_t high =
+        static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1)));
+    std::memcpy(dest, &low, sizeof(low));
+    std::memcpy(dest + sizeof(low), &high, sizeof(high));
+}
+
+APD_TARGET_AVX2 size_t DecodeAvx2(const AirPods *frames, size_t count, const Columns &columns)
+{
+    constexpr size_t kLanes = 8;
+    constexpr int kStride = sizeof(AirPods);
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i offsets = _mm256_setr_epi32(
+        0, kStride, kStride * 2, kStride * 3, kStride * 4, kStride * 5, kStride * 6, kStride * 7);
+
+    size_t i = 0;
+    for (; i + kLanes <= count; i += kLanes) {
+        const auto *base = reinterpret_cast<const uint8_t *>(&frames[i]);
+        const __m256i head =
+            _mm256_i32gather_epi32(reinterpret_cast<const int *>(base + kHeadOffset), offsets, 1);
+        const __m256i status = _mm256_i32gather_epi32(
+            reinterpret_cast<const int *>(base + kStatusOffset), offsets, 1);
+
+        const __m256i broadcastFrom = Bit256(status, kBitBroadcastFrom);
+        const __m256i leftBroadcasted = _mm256_sub_epi32(_mm256_setzero_si256(), broadcastFrom);
+
+        const __m256i currBattery = Nibble256(status, kBitCurrBattery);
+        const __m256i anotBattery = Nibble256(status, kBitAnotBattery);
+        const __m256i currCharging = Bit256(status, kBitCurrCharging);
+        const __m256i anotCharging = Bit256(status, kBitAnotCharging);
+        const __m256i currInEar = Bit256(status, kBitCurrInEar);
+        const __m256i anotInEar = Bit256(status, kBitAnotInEar);
+
+        const __m256i leftCharging = Select256(leftBroadcasted, currCharging, anotCharging);
+        const __m256i rightCharging = Select256(leftBroadcasted, anotCharging, currCharging);
+        const __m256i caseCharging = Bit256(status, kBitCaseCharging);
+
+        const __m256i leftInEar =
+            _mm256_andnot_si256(leftCharging, Select256(leftBroadcasted, currInEar, anotInEar));
+        const __m256i rightInEar =
+            _mm256_andnot_si256(rightCharging, Select256(leftBroadcasted, anotInEar, currInEar));
+
+        StoreBytes256(
+            columns.leftBattery + i,
+            Battery256(Select256(leftBroadcasted, currBattery, anotBattery)));
+        StoreBytes256(
+            columns.rightBattery + i,
+            Battery256(Select256(leftBroadcasted, anotBattery, currBattery)));
+        StoreBytes256(columns.caseBattery + i, Battery256(Nibble256(status, kBitCaseBattery)));
+        StoreBytes256(
+            columns.charging + i,
+            _mm256_or_si256(
+                leftCharging, _mm256_or_si256(
+                                  _mm256_slli_epi32(rightCharging, 1),
+                                  _mm256_slli_epi32(caseCharging, 2))));
+        StoreBytes256(
+            columns.inEar + i, _mm256_or_si256(leftInEar, _mm256_slli_epi32(rightInEar, 1)));
+        StoreBytes256(columns.bothInCase + i, Bit256(status, kBitBothInCase));
+        StoreBytes256(
+            columns.lidOpened + i, _mm256_xor_si256(Bit256(status, kBitLidClosed), one));
+
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(columns.side + i), _mm256_xor_si256(broadcastFrom, one));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(columns.model + i), Model256(head));
+    }
+    return i;
+}
+
+#endif
+} // namespace
+
+Kernel GetBestKernel()
+{
+    const auto &features = Cpu::GetFeatures();
+
+    if (features.avx2) {
+        return Kernel::Avx2;
+    }
+    else if (features.sse2) {
+        return Kernel::Sse2;
+    }
+    else {
+        return Kernel::Scalar;
+    }
+}
+
+void Decode(std::span<const AirPods> frames, const Columns &columns)
+{
+    static const Kernel bestKernel = GetBestKernel();
+    Decode(frames, columns, bestKernel);
+}
+
+void Decode(std::span<const AirPods> frames, const Columns &columns, Kernel kernel)
+{
+    size_t decoded = 0;
+
+#if defined APD_ARCH_X86
+    switch (kernel) {
+    case Kernel::Avx2:
+        decoded = DecodeAvx2(frames.data(), frames.size(), columns);
+        break;
+    case Kernel::Sse2:
+        decoded = DecodeSse2(frames.data(), frames.size(), columns);
+        break;
+    default:
+        break;
+    }
+#endif
+
+    // The remaining frames that don't fill a whole vector
+    //
+    DecodeScalar(frames.data(), decoded, frames.size(), columns);
+}
+
+} // namespace Core::AppleCP::Batch
@@ -0,0 +1,78 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+
+#include "AppleCP.h"
+
+// Decodes many `AppleCP::AirPods` frames at once into structure-of-arrays columns. This is meant
+// for offline analysis and load testing, the live path decodes frames one by one.
+//
+namespace Core::AppleCP::Batch {
+
+constexpr inline uint8_t kBatteryUnavailable = 0xFF;
+
+enum ChargingBit : uint8_t {
+    LeftCharging = 1 << 0,
+    RightCharging = 1 << 1,
+    CaseCharging = 1 << 2,
+};
+
+enum InEarBit : uint8_t {
+    LeftInEar = 1 << 0,
+    RightInEar = 1 << 1,
+};
+
+// Every column must have room for at least as many elements as the number of frames.
+//
+// The values are exactly what the per-packet accessors return:
+//
+//   model        `GetModel()`
+//   *Battery     `Get*Battery()` in [0, 10], or `kBatteryUnavailable`
+//   charging     `Is*Charging()` as `ChargingBit`s
+//   inEar        `Is*InEar()` as `InEarBit`s
+//   bothInCase   `IsBothPodsInCase()`
+//   lidOpened    `IsLidOpened()`
+//   side         `GetBroadcastedSide()`
+//
+struct Columns {
+    Core::AirPods::Model *model;
+    uint8_t *leftBattery;
+    uint8_t *rightBattery;
+    uint8_t *caseBattery;
+    uint8_t *charging;
+    uint8_t *inEar;
+    uint8_t *bothInCase;
+    uint8_t *lidOpened;
+    Core::AirPods::Side *side;
+};
+
+enum class Kernel : uint32_t { Scalar, Sse2, Avx2 };
+
+// The fastest kernel supported by the current CPU
+//
+Kernel GetBestKernel();
+
+// The frames are expected to be validated by `AirPods::IsValid` already.
+//
+void Decode(std::span<const AirPods> frames, const Columns &columns);
+void Decode(std::span<const AirPods> frames, const Columns &columns, Kernel kernel);
+
+} // namespace Core::AppleCP::Batch
@@ -0,0 +1,238 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "AppleCPStats.h"
+
+#include <bit>
+#include <cstring>
+#include <algorithm>
+
+namespace Core::AppleCP::Stats {
+
+namespace {
+
+inline Bits LoadBits(const AirPods &frame)
+{
+    static_assert(std::endian::native == std::endian::little);
+
+    Bits result{};
+    std::memcpy(result.data(), frame.Bytes().data(), AirPodsLayout::kSize);
+    return result;
+}
+
+inline Bits Xor(const Bits &lhs, const Bits &rhs)
+{
+    Bits result;
+    for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = lhs[i] ^ rhs[i];
+    }
+    return result;
+}
+
+inline uint64_t PopCount(const Bits &bits)
+{
+    uint64_t result = 0;
+    for (const auto word : bits) {
+        result += std::popcount(word);
+    }
+    return result;
+}
+
+constexpr Bits Mask(std::initializer_list<const Layout::Field *> fields)
+{
+    Bits result{};
+    for (const auto *field : fields) {
+        for (size_t i = 0; i < field->width; ++i) {
+            const size_t bit = field->byteOffset * 8 + field->bitOffset + i;
+            result[bit / 64] |= uint64_t{1} << (bit % 64);
+        }
+    }
+    return result;
+}
+
+constexpr bool AnySet(const Bits &bits, const Bits &mask)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < bits.size(); ++i) {
+        result |= bits[i] & mask[i];
+    }
+    return result != 0;
+}
+
+// The conditions are the raw bits rather than the accessors, e.g. `IsLeftInEar()` hides the
+// in-ear bits while charging, but here we want to see exactly what was broadcast.
+//
+constexpr Bits kChargingMask = Mask(
+    {&AirPodsLayout::kCurrCharging, &AirPodsLayout::kAnotCharging, &AirPodsLayout::kCaseCharging});
+constexpr Bits kInEarMask = Mask({&AirPodsLayout::kCurrInEar, &AirPodsLayout::kAnotInEar});
+constexpr Bits kLidClosedMask = Mask({&AirPodsLayout::kLidClosed});
+
+std::array<bool, kConditionCount> GetConditions(const Bits &bits)
+{
+    std::array<bool, kConditionCount> result;
+    result[static_cast<size_t>(Condition::Charging)] = AnySet(bits, kChargingMask);
+    result[static_cast<size_t>(Condition::InEar)] = AnySet(bits, kInEarMask);
+    result[static_cast<size_t>(Condition::LidOpened)] = !AnySet(bits, kLidClosedMask);
+    return result;
+}
+} // namespace
+
+//
+// BitCounter
+//
+
+void BitCounter::Add(const Bits &bits)
+{
+    // Branch-free on purpose, an early exit when the carry runs out is mispredicted all the time
+    //
+    Bits carry = bits;
+    for (auto &plane : _planes) {
+        for (size_t word = 0; word < carry.size(); ++word) {
+            const uint64_t next = plane[word] & carry[word];
+            plane[word] ^= carry[word];
+            carry[word] = next;
+        }
+    }
+
+    ++_total;
+    if (++_pending == kFlushThreshold) {
+        Flush(_counts);
+        _planes = {};
+        _pending = 0;
+    }
+}
+
+uint64_t BitCounter::GetTotal() const
+{
+    return _total;
+}
+
+std::array<uint64_t, kBits> BitCounter::GetCounts() const
+{
+    auto result = _counts;
+    Flush(result);
+    return result;
+}
+
+void BitCounter::Flush(std::array<uint64_t, kBits> &counts) const
+{
+    for (size_t plane = 0; plane < kPlanes; ++plane) {
+        for (size_t bit = 0; bit < kBits; ++bit) {
+            counts[bit] += ((_planes[plane][bit / 64] >> (bit % 64)) & 1) << plane;
+        }
+    }
+}
+
+//
+// Aggregator
+//
+
+void Aggregator::Add(uint64_t address, const AirPods &frame)
+{
+    const Bits bits = LoadBits(frame);
+
+    _set.Add(bits);
+
+    const auto conditions = GetConditions(bits);
+    for (size_t i = 0; i < kConditionCount; ++i) {
+        if (conditions[i]) {
+            _setWithCondition[i].Add(bits);
+        }
+    }
+
+    auto [iter, inserted] = _addresses.try_emplace(address);
+    auto &state = iter->second;
+    if (!inserted) {
+        const Bits flipped = Xor(state.last, bits);
+        _flipped.Add(flipped);
+        state.stats.flippedBits += PopCount(flipped);
+    }
+    state.last = bits;
+    state.stats.frames += 1;
+}
+
+void Aggregator::Add(std::span<const uint64_t> addresses, std::span<const AirPods> frames)
+{
+    const size_t count = std::min(addresses.size(), frames.size());
+    for (size_t i = 0; i < count; ++i) {
+        Add(addresses[i], frames[i]);
+    }
+}
+
+Report Aggregator::GetReport() const
+{
+    Report result;
+
+    result.frames = _set.GetTotal();
+    result.set = _set.GetCounts();
+
+    for (size_t i = 0; i < kConditionCount; ++i) {
+        result.conditionFrames[i] = _setWithCondition[i].GetTotal();
+        result.setWithCondition[i] = _setWithCondition[i].GetCounts();
+    }
+
+    result.transitions = _flipped.GetTotal();
+    result.flipped = _flipped.GetCounts();
+
+    for (const auto &[address, state] : _addresses) {
+        result.addresses.emplace(address, state.stats);
+    }
+    return result;
+}
+
+} // namespace Core::AppleCP::Stats
+
+template <>
+QString Helper::ToString<Core::AppleCP::Stats::Report>(const Core::AppleCP::Stats::Report &value)
+{
+    using namespace Core::AppleCP;
+    using namespace Core::AppleCP::Stats;
+
+    const auto rate = [](uint64_t count, uint64_t total) {
+        return total == 0 ? QString{"-"}
+                           : QString::number(static_cast<double>(count) * 100 / total, 'f', 2);
+    };
+
+    QString result = QString{"frames: %1, transitions: %2, addresses: %3\n"}
+                         .arg(value.frames)
+                         .arg(value.transitions)
+                         .arg(value.addresses.size());
+    result += "byte.bit field set% charging% inEar% lidOpened% flip%\n";
+
+    for (const auto *field : AirPodsLayout::kFields) {
+        for (size_t i = 0; i < field->width; ++i) {
+            const size_t bit = field->byteOffset * 8 + field->bitOffset + i;
+
+            result += QString{"%1.%2 %3[%4] %5"}
+                          .arg(bit / 8)
+                          .arg(bit % 8)
+                          .arg(QString::fromUtf8(field->name.data(), int(field->name.size())))
+                          .arg(i)
+                          .arg(rate(value.set[bit], value.frames));
+
+            for (size_t c = 0; c < kConditionCount; ++c) {
+                result += ' ';
+                result += rate(value.setWithCondition[c][bit], value.conditionFrames[c]);
+            }
+            result += ' ';
+            result += rate(value.flipped[bit], value.transitions);
+            result += '\n';
+        }
+    }
+    return result;
+}
@@ -0,0 +1,115 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <unordered_map>
+
+#include "AppleCP.h"
+
+// Aggregates bit-level statistics over captured `AppleCP::AirPods` frames, to help working out
+// the meaning of the `unkN` fields.
+//
+// For every bit of the frame it counts how often it is set, how often it is set while a known
+// field is set (co-occurrence), and how often it flips between two consecutive frames from the
+// same address.
+//
+namespace Core::AppleCP::Stats {
+
+constexpr inline size_t kBits = AirPodsLayout::kSize * 8;
+
+// Bit `i` is bit `i % 8` of byte `i / 8`, the same numbering as `Layout::Field`
+//
+using Bits = std::array<uint64_t, (kBits + 63) / 64>;
+
+enum class Condition : uint32_t { Charging, InEar, LidOpened, _Count };
+
+constexpr inline size_t kConditionCount = static_cast<size_t>(Condition::_Count);
+
+// Counts set bits across many `Bits` with bit-sliced vertical counters. Adding is a ripple-carry
+// over a few words instead of 216 separate increments, the planes are flushed into the integer
+// counters before they can overflow.
+//
+class BitCounter
+{
+public:
+    void Add(const Bits &bits);
+
+    uint64_t GetTotal() const;
+    std::array<uint64_t, kBits> GetCounts() const;
+
+private:
+    constexpr static size_t kPlanes = 8;
+    constexpr static uint32_t kFlushThreshold = (1u << kPlanes) - 1;
+
+    std::array<Bits, kPlanes> _planes{};
+    uint32_t _pending{0};
+    uint64_t _total{0};
+    std::array<uint64_t, kBits> _counts{};
+
+    void Flush(std::array<uint64_t, kBits> &counts) const;
+};
+
+struct AddressStats {
+    uint64_t frames{0};
+    uint64_t flippedBits{0};
+};
+
+struct Report {
+    uint64_t frames{0};
+    std::array<uint64_t, kBits> set{};
+
+    std::array<uint64_t, kConditionCount> conditionFrames{};
+    std::array<std::array<uint64_t, kBits>, kConditionCount> setWithCondition{};
+
+    uint64_t transitions{0};
+    std::array<uint64_t, kBits> flipped{};
+
+    std::unordered_map<uint64_t, AddressStats> addresses;
+};
+
+class Aggregator
+{
+public:
+    void Add(uint64_t address, const AirPods &frame);
+    void Add(std::span<const uint64_t> addresses, std::span<const AirPods> frames);
+
+    Report GetReport() const;
+
+private:
+    struct AddressState {
+        Bits last;
+        AddressStats stats;
+    };
+
+    BitCounter _set;
+    std::array<BitCounter, kConditionCount> _setWithCondition;
+    BitCounter _flipped;
+    std::unordered_map<uint64_t, AddressState> _addresses;
+};
+
+} // namespace Core::AppleCP::Stats
+
+// A table of every bit with its field name, set rate, the set rate under each condition and the
+// flip rate
+//
+template <>
+QString Helper::ToString<Core::AppleCP::Stats::Report>(const Core::AppleCP::Stats::Report &value);
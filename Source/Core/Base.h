@@ -18,7 +18,9 @@
 
 #pragma once
 
+#include <array>
 #include <optional>
+#include <string_view>
 
 #include "../Helper.h"
 #include "../Logger.h"
@@ -80,35 +82,125 @@ enum class Model : uint32_t {
 
 enum class Side : uint32_t { Left, Right };
 
+//
+// Model descriptors
+//
+// Everything we know about a model lives in one row of `Details::kModelDescriptors`. Adding a
+// new model means adding an enumerator to `Model` and a row to the table, nothing else.
+//
+
+struct Capabilities {
+    bool chargingCase{false};
+    bool inEarDetection{false};
+    bool noiseCancellation{false};
+};
+
+struct ModelDescriptor {
+    struct VideoSize {
+        uint32_t width, height;
+    };
+
+    Model model;
+    uint16_t modelId; // `0` if we don't recognize it from advertisements
+    std::string_view displayName;
+    std::string_view animation; // File name in `Resource/Video`
+    // It's not possible to set video padding background color or get video resolution just
+    // through Qt, so we hardcode it here
+    VideoSize videoSize;
+    Capabilities capabilities;
+};
+
+namespace Details {
+
+// Powerbeats 3, BeatsX and BeatsSolo3 are known to broadcast the model ids 0x2003, 0x2005 and
+// 0x2006, but they are untested yet. Their rows keep the model id 0, so they are never matched.
+//
+// clang-format off
+inline constexpr std::array<ModelDescriptor, Helper::ToUnderlying(Model::_Max)> kModelDescriptors{{
+    // model              modelId displayName      animation        videoSize   case   inEar  anc
+    {Model::Unknown,       0x0000, "Unknown",       "AirPods_1",     {800, 400}, {false, false, false}},
+    {Model::AirPods_1,     0x2002, "AirPods 1",     "AirPods_1",     {800, 400}, {true,  true,  false}},
+    {Model::AirPods_2,     0x200F, "AirPods 2",     "AirPods_2",     {800, 400}, {true,  true,  false}},
+    {Model::AirPods_3,     0x2013, "AirPods 3",     "AirPods_3",     {900, 450}, {true,  true,  false}},
+    {Model::AirPods_Pro,   0x200E, "AirPods Pro",   "AirPods_Pro",   {900, 450}, {true,  true,  true }},
+    {Model::AirPods_Pro_2, 0x2014, "AirPods Pro 2", "AirPods_Pro_2", {900, 450}, {true,  true,  true }},
+    {Model::AirPods_Max,   0x200A, "AirPods Max",   "AirPods_Max",   {600, 650}, {false, true,  true }},
+    {Model::Powerbeats_3,  0x0000, "Powerbeats 3",  "AirPods_1",     {800, 400}, {false, false, false}},
+    {Model::Beats_X,       0x0000, "BeatsX",        "AirPods_1",     {800, 400}, {false, false, false}},
+    {Model::Beats_Solo3,   0x0000, "BeatsSolo3",    "AirPods_1",     {800, 400}, {false, false, false}},
+    {Model::Beats_Fit_Pro, 0x2012, "Beats Fit Pro", "Beats_Fit_Pro", {900, 450}, {true,  true,  true }},
+}};
+// clang-format on
+
+static_assert(
+    [] {
+        for (size_t i = 0; i < kModelDescriptors.size(); ++i) {
+            if (Helper::ToUnderlying(kModelDescriptors[i].model) != i) {
+                return false;
+            }
+        }
+        return true;
+    }(),
+    "The model descriptor table is incomplete or out of order.");
+
+// A perfect hash of the model id. We pick the fewest low bits of the model id that are unique
+// among all known model ids, so looking up is a single masked array access.
+//
+inline constexpr uint32_t kModelIdHashBits = [] {
+    for (uint32_t bits = 1; bits < 16; ++bits) {
+        const uint32_t mask = (1u << bits) - 1;
+        bool collided = false;
+        for (size_t i = 0; i < kModelDescriptors.size() && !collided; ++i) {
+            for (size_t j = i + 1; j < kModelDescriptors.size() && !collided; ++j) {
+                const auto lhs = kModelDescriptors[i].modelId, rhs = kModelDescriptors[j].modelId;
+                collided = lhs != 0 && rhs != 0 && (lhs & mask) == (rhs & mask);
+            }
+        }
+        if (!collided) {
+            return bits;
+        }
+    }
+    return 16u;
+}();
+static_assert(kModelIdHashBits <= 8, "The model id hash table is getting too large.");
+
+inline constexpr auto kModelIdHashTable = [] {
+    // Empty slots point to `Model::Unknown`, whose model id `0` never matches
+    std::array<uint8_t, (1u << kModelIdHashBits)> result{};
+    for (size_t i = 0; i < kModelDescriptors.size(); ++i) {
+        if (kModelDescriptors[i].modelId != 0) {
+            result[kModelDescriptors[i].modelId & (result.size() - 1)] = static_cast<uint8_t>(i);
+        }
+    }
+    return result;
+}();
+} // namespace Details
+
+constexpr const ModelDescriptor &GetModelDescriptor(Model model)
+{
+    const auto index = Helper::ToUnderlying(model);
+    return Details::kModelDescriptors[index < Details::kModelDescriptors.size() ? index : 0];
+}
+
+constexpr Model GetModelByModelId(uint16_t modelId)
+{
+    const auto &descriptor =
+        Details::kModelDescriptors[Details::kModelIdHashTable
+                                       [modelId & (Details::kModelIdHashTable.size() - 1)]];
+    return descriptor.modelId == modelId ? descriptor.model : Model::Unknown;
+}
+
+static_assert(GetModelByModelId(0x200E) == Model::AirPods_Pro);
+static_assert(GetModelByModelId(0x0000) == Model::Unknown);
+static_assert(GetModelByModelId(0x2003) == Model::Unknown);
+
 } // namespace Core::AirPods
 
 template <>
 inline QString Helper::ToString<Core::AirPods::Model>(const Core::AirPods::Model &value)
 {
-    switch (value) {
-    case Core::AirPods::Model::AirPods_1:
-        return "AirPods 1";
-    case Core::AirPods::Model::AirPods_2:
-        return "AirPods 2";
-    case Core::AirPods::Model::AirPods_3:
-        return "AirPods 3";
-    case Core::AirPods::Model::AirPods_Pro:
-        return "AirPods Pro";
-    case Core::AirPods::Model::AirPods_Pro_2:
-        return "AirPods Pro 2";
-    case Core::AirPods::Model::AirPods_Max:
-        return "AirPods Max";
-    case Core::AirPods::Model::Powerbeats_3:
-        return "Powerbeats 3";
-    case Core::AirPods::Model::Beats_X:
-        return "BeatsX";
-    case Core::AirPods::Model::Beats_Solo3:
-        return "BeatsSolo3";
-    case Core::AirPods::Model::Beats_Fit_Pro:
-        return "Beats Fit Pro";
-    default:
-        return "Unknown";
-    }
+    const auto &displayName = Core::AirPods::GetModelDescriptor(value).displayName;
+    return QString::fromUtf8(displayName.data(), static_cast<int>(displayName.size()));
 }
 
 template <>
@@ -22,15 +22,23 @@
     #include "Bluetooth_win.h"
 #endif
 
+namespace Core::Bluetooth {
+
+// The live watcher and the replay of a capture are interchangeable through this
+//
+using AdvertisementWatcherInterface = Details::AdvertisementWatcherAbstract<AdvertisementWatcher>;
+
+} // namespace Core::Bluetooth
+
 template <>
 inline QString Helper::ToString<Core::Bluetooth::AdvertisementWatcher::ReceivedData>(
     const Core::Bluetooth::AdvertisementWatcher::ReceivedData &value)
 {
     QString manufacturerData;
 
-    for (const auto &keyValue : value.manufacturerDataMap) {
-        manufacturerData +=
-            QString{"CompanyId: %1 Bytes: %2"}.arg(keyValue.first).arg(ToString(keyValue.second));
+    for (const auto &[companyId, bytes] : value.manufacturerDataMap) {
+        manufacturerData += QString{"CompanyId: %1 Bytes: %2"}.arg(companyId).arg(
+            ToString(std::vector<uint8_t>{bytes.begin(), bytes.end()}));
     }
 
     return QString{"rssi: %1 address: %3\nmanufacturerData: %4"}
@@ -18,7 +18,15 @@
 
 #pragma once
 
+#include <span>
+#include <array>
+#include <string>
+#include <algorithm>
+#include <optional>
 #include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "../Helper.h"
 
@@ -30,6 +38,128 @@ enum class DeviceState : uint32_t {
     Connected,
 };
 
+// Manufacturer data of an advertisement, keyed by company id and stored inline.
+//
+// Legacy advertisements carry at most 31 bytes and a single extended advertising report at most
+// 229, so the capacity is enough for any advertisement without touching the heap. Copying it is a
+// plain memory copy.
+//
+class ManufacturerDataMap
+{
+public:
+    constexpr static size_t kMaxEntries = 8;
+    constexpr static size_t kMaxBytes = 254;
+
+    using ValueType = std::pair<uint16_t, std::span<const uint8_t>>;
+
+    class Iterator
+    {
+    public:
+        inline Iterator(const ManufacturerDataMap *map, size_t index) : _map{map}, _index{index} {}
+
+        inline ValueType operator*() const
+        {
+            return _map->At(_index);
+        }
+        inline Iterator &operator++()
+        {
+            ++_index;
+            return *this;
+        }
+        inline bool operator==(const Iterator &rhs) const
+        {
+            return _index == rhs._index;
+        }
+
+    private:
+        const ManufacturerDataMap *_map;
+        size_t _index;
+    };
+
+    // Like `std::map::try_emplace`, an existing company id is kept. Returns false if the company
+    // id exists or there is no room left.
+    //
+    inline bool TryEmplace(uint16_t companyId, std::span<const uint8_t> data)
+    {
+        if (_count == kMaxEntries || data.size() > kMaxBytes - _used || Find(companyId).has_value())
+        {
+            return false;
+        }
+
+        std::copy(data.begin(), data.end(), _bytes.begin() + _used);
+        _entries[_count++] = Entry{
+            companyId, static_cast<uint8_t>(_used), static_cast<uint8_t>(data.size())};
+        _used += static_cast<uint8_t>(data.size());
+        return true;
+    }
+
+    inline std::optional<std::span<const uint8_t>> Find(uint16_t companyId) const
+    {
+        for (size_t i = 0; i < _count; ++i) {
+            if (_entries[i].companyId == companyId) {
+                return At(i).second;
+            }
+        }
+        return std::nullopt;
+    }
+
+    inline size_t Size() const
+    {
+        return _count;
+    }
+
+    inline bool Empty() const
+    {
+        return _count == 0;
+    }
+
+    inline Iterator begin() const
+    {
+        return Iterator{this, 0};
+    }
+
+    inline Iterator end() const
+    {
+        return Iterator{this, _count};
+    }
+
+    inline bool operator==(const ManufacturerDataMap &rhs) const
+    {
+        if (_count != rhs._count) {
+            return false;
+        }
+        for (size_t i = 0; i < _count; ++i) {
+            const auto lhsEntry = At(i), rhsEntry = rhs.At(i);
+            if (lhsEntry.first != rhsEntry.first ||
+                !std::equal(
+                    lhsEntry.second.begin(), lhsEntry.second.end(), rhsEntry.second.begin(),
+                    rhsEntry.second.end()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint16_t companyId;
+        uint8_t offset;
+        uint8_t size;
+    };
+
+    std::array<Entry, kMaxEntries> _entries{};
+    std::array<uint8_t, kMaxBytes> _bytes;
+    uint8_t _count{0};
+    uint8_t _used{0};
+
+    inline ValueType At(size_t index) const
+    {
+        const auto &entry = _entries[index];
+        return {entry.companyId, std::span<const uint8_t>{_bytes.data() + entry.offset, entry.size}};
+    }
+};
+
 namespace Details {
 
 template <class ConcreteAddressT>
@@ -67,8 +197,266 @@ class DeviceManagerAbstract
 public:
     virtual inline ~DeviceManagerAbstract() {}
 
-    virtual std::vector<ConcreteDeviceT> GetDevicesByState(DeviceState state) const = 0;
-    virtual std::optional<ConcreteDeviceT> FindDevice(uint64_t address) const = 0;
+    virtual Helper::Task<std::vector<ConcreteDeviceT>>
+    GetDevicesByStateAsync(DeviceState state, Helper::CancellationToken token) const = 0;
+    virtual Helper::Task<std::optional<ConcreteDeviceT>>
+    FindDeviceAsync(uint64_t address, Helper::CancellationToken token) const = 0;
+};
+
+// Parses an address in the form of "aa:bb:cc:dd:ee:ff"
+//
+inline std::optional<uint64_t> ParseAddress(std::string_view text)
+{
+    if (text.size() != 17) {
+        return std::nullopt;
+    }
+
+    uint64_t result = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char ch = text[i];
+        if (i % 3 == 2) {
+            if (ch != ':') {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        uint64_t digit;
+        if (ch >= '0' && ch <= '9') {
+            digit = ch - '0';
+        }
+        else if (ch >= 'a' && ch <= 'f') {
+            digit = ch - 'a' + 10;
+        }
+        else if (ch >= 'A' && ch <= 'F') {
+            digit = ch - 'A' + 10;
+        }
+        else {
+            return std::nullopt;
+        }
+        result = (result << 4) | digit;
+    }
+    return result;
+}
+
+// The paired devices indexed by address, filled by a single enumeration.
+//
+// A device watcher keeps it up to date. An added device is inserted, or replaces the entry with
+// its id, and a removed one is dropped. An updated one only marks its entry stale, a lookup that
+// hits something stale enumerates again. Once the watcher has reported every device that was
+// already paired, the cache is complete without an enumeration of its own. The enumeration is
+// passed in as a coroutine, so the cache itself doesn't depend on the platform.
+//
+template <class Record>
+class DeviceCache : Helper::NonCopyable
+{
+public:
+    struct Item {
+        std::string id;
+        uint64_t address{};
+        Record record;
+    };
+    // If it throws, the cache is kept as it was and the exception is passed on to the lookup
+    //
+    using FnEnumerate =
+        std::function<Helper::Task<std::vector<Item>>(Helper::CancellationToken token)>;
+
+    struct Counters {
+        uint64_t enumerations{0}, hits{0}, misses{0};
+    };
+
+    explicit DeviceCache(FnEnumerate enumerate) : _enumerate{std::move(enumerate)} {}
+
+    inline Helper::Task<std::optional<Record>>
+    Find(uint64_t address, Helper::CancellationToken token = {})
+    {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+
+            const auto iter = _byAddress.find(address);
+            if (_valid && (iter == _byAddress.end() || !_stale.contains(_items[iter->second].id)))
+            {
+                ++_counters.hits;
+                if (iter == _byAddress.end()) {
+                    co_return std::nullopt;
+                }
+                co_return _items[iter->second].record;
+            }
+            generation = BeginRefresh();
+        }
+
+        auto items = co_await _enumerate(std::move(token));
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        EndRefresh(std::move(items), generation);
+
+        const auto iter = _byAddress.find(address);
+        if (iter == _byAddress.end()) {
+            co_return std::nullopt;
+        }
+        co_return _items[iter->second].record;
+    }
+
+    // In the order of the enumeration
+    //
+    inline Helper::Task<std::vector<Record>> GetAll(Helper::CancellationToken token = {})
+    {
+        std::optional<uint64_t> generation;
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+
+            if (!_valid || !_stale.empty()) {
+                generation = BeginRefresh();
+            }
+            else {
+                ++_counters.hits;
+            }
+        }
+
+        if (generation.has_value()) {
+            auto items = co_await _enumerate(std::move(token));
+
+            std::lock_guard<std::mutex> lock{_mutex};
+            EndRefresh(std::move(items), generation.value());
+        }
+
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        std::vector<Record> result;
+        result.reserve(_items.size());
+        for (const auto &item : _items) {
+            result.push_back(item.record);
+        }
+        co_return result;
+    }
+
+    // Until the watcher's initial enumeration is completed, it reports the devices that were
+    // already paired, so an enumeration in flight doesn't miss them
+    //
+    inline void OnAdded(Item item)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_watcherEnumerated) {
+            ++_generation;
+        }
+        Upsert(std::move(item));
+    }
+
+    inline void OnUpdated(const std::string &id)
+    {
+        MarkStale(id);
+    }
+
+    inline void OnRemoved(const std::string &id)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        ++_generation;
+        Erase(id);
+    }
+
+    inline void OnEnumerationCompleted()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _watcherEnumerated = true;
+        _valid = true;
+    }
+
+    inline void Invalidate()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        ++_generation;
+        _valid = false;
+    }
+
+    inline Counters GetCounters() const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _counters;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    FnEnumerate _enumerate;
+    std::vector<Item> _items;
+    std::unordered_map<std::string, size_t> _byId;
+    std::unordered_map<uint64_t, size_t> _byAddress;
+    std::unordered_set<std::string> _stale;
+    uint64_t _generation{0};
+    bool _valid{false}, _watcherEnumerated{false};
+    Counters _counters;
+
+    inline void MarkStale(const std::string &id)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        ++_generation;
+        if (_byId.contains(id)) {
+            _stale.insert(id);
+        }
+    }
+
+    // The lock is released while enumerating. If an event comes meanwhile, the result is still
+    // used for this lookup, but the next one enumerates again.
+    //
+    inline uint64_t BeginRefresh()
+    {
+        ++_counters.misses;
+        ++_counters.enumerations;
+        return _generation;
+    }
+
+    inline void EndRefresh(std::vector<Item> items, uint64_t generation)
+    {
+        _items = std::move(items);
+        Reindex();
+        _stale.clear();
+        _valid = _generation == generation;
+    }
+
+    // An address that moves to another device is looked up as the device added last
+    //
+    inline void Upsert(Item item)
+    {
+        _stale.erase(item.id);
+
+        const auto iter = _byId.find(item.id);
+        if (iter == _byId.end()) {
+            _byId.emplace(item.id, _items.size());
+            _byAddress.insert_or_assign(item.address, _items.size());
+            _items.push_back(std::move(item));
+            return;
+        }
+
+        const size_t index = iter->second;
+        const auto byAddress = _byAddress.find(_items[index].address);
+        if (byAddress != _byAddress.end() && byAddress->second == index) {
+            _byAddress.erase(byAddress);
+        }
+        _byAddress.insert_or_assign(item.address, index);
+        _items[index] = std::move(item);
+    }
+
+    inline void Erase(const std::string &id)
+    {
+        const auto iter = _byId.find(id);
+        if (iter == _byId.end()) {
+            return;
+        }
+
+        _items.erase(_items.begin() + iter->second);
+        _stale.erase(id);
+        Reindex();
+    }
+
+    inline void Reindex()
+    {
+        _byId.clear();
+        _byAddress.clear();
+        for (size_t i = 0; i < _items.size(); ++i) {
+            _byId.emplace(_items[i].id, i);
+            _byAddress.insert_or_assign(_items[i].address, i);
+        }
+    }
 };
 
 template <class Derived>
@@ -81,7 +469,7 @@ public:
         int16_t rssi{};
         typename Derived::Timestamp timestamp;
         uint64_t address{};
-        std::map<uint16_t, std::vector<uint8_t>> manufacturerDataMap;
+        ManufacturerDataMap manufacturerDataMap;
     };
     using FnReceived = std::function<void(const ReceivedData &)>;
     using FnStateChanged = std::function<void(State, const std::optional<std::string> &)>;
@@ -33,11 +33,37 @@ using namespace WinrtDevicesEnumeration;
 
 using namespace Core::Debug;
 
+// The synchronous interfaces wait for the coroutines on the calling thread, and cancel them if they
+// take longer than this
+//
+constexpr inline auto kSyncWaitTimeout = 10s;
+
+// A timeout throws `winrt::hresult_canceled` from a WinRT call, or `Helper::OperationCancelled`
+// from a check between calls, so the callers catch both
+//
+template <class Fn>
+inline auto SyncWaitFor(Fn &&start)
+{
+    Helper::CancellationSource cancellation;
+    cancellation.CancelAfter(kSyncWaitTimeout);
+    return Helper::SyncWait(start(cancellation.GetToken()));
+}
+
+Helper::Task<DeviceInformation>
+FetchInfoAsync(BluetoothDevice device, Helper::CancellationToken token)
+{
+    co_return co_await OS::Windows::Winrt::Await(
+        DeviceInformation::CreateFromIdAsync(
+            device.DeviceInformation().Id(), Device::GetRequestedProperties()),
+        std::move(token));
+}
+
 //////////////////////////////////////////////////
 // Device
 //
 
-Device::Device(BluetoothDevice device) : _device{std::move(device)}
+Device::Device(BluetoothDevice device, std::optional<DeviceInformation> info)
+    : _device{std::move(device)}, _info{std::move(info)}
 {
     RegisterHandlers();
 }
@@ -96,6 +122,16 @@ DeviceState Device::GetConnectionState() const
                : DeviceState::Disconnected;
 }
 
+std::vector<winrt::hstring> Device::GetRequestedProperties()
+{
+    return {
+        kPropertyBluetoothProductId, // uint16
+        kPropertyBluetoothVendorId,  // uint16
+        kPropertyAepContainerId,     // hstring
+        kPropertyAepDeviceAddress,   // hstring
+    };
+}
+
 winrt::hstring Device::GetAepId() const
 {
     return GetProperty<winrt::hstring>(kPropertyAepContainerId, {});
@@ -146,23 +182,17 @@ const std::optional<DeviceInformation> &Device::GetInfo() const
         return _info;
     }
 
-    std::thread{[this]() {
-        try {
-            // clang-format off
-            _info = DeviceInformation::CreateFromIdAsync(
-                _device->DeviceInformation().Id(),
-                {
-                    kPropertyBluetoothProductId, // uint16
-                    kPropertyBluetoothVendorId,  // uint16
-                    kPropertyAepContainerId,     // hstring
-                }
-            ).get();
-            // clang-format on
-        }
-        catch (const OS::Windows::Winrt::Exception &ex) {
-            LOG(Warn, "DeviceInformation::CreateFromIdAsync() failed. {}", Helper::ToString(ex));
-        }
-    }}.join();
+    try {
+        _info = SyncWaitFor([this](Helper::CancellationToken token) {
+            return FetchInfoAsync(_device.value(), std::move(token));
+        });
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "DeviceInformation::CreateFromIdAsync() failed. {}", Helper::ToString(ex));
+    }
+    catch (const Helper::OperationCancelled &) {
+        LOG(Warn, "DeviceInformation::CreateFromIdAsync() timed out.");
+    }
 
     return _info;
 }
@@ -186,67 +216,226 @@ class DeviceManager final : public Helper::Singleton<DeviceManager>,
                             Details::DeviceManagerAbstract<Device>
 {
 protected:
-    DeviceManager() = default;
+    DeviceManager()
+    {
+        try {
+            _watcher = DeviceInformation::CreateWatcher(
+                BluetoothDevice::GetDeviceSelectorFromPairingState(true),
+                Device::GetRequestedProperties());
+
+            _watcher.Added([this](const DeviceWatcher &, const DeviceInformation &info) {
+                auto item = MakeCacheItem(info);
+                if (item.has_value()) {
+                    _cache.OnAdded(std::move(item.value()));
+                }
+            });
+            _watcher.Updated([this](const DeviceWatcher &, const DeviceInformationUpdate &update) {
+                _cache.OnUpdated(winrt::to_string(update.Id()));
+            });
+            _watcher.Removed([this](const DeviceWatcher &, const DeviceInformationUpdate &update) {
+                _cache.OnRemoved(winrt::to_string(update.Id()));
+            });
+            _watcher.EnumerationCompleted([this](const DeviceWatcher &, IInspectable) {
+                LOG(Trace, "The paired device watcher enumeration completed.");
+                _cache.OnEnumerationCompleted();
+            });
+            _watcher.Stopped([this](const DeviceWatcher &, IInspectable) {
+                LOG(Warn, "The paired device watcher stopped. Status: {}",
+                    Helper::ToUnderlying(_watcher.Status()));
+                _watching = false;
+            });
+
+            _watcher.Start();
+            _watching = true;
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "Start paired device watcher failed, devices won't be cached. {}",
+                Helper::ToString(ex));
+        }
+    }
+
+    ~DeviceManager()
+    {
+        try {
+            if (_watching) {
+                _watching = false;
+                _watcher.Stop();
+            }
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "Stop paired device watcher failed. {}", Helper::ToString(ex));
+        }
+    }
+
     friend Helper::Singleton<DeviceManager>;
 
 public:
-    std::vector<Device> GetDevicesByState(DeviceState state) const override
+    Helper::Task<std::vector<Device>>
+    GetDevicesByStateAsync(DeviceState state, Helper::CancellationToken token) const override
     {
         std::vector<Device> result;
 
-        try {
-            winrt::hstring aqsString;
-
-            switch (state) {
-            case Core::Bluetooth::DeviceState::Paired:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromPairingState(true);
-                break;
-            case Core::Bluetooth::DeviceState::Disconnected:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
-                    BluetoothConnectionStatus::Disconnected);
-                break;
-            case Core::Bluetooth::DeviceState::Connected:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
-                    BluetoothConnectionStatus::Connected);
-                break;
-            default:
-                APD_ASSERT(false);
-                break;
+        if (state == Core::Bluetooth::DeviceState::Paired) {
+            const auto pairedDevices = co_await GetCache().GetAll(token);
+
+            result.reserve(pairedDevices.size());
+            for (const auto &pairedDevice : pairedDevices) {
+                auto device = co_await pairedDevice->GetDeviceAsync(token);
+                if (device.has_value()) {
+                    result.emplace_back(std::move(device.value()));
+                }
             }
+            co_return result;
+        }
 
-            auto collection =
-                WinrtDevicesEnumeration::DeviceInformation::FindAllAsync(aqsString).get();
+        winrt::hstring aqsString;
+
+        switch (state) {
+        case Core::Bluetooth::DeviceState::Disconnected:
+            aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
+                BluetoothConnectionStatus::Disconnected);
+            break;
+        case Core::Bluetooth::DeviceState::Connected:
+            aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
+                BluetoothConnectionStatus::Connected);
+            break;
+        default:
+            APD_ASSERT(false);
+            break;
+        }
 
-            result.reserve(collection.Size());
+        auto collection = co_await OS::Windows::Winrt::Await(
+            DeviceInformation::FindAllAsync(aqsString, Device::GetRequestedProperties()), token);
 
-            for (uint32_t i = 0; i < collection.Size(); ++i) {
-                const auto &deviceInfo = collection.GetAt(i);
+        result.reserve(collection.Size());
 
-                try {
-                    auto device = BluetoothDevice::FromIdAsync(deviceInfo.Id()).get();
-                    result.emplace_back(std::move(device));
-                }
-                catch (const OS::Windows::Winrt::Exception &ex) {
-                    LOG(Warn, "BluetoothDevice::FromIdAsync() failed. {}", Helper::ToString(ex));
+        for (uint32_t i = 0; i < collection.Size(); ++i) {
+            const auto deviceInfo = collection.GetAt(i);
+
+            std::optional<BluetoothDevice> device;
+            try {
+                device = co_await OS::Windows::Winrt::Await(
+                    BluetoothDevice::FromIdAsync(deviceInfo.Id()), token);
+            }
+            catch (const OS::Windows::Winrt::Exception &ex) {
+                LOG(Warn, "BluetoothDevice::FromIdAsync() failed. {}", Helper::ToString(ex));
+            }
+
+            if (device.has_value()) {
+                result.emplace_back(std::move(device.value()), deviceInfo);
+            }
+        }
+
+        co_return result;
+    }
+
+    Helper::Task<std::optional<Device>>
+    FindDeviceAsync(uint64_t address, Helper::CancellationToken token) const override
+    {
+        const auto pairedDevice = co_await GetCache().Find(address, token);
+        if (!pairedDevice.has_value()) {
+            co_return std::nullopt;
+        }
+        co_return co_await pairedDevice.value()->GetDeviceAsync(std::move(token));
+    }
+
+private:
+    // The `BluetoothDevice` is only opened when a `Device` is asked for, and kept until the next
+    // enumeration
+    //
+    class PairedDevice
+    {
+    public:
+        explicit PairedDevice(DeviceInformation info) : _info{std::move(info)} {}
+
+        Helper::Task<std::optional<Device>> GetDeviceAsync(Helper::CancellationToken token)
+        {
+            {
+                std::lock_guard<std::mutex> lock{_mutex};
+                if (_device.has_value()) {
+                    co_return Device{_device.value(), _info};
                 }
             }
 
-            return result;
+            std::optional<BluetoothDevice> device;
+            try {
+                device = co_await OS::Windows::Winrt::Await(
+                    BluetoothDevice::FromIdAsync(_info.Id()), std::move(token));
+            }
+            catch (const OS::Windows::Winrt::Exception &ex) {
+                LOG(Warn, "BluetoothDevice::FromIdAsync() failed. {}", Helper::ToString(ex));
+            }
+
+            if (!device.has_value()) {
+                co_return std::nullopt;
+            }
+
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (!_device.has_value()) {
+                _device = std::move(device);
+            }
+            co_return Device{_device.value(), _info};
         }
-        catch (const OS::Windows::Winrt::Exception &ex) {
-            return result;
+
+    private:
+        std::mutex _mutex;
+        const DeviceInformation _info;
+        std::optional<BluetoothDevice> _device;
+    };
+
+    using Cache = Details::DeviceCache<std::shared_ptr<PairedDevice>>;
+
+    DeviceWatcher _watcher{nullptr};
+    std::atomic<bool> _watching{false};
+    mutable Cache _cache{&DeviceManager::EnumeratePairedDevicesAsync};
+
+    // Without the watcher nothing tells when the cache goes stale, so it enumerates every time
+    //
+    Cache &GetCache() const
+    {
+        if (!_watching) {
+            _cache.Invalidate();
         }
+        return _cache;
     }
 
-    std::optional<Device> FindDevice(uint64_t address) const override
+    static Helper::Task<std::vector<Cache::Item>>
+    EnumeratePairedDevicesAsync(Helper::CancellationToken token)
     {
-        auto devices = GetDevicesByState(Bluetooth::DeviceState::Paired);
-        for (const auto &device : devices) {
-            if (device.GetAddress() == address) {
-                return device;
+        auto collection = co_await OS::Windows::Winrt::Await(
+            DeviceInformation::FindAllAsync(
+                BluetoothDevice::GetDeviceSelectorFromPairingState(true),
+                Device::GetRequestedProperties()),
+            std::move(token));
+
+        std::vector<Cache::Item> result;
+        result.reserve(collection.Size());
+
+        for (uint32_t i = 0; i < collection.Size(); ++i) {
+            auto item = MakeCacheItem(collection.GetAt(i));
+            if (item.has_value()) {
+                result.push_back(std::move(item.value()));
             }
         }
-        return std::nullopt;
+
+        LOG(Trace, "Paired devices enumerated. Count: {}", result.size());
+        co_return result;
+    }
+
+    static std::optional<Cache::Item> MakeCacheItem(const DeviceInformation &deviceInfo)
+    {
+        const auto addressString = winrt::to_string(winrt::unbox_value_or<winrt::hstring>(
+            deviceInfo.Properties().TryLookup(Device::kPropertyAepDeviceAddress), {}));
+
+        const auto address = Details::ParseAddress(addressString);
+        if (!address.has_value()) {
+            LOG(Warn, "Unexpected paired device address '{}'.", addressString);
+            return std::nullopt;
+        }
+
+        return Cache::Item{
+            winrt::to_string(deviceInfo.Id()), address.value(),
+            std::make_shared<PairedDevice>(deviceInfo)};
     }
 };
 } // namespace Details
@@ -255,20 +444,39 @@ namespace DeviceManager {
 
 std::vector<Device> GetDevicesByState(DeviceState state)
 {
-    std::vector<Device> result;
-    std::thread{[&]() {
-        result = Details::DeviceManager::GetInstance().GetDevicesByState(state);
-    }}.join();
-    return result;
+    try {
+        return SyncWaitFor([state](Helper::CancellationToken token) {
+            return Details::DeviceManager::GetInstance().GetDevicesByStateAsync(
+                state, std::move(token));
+        });
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "DeviceManager::GetDevicesByState() failed. State: {}, {}",
+            Helper::ToUnderlying(state), Helper::ToString(ex));
+        return {};
+    }
+    catch (const Helper::OperationCancelled &) {
+        LOG(Warn, "DeviceManager::GetDevicesByState() timed out. State: {}",
+            Helper::ToUnderlying(state));
+        return {};
+    }
 }
 
 std::optional<Device> FindDevice(uint64_t address)
 {
-    std::optional<Device> result;
-    std::thread{[&]() {
-        result = Details::DeviceManager::GetInstance().FindDevice(address);
-    }}.join();
-    return result;
+    try {
+        return SyncWaitFor([address](Helper::CancellationToken token) {
+            return Details::DeviceManager::GetInstance().FindDeviceAsync(address, std::move(token));
+        });
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "DeviceManager::FindDevice() failed. {}", Helper::ToString(ex));
+        return std::nullopt;
+    }
+    catch (const Helper::OperationCancelled &) {
+        LOG(Warn, "DeviceManager::FindDevice() timed out.");
+        return std::nullopt;
+    }
 }
 } // namespace DeviceManager
 
@@ -280,6 +488,22 @@ AdvertisementWatcher::AdvertisementWatcher()
 {
     _bleWatcher.Received(std::bind(&AdvertisementWatcher::OnReceived, this, _2));
     _bleWatcher.Stopped(std::bind(&AdvertisementWatcher::OnStopped, this, _2));
+
+    // `Start` takes the manager's lock in the state callbacks, which may be held for seconds while
+    // it waits on a device, so it's retried on the executor rather than on the wheel thread
+    //
+    _retry.callback = [this] {
+        std::lock_guard<std::mutex> lock{_retryMutex};
+        if (_destroy) {
+            return;
+        }
+        _retryJob = Helper::BlockingExecutor::GetInstance().Submit([this] {
+            if (!_destroy && !_stop && !Start()) {
+                Helper::TimerWheel::GetInstance().Schedule(
+                    _retry, _lastStartTime.load() + kRetryInterval);
+            }
+        });
+    };
 }
 
 AdvertisementWatcher::~AdvertisementWatcher()
@@ -290,13 +514,27 @@ AdvertisementWatcher::~AdvertisementWatcher()
         std::unique_lock<std::mutex> lock{_conVarMutex};
         _destroyConVar.wait_for(lock, 1s);
     }
+
+    _destroy = true;
+    Helper::TimerWheel::GetInstance().Cancel(_retry);
+    {
+        std::lock_guard<std::mutex> lock{_retryMutex};
+        if (_retryJob.has_value() && !_retryJob->Cancel()) {
+            _retryJob->GetFuture().wait();
+        }
+    }
+    // A retry that was running may have armed it again
+    //
+    Helper::TimerWheel::GetInstance().Cancel(_retry);
 }
 
 bool AdvertisementWatcher::Start()
 {
+    Helper::TimerWheel::GetInstance().Cancel(_retry);
+
     try {
         _stop = false;
-        _lastStartTime = std::chrono::steady_clock::now();
+        _lastStartTime = Helper::GetClock().Now();
 
         std::lock_guard<std::mutex> lock{_mutex};
         _bleWatcher.Start();
@@ -314,7 +552,7 @@ bool AdvertisementWatcher::Stop()
 {
     try {
         _stop = true;
-        _stopConVar.notify_all();
+        Helper::TimerWheel::GetInstance().Cancel(_retry);
 
         std::lock_guard<std::mutex> lock{_mutex};
         _bleWatcher.Stop();
@@ -341,17 +579,22 @@ void AdvertisementWatcher::OnReceived(const BluetoothLEAdvertisementReceivedEven
         const auto companyId = manufacturerData.CompanyId();
         const auto &data = manufacturerData.Data();
 
-        std::vector<uint8_t> stdData(data.data(), data.data() + data.Length());
+        std::span<const uint8_t> bytes{data.data(), data.Length()};
 
 #if defined APD_DEBUG
         auto overrideAdv = DebugConfig::GetInstance().GetOverrideAdv();
         if (overrideAdv.has_value()) {
-            stdData = std::move(overrideAdv.value());
-            LOG(Trace, "Adv override: {}", Helper::ToString(stdData));
+            bytes = overrideAdv.value();
+            LOG(Trace, "Adv override: {}", Helper::ToString(overrideAdv.value()));
         }
 #endif
 
-        receivedData.manufacturerDataMap.try_emplace(companyId, std::move(stdData));
+        // The bytes are copied into `receivedData`, the WinRT buffer doesn't need to outlive it
+        //
+        if (!receivedData.manufacturerDataMap.TryEmplace(companyId, bytes)) {
+            LOG(Trace, "Manufacturer data dropped. CompanyId: {} Size: {}", companyId,
+                bytes.size());
+        }
     }
 
     std::lock_guard<std::mutex> lock{_mutex};
@@ -405,11 +648,14 @@ void AdvertisementWatcher::OnStopped(const BluetoothLEAdvertisementWatcherStoppe
 
     CbStateChanged().Invoke(State::Stopped, optError);
 
+    // Retried on the timer wheel rather than by blocking the event thread, so it follows the
+    // installed clock
+    //
     if (!_destroy) {
-        do {
-            std::unique_lock<std::mutex> lock{_conVarMutex};
-            _stopConVar.wait_until(lock, _lastStartTime.load() + kRetryInterval);
-        } while (!_stop && !Start());
+        if (!_stop) {
+            Helper::TimerWheel::GetInstance().Schedule(
+                _retry, _lastStartTime.load() + kRetryInterval);
+        }
     }
     else {
         _destroyConVar.notify_all();
@@ -41,10 +41,18 @@ namespace WinrtBluetooth = winrt::Windows::Devices::Bluetooth;
 namespace WinrtBluetoothAdv = winrt::Windows::Devices::Bluetooth::Advertisement;
 namespace WinrtDevicesEnumeration = winrt::Windows::Devices::Enumeration;
 
+namespace Details {
+class DeviceManager;
+} // namespace Details
+
 class Device final : public Details::DeviceAbstract<uint64_t>
 {
 public:
-    Device(WinrtBluetooth::BluetoothDevice device);
+    // The info is fetched on demand if it isn't given. If it is, it must have been requested with
+    // the properties of `GetRequestedProperties`.
+    //
+    Device(WinrtBluetooth::BluetoothDevice device,
+           std::optional<WinrtDevicesEnumeration::DeviceInformation> info = std::nullopt);
     Device(const Device &rhs);
     Device(Device &&rhs) noexcept;
     ~Device();
@@ -58,11 +66,14 @@ public:
     uint16_t GetProductId() const override;
     DeviceState GetConnectionState() const override;
 
+    static std::vector<winrt::hstring> GetRequestedProperties();
+
 private:
     constexpr static auto kPropertyBluetoothVendorId = L"System.DeviceInterface.Bluetooth.VendorId";
     constexpr static auto kPropertyBluetoothProductId =
         L"System.DeviceInterface.Bluetooth.ProductId";
     constexpr static auto kPropertyAepContainerId = L"System.Devices.Aep.ContainerId";
+    constexpr static auto kPropertyAepDeviceAddress = L"System.Devices.Aep.DeviceAddress";
 
     std::optional<WinrtBluetooth::BluetoothDevice> _device;
     mutable std::optional<WinrtDevicesEnumeration::DeviceInformation> _info;
@@ -96,6 +107,8 @@ private:
 
     winrt::hstring GetAepId() const;
 
+    friend class Details::DeviceManager;
+
     void OnConnectionStatusChanged(const WinrtBluetooth::BluetoothDevice &sender);
     void OnNameChanged(const WinrtBluetooth::BluetoothDevice &sender);
 };
@@ -126,9 +139,12 @@ private:
     std::mutex _mutex;
 
     std::atomic<bool> _stop{false}, _destroy{false};
-    std::atomic<std::chrono::steady_clock::time_point> _lastStartTime;
+    std::atomic<Helper::ClockSource::TimePoint> _lastStartTime;
+    Helper::TimerWheel::Entry _retry;
+    std::mutex _retryMutex;
+    std::optional<Helper::BlockingExecutor::Job<void>> _retryJob;
     std::mutex _conVarMutex;
-    std::condition_variable _stopConVar, _destroyConVar;
+    std::condition_variable _destroyConVar;
 
     void OnReceived(const WinrtBluetoothAdv::BluetoothLEAdvertisementReceivedEventArgs &args);
     void OnStopped(const WinrtBluetoothAdv::BluetoothLEAdvertisementWatcherStoppedEventArgs &args);
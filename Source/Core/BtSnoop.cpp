@@ -0,0 +1,312 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "BtSnoop.h"
+
+#include <array>
+#include <algorithm>
+
+#include "../Logger.h"
+
+namespace Core::Capture {
+
+namespace {
+
+constexpr std::array<uint8_t, 8> kMagic{'b', 't', 's', 'n', 'o', 'o', 'p', '\0'};
+
+constexpr size_t kFileHeaderSize = 16;
+constexpr size_t kPacketHeaderSize = 24;
+
+// btsnoop timestamps are microseconds since midnight, January 1st, 0 AD
+//
+constexpr int64_t kUnixEpochOffset = 0x00DC'DDB3'0F2F'8000;
+
+constexpr uint8_t kH4EventPacket = 0x04;
+constexpr uint16_t kMonitorEventPacket = 0x0003;
+
+constexpr uint8_t kEventLeMeta = 0x3E;
+constexpr uint8_t kSubeventAdvertisingReport = 0x02;
+constexpr uint8_t kSubeventExtendedAdvertisingReport = 0x0D;
+
+constexpr uint8_t kAdTypeManufacturerData = 0xFF;
+
+inline uint32_t LoadBE32(std::span<const uint8_t> data, size_t offset)
+{
+    return (uint32_t{data[offset]} << 24) | (uint32_t{data[offset + 1]} << 16) |
+           (uint32_t{data[offset + 2]} << 8) | uint32_t{data[offset + 3]};
+}
+
+inline uint64_t LoadBE64(std::span<const uint8_t> data, size_t offset)
+{
+    return (uint64_t{LoadBE32(data, offset)} << 32) | LoadBE32(data, offset + 4);
+}
+
+inline uint64_t LoadAddress(std::span<const uint8_t> data, size_t offset)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < 6; ++i) {
+        result |= uint64_t{data[offset + i]} << (i * 8);
+    }
+    return result;
+}
+
+// AD structures are [length][type][data...], the length covers the type and the data
+//
+bool ParseAdStructures(std::span<const uint8_t> data, ReceivedData &receivedData)
+{
+    size_t offset = 0;
+    while (offset < data.size()) {
+        const size_t length = data[offset];
+        if (length == 0) {
+            break; // Significant part ended
+        }
+        if (offset + 1 + length > data.size()) {
+            return false;
+        }
+
+        const auto type = data[offset + 1];
+        const auto value = data.subspan(offset + 2, length - 1);
+
+        if (type == kAdTypeManufacturerData && value.size() >= 2) {
+            const uint16_t companyId = value[0] | (value[1] << 8);
+            receivedData.manufacturerDataMap.TryEmplace(companyId, value.subspan(2));
+        }
+        offset += 1 + length;
+    }
+    return true;
+}
+} // namespace
+
+BtSnoopImporter::~BtSnoopImporter()
+{
+    Close();
+}
+
+bool BtSnoopImporter::IsBtSnoop(const QString &path)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const auto header = file.read(kMagic.size());
+    return header.size() == kMagic.size() &&
+           std::equal(kMagic.begin(), kMagic.end(), header.begin());
+}
+
+bool BtSnoopImporter::Open(const QString &path)
+{
+    Close();
+
+    _file.setFileName(path);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        LOG(Warn, "BtSnoop: Open '{}' failed. Error: {}", path, _file.errorString());
+        return false;
+    }
+    _fileSize = static_cast<uint64_t>(_file.size());
+
+    const auto header = Fetch(0, kFileHeaderSize);
+    if (header.size() != kFileHeaderSize ||
+        !std::equal(kMagic.begin(), kMagic.end(), header.begin()) || LoadBE32(header, 8) != 1)
+    {
+        LOG(Warn, "BtSnoop: '{}' isn't a btsnoop version 1 file.", path);
+        Close();
+        return false;
+    }
+
+    const auto dataLink = LoadBE32(header, 12);
+    if (dataLink != static_cast<uint32_t>(DataLink::H1) &&
+        dataLink != static_cast<uint32_t>(DataLink::H4) &&
+        dataLink != static_cast<uint32_t>(DataLink::Monitor))
+    {
+        LOG(Warn, "BtSnoop: Unsupported datalink type {}.", dataLink);
+        Close();
+        return false;
+    }
+
+    _dataLink = static_cast<DataLink>(dataLink);
+    _offset = kFileHeaderSize;
+    return true;
+}
+
+void BtSnoopImporter::Close()
+{
+    if (_window != nullptr) {
+        _file.unmap(_window);
+        _window = nullptr;
+    }
+    _windowBegin = _windowSize = 0;
+
+    if (_file.isOpen()) {
+        _file.close();
+    }
+
+    _fileSize = 0;
+    _offset = 0;
+    _pending.clear();
+    _pendingIndex = 0;
+    _stats = {};
+}
+
+std::optional<ReceivedData> BtSnoopImporter::Next()
+{
+    while (_pendingIndex >= _pending.size()) {
+        _pending.clear();
+        _pendingIndex = 0;
+
+        const auto header = Fetch(_offset, kPacketHeaderSize);
+        if (header.size() != kPacketHeaderSize) {
+            return std::nullopt;
+        }
+
+        const auto includedLength = LoadBE32(header, 4);
+        const auto flags = LoadBE32(header, 8);
+        const auto timestamp = static_cast<int64_t>(LoadBE64(header, 16)) - kUnixEpochOffset;
+
+        const auto packet = Fetch(_offset + kPacketHeaderSize, includedLength);
+        if (packet.size() != includedLength) {
+            return std::nullopt; // Truncated
+        }
+
+        _offset += kPacketHeaderSize + includedLength;
+        _stats.packets += 1;
+
+        const auto event = GetEvent(flags, packet);
+        if (event.has_value()) {
+            ParseEvent(timestamp, event.value());
+        }
+    }
+
+    return std::move(_pending[_pendingIndex++]);
+}
+
+auto BtSnoopImporter::GetStats() const -> const Stats &
+{
+    return _stats;
+}
+
+std::span<const uint8_t> BtSnoopImporter::Fetch(uint64_t offset, size_t size)
+{
+    if (offset + size > _fileSize) {
+        return {};
+    }
+
+    if (_window == nullptr || offset < _windowBegin ||
+        offset + size > _windowBegin + _windowSize)
+    {
+        if (_window != nullptr) {
+            _file.unmap(_window);
+        }
+
+        _windowBegin = offset;
+        _windowSize = std::min<uint64_t>(std::max(kWindowSize, size), _fileSize - offset);
+        _window = _file.map(_windowBegin, _windowSize);
+
+        if (_window == nullptr) {
+            LOG(Warn, "BtSnoop: Map failed. Error: {}", _file.errorString());
+            _windowSize = 0;
+            return {};
+        }
+    }
+
+    return std::span<const uint8_t>{_window + (offset - _windowBegin), size};
+}
+
+auto BtSnoopImporter::GetEvent(uint32_t flags, std::span<const uint8_t> packet)
+    -> std::optional<std::span<const uint8_t>>
+{
+    switch (_dataLink) {
+    case DataLink::H1:
+        // Bit 0 is set for received packets, bit 1 for commands and events
+        //
+        if ((flags & 0b11) == 0b11) {
+            return packet;
+        }
+        break;
+
+    case DataLink::H4:
+        if (!packet.empty() && packet[0] == kH4EventPacket) {
+            return packet.subspan(1);
+        }
+        break;
+
+    case DataLink::Monitor:
+        if ((flags & 0xFFFF) == kMonitorEventPacket) {
+            return packet;
+        }
+        break;
+    }
+    return std::nullopt;
+}
+
+void BtSnoopImporter::ParseEvent(int64_t timestamp, std::span<const uint8_t> event)
+{
+    if (event.size() < 4 || event[0] != kEventLeMeta) {
+        return;
+    }
+
+    const auto subevent = event[2];
+    if (subevent != kSubeventAdvertisingReport && subevent != kSubeventExtendedAdvertisingReport) {
+        return;
+    }
+
+    const size_t reports = event[3];
+    size_t offset = 4;
+
+    // Legacy:   event_type:1 address_type:1 address:6 data_length:1 data rssi:1
+    // Extended: event_type:2 address_type:1 address:6 primary_phy:1 secondary_phy:1 sid:1
+    //           tx_power:1 rssi:1 interval:2 direct_address_type:1 direct_address:6
+    //           data_length:1 data
+    //
+    const bool extended = subevent == kSubeventExtendedAdvertisingReport;
+    const size_t addressOffset = extended ? 3 : 2;
+    const size_t dataLengthOffset = extended ? 23 : 8;
+    const size_t fixedSize = extended ? 24 : 10;
+
+    for (size_t i = 0; i < reports; ++i) {
+        if (offset + fixedSize > event.size()) {
+            _stats.malformed += 1;
+            return;
+        }
+
+        const size_t dataLength = event[offset + dataLengthOffset];
+        const size_t dataOffset = offset + dataLengthOffset + 1;
+        const size_t end = offset + fixedSize + dataLength;
+        if (end > event.size()) {
+            _stats.malformed += 1;
+            return;
+        }
+
+        ReceivedData data;
+        data.timestamp = FromUnixMicroseconds(timestamp);
+        data.address = LoadAddress(event, offset + addressOffset);
+        data.rssi = static_cast<int8_t>(extended ? event[offset + 13] : event[end - 1]);
+
+        if (ParseAdStructures(event.subspan(dataOffset, dataLength), data)) {
+            _pending.push_back(std::move(data));
+            _stats.reports += 1;
+        }
+        else {
+            _stats.malformed += 1;
+        }
+
+        offset = end;
+    }
+}
+
+} // namespace Core::Capture
@@ -0,0 +1,85 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+#include <vector>
+#include <optional>
+
+#include <QFile>
+
+#include "Capture.h"
+
+// Imports advertisements from btsnoop HCI logs, as written by `btmon -w` or Android's HCI snoop.
+//
+// Only the LE Advertising Report and LE Extended Advertising Report events are imported. The file
+// is mapped through a sliding window, so logs of any size are read in constant memory.
+//
+// Fragmented extended advertising data isn't reassembled, each report is imported on its own.
+//
+namespace Core::Capture {
+
+class BtSnoopImporter
+{
+public:
+    struct Stats {
+        uint64_t packets{0};
+        uint64_t reports{0};
+        uint64_t malformed{0};
+    };
+
+    BtSnoopImporter() = default;
+    ~BtSnoopImporter();
+
+    static bool IsBtSnoop(const QString &path);
+
+    bool Open(const QString &path);
+    void Close();
+
+    std::optional<ReceivedData> Next();
+
+    const Stats &GetStats() const;
+
+private:
+    enum class DataLink : uint32_t {
+        H1 = 1001,
+        H4 = 1002,
+        Monitor = 2001,
+    };
+
+    constexpr static size_t kWindowSize = 64 * 1024 * 1024;
+
+    QFile _file;
+    uint64_t _fileSize{0};
+    DataLink _dataLink{DataLink::H4};
+    uint64_t _offset{0};
+
+    uchar *_window{nullptr};
+    uint64_t _windowBegin{0}, _windowSize{0};
+
+    std::vector<ReceivedData> _pending;
+    size_t _pendingIndex{0};
+    Stats _stats;
+
+    std::span<const uint8_t> Fetch(uint64_t offset, size_t size);
+    std::optional<std::span<const uint8_t>> GetEvent(uint32_t flags, std::span<const uint8_t> packet);
+    void ParseEvent(int64_t timestamp, std::span<const uint8_t> event);
+};
+
+} // namespace Core::Capture
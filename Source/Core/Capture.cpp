@@ -0,0 +1,560 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Capture.h"
+
+#include <bit>
+#include <cstring>
+#include <algorithm>
+
+#include "BtSnoop.h"
+#include "../Logger.h"
+
+namespace Core::Capture {
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+constexpr std::array<uint8_t, 6> kHeaderMagic{'A', 'P', 'D', 'C', 'A', 'P'};
+constexpr std::array<uint8_t, 6> kFooterMagic{'A', 'P', 'D', 'I', 'D', 'X'};
+
+constexpr size_t kHeaderSize = kHeaderMagic.size() + sizeof(uint32_t);
+constexpr size_t kIndexEntrySize = sizeof(int64_t) + sizeof(uint64_t);
+constexpr size_t kFooterSize = sizeof(uint64_t) * 2 + kFooterMagic.size();
+constexpr size_t kRecordFixedSize =
+    sizeof(uint16_t) + sizeof(int64_t) + sizeof(uint64_t) + sizeof(int16_t) + sizeof(uint8_t);
+
+template <class T>
+void Append(std::vector<uint8_t> &buffer, T value)
+{
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+}
+
+template <class T>
+T Load(std::span<const uint8_t> data, size_t offset)
+{
+    T result;
+    std::memcpy(&result, data.data() + offset, sizeof(result));
+    return result;
+}
+} // namespace
+
+int64_t ToUnixMicroseconds(const decltype(ReceivedData::timestamp) &timestamp)
+{
+    using Clock = std::decay_t<decltype(timestamp)>::clock;
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               Clock::to_sys(timestamp).time_since_epoch())
+        .count();
+}
+
+decltype(ReceivedData::timestamp) FromUnixMicroseconds(int64_t timestamp)
+{
+    using Clock = decltype(ReceivedData::timestamp)::clock;
+
+    return Clock::from_sys(std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+        std::chrono::sys_time<std::chrono::microseconds>{std::chrono::microseconds{timestamp}}));
+}
+
+ReceivedData ToReceivedData(const Record &record)
+{
+    ReceivedData result;
+    result.rssi = record.rssi;
+    result.timestamp = FromUnixMicroseconds(record.timestamp);
+    result.address = record.address;
+
+    record.ForEachManufacturerData([&](uint16_t companyId, std::span<const uint8_t> data) {
+        result.manufacturerDataMap.TryEmplace(companyId, data);
+    });
+    return result;
+}
+
+//
+// Writer
+//
+
+Writer::~Writer()
+{
+    Close();
+}
+
+bool Writer::Open(const QString &path)
+{
+    Close();
+
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    _file.setFileName(path);
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        LOG(Warn, "Capture: Open '{}' for writing failed. Error: {}", path, _file.errorString());
+        return false;
+    }
+
+    _buffer.clear();
+    _buffer.insert(_buffer.end(), kHeaderMagic.begin(), kHeaderMagic.end());
+    Append<uint32_t>(_buffer, kVersion);
+
+    _file.write(reinterpret_cast<const char *>(_buffer.data()), _buffer.size());
+    _file.flush();
+
+    _index.clear();
+    _offset = _buffer.size();
+    _records = 0;
+    return true;
+}
+
+void Writer::Close()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (!_file.isOpen()) {
+        return;
+    }
+
+    const uint64_t indexOffset = _offset;
+
+    _buffer.clear();
+    for (const auto &entry : _index) {
+        Append<int64_t>(_buffer, entry.timestamp);
+        Append<uint64_t>(_buffer, entry.offset);
+    }
+    Append<uint64_t>(_buffer, indexOffset);
+    Append<uint64_t>(_buffer, _records);
+    _buffer.insert(_buffer.end(), kFooterMagic.begin(), kFooterMagic.end());
+
+    _file.write(reinterpret_cast<const char *>(_buffer.data()), _buffer.size());
+    _file.close();
+
+    LOG(Info, "Capture: Closed. Records: {}", _records);
+}
+
+void Writer::Write(const ReceivedData &data)
+{
+    Write(std::span{&data, 1});
+}
+
+// The whole batch is written and flushed at once, the last records before a crash are usually
+// the interesting ones, but a flush per record is too slow for the ingest thread
+//
+void Writer::Write(std::span<const ReceivedData> batch)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (!_file.isOpen()) {
+        return;
+    }
+
+    _buffer.clear();
+    for (const auto &data : batch) {
+        AppendRecord(data);
+    }
+    Flush();
+}
+
+void Writer::Write(
+    int64_t timestamp, int16_t rssi, uint64_t address,
+    std::span<const std::pair<uint16_t, std::span<const uint8_t>>> manufacturerData)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (!_file.isOpen()) {
+        return;
+    }
+
+    _buffer.clear();
+    AppendRecord(timestamp, rssi, address, manufacturerData);
+    Flush();
+}
+
+void Writer::AppendRecord(const ReceivedData &data)
+{
+    using ManufacturerDataMap = Bluetooth::ManufacturerDataMap;
+
+    std::array<ManufacturerDataMap::ValueType, ManufacturerDataMap::kMaxEntries> manufacturerData;
+    size_t count = 0;
+
+    for (const auto &value : data.manufacturerDataMap) {
+        manufacturerData[count++] = value;
+    }
+
+    AppendRecord(
+        ToUnixMicroseconds(data.timestamp), data.rssi, data.address,
+        std::span{manufacturerData}.first(count));
+}
+
+void Writer::AppendRecord(
+    int64_t timestamp, int16_t rssi, uint64_t address,
+    std::span<const std::pair<uint16_t, std::span<const uint8_t>>> manufacturerData)
+{
+    const size_t begin = _buffer.size();
+
+    Append<uint16_t>(_buffer, 0); // Size, filled below
+    Append<int64_t>(_buffer, timestamp);
+    Append<uint64_t>(_buffer, address);
+    Append<int16_t>(_buffer, rssi);
+
+    const auto count = std::min<size_t>(manufacturerData.size(), UINT8_MAX);
+    Append<uint8_t>(_buffer, static_cast<uint8_t>(count));
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto &[companyId, bytes] = manufacturerData[i];
+        const auto length = std::min<size_t>(bytes.size(), UINT16_MAX);
+
+        Append<uint16_t>(_buffer, companyId);
+        Append<uint16_t>(_buffer, static_cast<uint16_t>(length));
+        _buffer.insert(_buffer.end(), bytes.begin(), bytes.begin() + length);
+    }
+
+    const size_t size = _buffer.size() - begin - sizeof(uint16_t);
+    if (size > UINT16_MAX) {
+        LOG(Warn, "Capture: Record too large, dropped. Size: {}", size);
+        _buffer.resize(begin);
+        return;
+    }
+    const auto size16 = static_cast<uint16_t>(size);
+    std::memcpy(_buffer.data() + begin, &size16, sizeof(size16));
+
+    if (_records % kIndexInterval == 0) {
+        _index.push_back(IndexEntry{timestamp, _offset});
+    }
+
+    _offset += _buffer.size() - begin;
+    _records += 1;
+}
+
+void Writer::Flush()
+{
+    if (_buffer.empty()) {
+        return;
+    }
+
+    _file.write(reinterpret_cast<const char *>(_buffer.data()), _buffer.size());
+    _file.flush();
+}
+
+//
+// Reader
+//
+
+Reader::~Reader()
+{
+    Close();
+}
+
+bool Reader::Open(const QString &path)
+{
+    Close();
+
+    _file.setFileName(path);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        LOG(Warn, "Capture: Open '{}' for reading failed. Error: {}", path, _file.errorString());
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(_file.size());
+    const uchar *mapped = size != 0 ? _file.map(0, _file.size()) : nullptr;
+    if (mapped == nullptr) {
+        LOG(Warn, "Capture: Map '{}' failed. Error: {}", path, _file.errorString());
+        Close();
+        return false;
+    }
+    _data = std::span<const uint8_t>{mapped, size};
+
+    if (size < kHeaderSize ||
+        !std::equal(kHeaderMagic.begin(), kHeaderMagic.end(), _data.begin()) ||
+        Load<uint32_t>(_data, kHeaderMagic.size()) != kVersion)
+    {
+        LOG(Warn, "Capture: '{}' isn't a capture of version {}.", path, kVersion);
+        Close();
+        return false;
+    }
+
+    _recordsBegin = kHeaderSize;
+    if (!LoadIndex()) {
+        LOG(Info, "Capture: '{}' wasn't closed properly, scanning records.", path);
+        ScanIndex();
+    }
+
+    _offset = _recordsBegin;
+    return true;
+}
+
+void Reader::Close()
+{
+    _data = {};
+    _index.clear();
+    _recordsBegin = _recordsEnd = _offset = 0;
+    _records = 0;
+
+    if (_file.isOpen()) {
+        _file.close(); // Unmaps too
+    }
+}
+
+uint64_t Reader::GetRecordCount() const
+{
+    return _records;
+}
+
+std::optional<Record> Reader::Next()
+{
+    size_t nextOffset;
+    auto result = ParseAt(_offset, nextOffset);
+    if (result.has_value()) {
+        _offset = nextOffset;
+    }
+    return result;
+}
+
+void Reader::Rewind()
+{
+    _offset = _recordsBegin;
+}
+
+void Reader::Seek(int64_t timestamp)
+{
+    auto iter = std::upper_bound(
+        _index.begin(), _index.end(), timestamp,
+        [](int64_t timestamp, const IndexEntry &entry) { return timestamp < entry.timestamp; });
+
+    _offset = iter == _index.begin() ? _recordsBegin : std::prev(iter)->offset;
+
+    while (true) {
+        size_t nextOffset;
+        const auto record = ParseAt(_offset, nextOffset);
+        if (!record.has_value() || record->timestamp >= timestamp) {
+            break;
+        }
+        _offset = nextOffset;
+    }
+}
+
+std::optional<Record> Reader::ParseAt(size_t offset, size_t &nextOffset) const
+{
+    if (offset + kRecordFixedSize > _recordsEnd) {
+        return std::nullopt;
+    }
+
+    const size_t size = Load<uint16_t>(_data, offset);
+    if (size + sizeof(uint16_t) < kRecordFixedSize || offset + sizeof(uint16_t) + size > _recordsEnd)
+    {
+        return std::nullopt;
+    }
+
+    size_t cursor = offset + sizeof(uint16_t);
+
+    Record result;
+    result.timestamp = Load<int64_t>(_data, cursor);
+    cursor += sizeof(int64_t);
+    result.address = Load<uint64_t>(_data, cursor);
+    cursor += sizeof(uint64_t);
+    result.rssi = Load<int16_t>(_data, cursor);
+    cursor += sizeof(int16_t);
+
+    nextOffset = offset + sizeof(uint16_t) + size;
+    result.manufacturerData = _data.subspan(cursor, nextOffset - cursor);
+    return result;
+}
+
+bool Reader::LoadIndex()
+{
+    if (_data.size() < kHeaderSize + kFooterSize) {
+        return false;
+    }
+
+    const size_t footer = _data.size() - kFooterSize;
+    if (!std::equal(kFooterMagic.begin(), kFooterMagic.end(), _data.begin() + footer + 16)) {
+        return false;
+    }
+
+    const auto indexOffset = Load<uint64_t>(_data, footer);
+    const auto records = Load<uint64_t>(_data, footer + 8);
+
+    if (indexOffset < kHeaderSize || indexOffset > footer ||
+        (footer - indexOffset) % kIndexEntrySize != 0)
+    {
+        return false;
+    }
+
+    _index.clear();
+    for (size_t offset = indexOffset; offset < footer; offset += kIndexEntrySize) {
+        _index.push_back(IndexEntry{Load<int64_t>(_data, offset), Load<uint64_t>(_data, offset + 8)});
+    }
+
+    _recordsEnd = indexOffset;
+    _records = records;
+    return true;
+}
+
+void Reader::ScanIndex()
+{
+    _index.clear();
+    _records = 0;
+    _recordsEnd = _data.size();
+
+    size_t offset = _recordsBegin, nextOffset;
+    while (true) {
+        const auto record = ParseAt(offset, nextOffset);
+        if (!record.has_value()) {
+            break;
+        }
+        if (_records % kIndexInterval == 0) {
+            _index.push_back(IndexEntry{record->timestamp, offset});
+        }
+        _records += 1;
+        offset = nextOffset;
+    }
+
+    // Ignore the truncated tail if any
+    //
+    _recordsEnd = offset;
+}
+
+//
+// ReplayAdvertisementWatcher
+//
+
+ReplayAdvertisementWatcher::ReplayAdvertisementWatcher(QString path, double speed)
+    : _path{std::move(path)}, _speed{speed}
+{
+}
+
+ReplayAdvertisementWatcher::~ReplayAdvertisementWatcher()
+{
+    Stop();
+}
+
+bool ReplayAdvertisementWatcher::Start()
+{
+    Stop();
+
+    if (BtSnoopImporter::IsBtSnoop(_path)) {
+        _btSnoop = std::make_unique<BtSnoopImporter>();
+        if (!_btSnoop->Open(_path)) {
+            return false;
+        }
+        LOG(Info, "Replay: Started. btsnoop, speed: {}", _speed);
+    }
+    else {
+        _btSnoop.reset();
+        if (!_reader.Open(_path)) {
+            return false;
+        }
+        LOG(Info, "Replay: Started. Records: {}, speed: {}", _reader.GetRecordCount(), _speed);
+    }
+
+    _stop = false;
+    CbStateChanged().Invoke(State::Started, std::nullopt);
+
+    const uint64_t run = ++_run;
+    _thread = std::thread{&ReplayAdvertisementWatcher::Run, this, run};
+    {
+        std::lock_guard<std::mutex> lock{_conVarMutex};
+        _launched = run;
+    }
+    _stopConVar.notify_all();
+    return true;
+}
+
+bool ReplayAdvertisementWatcher::Stop()
+{
+    _stop = true;
+    _stopConVar.notify_all();
+
+    if (_thread.joinable()) {
+        // Called from a handler on the replay thread, which can't join itself. It leaves the loop
+        // once the handler returns, even if it is restarted meanwhile, as its run is superseded.
+        //
+        if (_thread.get_id() == std::this_thread::get_id()) {
+            _thread.detach();
+        }
+        else {
+            _thread.join();
+        }
+    }
+    return true;
+}
+
+std::optional<ReceivedData> ReplayAdvertisementWatcher::Next()
+{
+    if (_btSnoop != nullptr) {
+        return _btSnoop->Next();
+    }
+
+    const auto record = _reader.Next();
+    if (!record.has_value()) {
+        return std::nullopt;
+    }
+    return ToReceivedData(record.value());
+}
+
+void ReplayAdvertisementWatcher::Run(uint64_t run)
+{
+    using Clock = std::chrono::steady_clock;
+
+    const auto begin = Clock::now();
+    std::optional<int64_t> firstTimestamp;
+    uint64_t replayed = 0;
+
+    // A handler may stop or restart it, which needs `_thread` to be stored first
+    //
+    {
+        std::unique_lock<std::mutex> lock{_conVarMutex};
+        _stopConVar.wait(lock, [&] { return _launched >= run; });
+    }
+
+    const auto stopped = [&] { return _stop || _run != run; };
+
+    while (!stopped()) {
+        auto data = Next();
+        if (!data.has_value()) {
+            break;
+        }
+
+        const auto timestamp = ToUnixMicroseconds(data->timestamp);
+        if (!firstTimestamp.has_value()) {
+            firstTimestamp = timestamp;
+        }
+
+        if (_speed > 0) {
+            const auto due = begin + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double, std::micro>{
+                                             (timestamp - firstTimestamp.value()) / _speed});
+
+            std::unique_lock<std::mutex> lock{_conVarMutex};
+            if (_stopConVar.wait_until(lock, due, stopped)) {
+                break;
+            }
+        }
+
+        CbReceived().Invoke(data.value());
+        replayed += 1;
+    }
+
+    LOG(Info, "Replay: Finished. Replayed: {}", replayed);
+
+    // A restart from a handler has reported its own state already
+    //
+    if (_run == run) {
+        CbStateChanged().Invoke(State::Stopped, std::nullopt);
+    }
+}
+
+} // namespace Core::Capture
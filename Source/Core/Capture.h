@@ -0,0 +1,208 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+#include <mutex>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <condition_variable>
+
+#include <QFile>
+
+#include "Bluetooth.h"
+
+// A compact, append-only file format for received advertisements. All integers are little-endian.
+//
+//   Header        magic "APDCAP", version
+//   Record...     appended while capturing
+//   IndexEntry... written on close, one every `kIndexInterval` records
+//   Footer        where the index starts, the record count, magic "APDIDX"
+//
+//   Record
+//     uint16_t size       Of the rest of the record
+//     int64_t  timestamp  Microseconds since the Unix epoch
+//     uint64_t address
+//     int16_t  rssi
+//     uint8_t  count      Of manufacturer data entries, each is
+//                           uint16_t companyId, uint16_t length, uint8_t data[length]
+//
+// A capture that wasn't closed properly has no index and footer, the reader then rebuilds the
+// index by scanning the records and ignores a truncated last record.
+//
+namespace Core::Capture {
+
+using ReceivedData = Bluetooth::AdvertisementWatcher::ReceivedData;
+
+constexpr inline uint32_t kVersion = 1;
+constexpr inline uint32_t kIndexInterval = 1024;
+
+struct Record {
+    int64_t timestamp{0}; // Microseconds since the Unix epoch
+    int16_t rssi{0};
+    uint64_t address{0};
+    std::span<const uint8_t> manufacturerData; // The raw entries, starting with the count
+
+    template <class Fn>
+    bool ForEachManufacturerData(Fn &&function) const;
+};
+
+int64_t ToUnixMicroseconds(const decltype(ReceivedData::timestamp) &timestamp);
+decltype(ReceivedData::timestamp) FromUnixMicroseconds(int64_t timestamp);
+
+ReceivedData ToReceivedData(const Record &record);
+
+class Writer
+{
+public:
+    Writer() = default;
+    ~Writer();
+
+    bool Open(const QString &path);
+    void Close();
+
+    void Write(const ReceivedData &data);
+    void Write(std::span<const ReceivedData> batch);
+    void Write(
+        int64_t timestamp, int16_t rssi, uint64_t address,
+        std::span<const std::pair<uint16_t, std::span<const uint8_t>>> manufacturerData);
+
+private:
+    struct IndexEntry {
+        int64_t timestamp;
+        uint64_t offset;
+    };
+
+    std::mutex _mutex;
+    QFile _file;
+    std::vector<uint8_t> _buffer;
+    std::vector<IndexEntry> _index;
+    uint64_t _offset{0};
+    uint64_t _records{0};
+
+    // Both are called with the lock held. `AppendRecord` adds a record to the buffer and `Flush`
+    // writes the buffer out.
+    //
+    void AppendRecord(const ReceivedData &data);
+    void AppendRecord(
+        int64_t timestamp, int16_t rssi, uint64_t address,
+        std::span<const std::pair<uint16_t, std::span<const uint8_t>>> manufacturerData);
+    void Flush();
+};
+
+class Reader
+{
+public:
+    Reader() = default;
+    ~Reader();
+
+    bool Open(const QString &path);
+    void Close();
+
+    uint64_t GetRecordCount() const;
+
+    std::optional<Record> Next();
+    void Rewind();
+
+    // Moves to the first record not earlier than `timestamp`
+    //
+    void Seek(int64_t timestamp);
+
+private:
+    struct IndexEntry {
+        int64_t timestamp;
+        uint64_t offset;
+    };
+
+    QFile _file;
+    std::span<const uint8_t> _data;
+    size_t _recordsBegin{0}, _recordsEnd{0}, _offset{0};
+    uint64_t _records{0};
+    std::vector<IndexEntry> _index;
+
+    std::optional<Record> ParseAt(size_t offset, size_t &nextOffset) const;
+    bool LoadIndex();
+    void ScanIndex();
+};
+
+class BtSnoopImporter;
+
+// Emits the advertisements of a capture or a btsnoop HCI log through `CbReceived()` in place of
+// the live watcher.
+//
+// A `speed` of 1 replays in real time according to the timestamps, N replays N times faster and
+// 0 replays as fast as possible.
+//
+class ReplayAdvertisementWatcher final : public Bluetooth::AdvertisementWatcherInterface
+{
+public:
+    ReplayAdvertisementWatcher(QString path, double speed);
+    ~ReplayAdvertisementWatcher();
+
+    bool Start() override;
+    bool Stop() override;
+
+private:
+    QString _path;
+    double _speed;
+    Reader _reader;
+    std::unique_ptr<BtSnoopImporter> _btSnoop;
+    std::thread _thread;
+    std::atomic<bool> _stop{false};
+    std::atomic<uint64_t> _run{0}; // Bumped by every start, a thread only serves its own run
+    uint64_t _launched{0};         // The last run whose thread is stored, under `_conVarMutex`
+    std::mutex _conVarMutex;
+    std::condition_variable _stopConVar;
+
+    std::optional<ReceivedData> Next();
+    void Run(uint64_t run);
+};
+
+template <class Fn>
+bool Record::ForEachManufacturerData(Fn &&function) const
+{
+    if (manufacturerData.empty()) {
+        return false;
+    }
+
+    const size_t count = manufacturerData[0];
+    size_t offset = 1;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (offset + 4 > manufacturerData.size()) {
+            return false;
+        }
+        const uint16_t companyId = manufacturerData[offset] | (manufacturerData[offset + 1] << 8);
+        const size_t length = manufacturerData[offset + 2] | (manufacturerData[offset + 3] << 8);
+        offset += 4;
+
+        if (offset + length > manufacturerData.size()) {
+            return false;
+        }
+        function(companyId, manufacturerData.subspan(offset, length));
+        offset += length;
+    }
+    return true;
+}
+
+} // namespace Core::Capture
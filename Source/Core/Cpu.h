@@ -0,0 +1,97 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#if defined _M_X64 || defined _M_IX86 || defined __x86_64__ || defined __i386__
+    #define APD_ARCH_X86
+#endif
+
+#if defined APD_ARCH_X86
+    #if defined _MSC_VER
+        #include <intrin.h>
+        #include <immintrin.h>
+    #else
+        #include <cpuid.h>
+        #include <immintrin.h>
+    #endif
+#endif
+
+// MSVC allows using any intrinsic in any function, while GCC and Clang require the function to
+// be compiled for the target explicitly.
+//
+#if defined APD_ARCH_X86 && !defined _MSC_VER
+    #define APD_TARGET_AVX2 __attribute__((target("avx2")))
+    #define APD_TARGET_AESNI __attribute__((target("aes")))
+#else
+    #define APD_TARGET_AVX2
+    #define APD_TARGET_AESNI
+#endif
+
+namespace Core::Cpu {
+
+struct Features {
+    bool sse2{false};
+    bool avx2{false};
+    bool aesni{false};
+};
+
+namespace Details {
+
+inline Features Detect()
+{
+    Features result;
+
+#if defined APD_ARCH_X86
+    #if defined _MSC_VER
+    int info[4]{};
+
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    result.sse2 = (info[3] & (1 << 26)) != 0;
+    result.aesni = (info[2] & (1 << 25)) != 0;
+
+    // AVX2 also needs the OS to save the YMM registers on context switches
+    //
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool ymmEnabled = osxsave && (_xgetbv(0) & 0b110) == 0b110;
+
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        result.avx2 = ymmEnabled && (info[1] & (1 << 5)) != 0;
+    }
+    #else
+    __builtin_cpu_init();
+    result.sse2 = __builtin_cpu_supports("sse2");
+    result.avx2 = __builtin_cpu_supports("avx2");
+    result.aesni = __builtin_cpu_supports("aes");
+    #endif
+#endif
+
+    return result;
+}
+} // namespace Details
+
+inline const Features &GetFeatures()
+{
+    static const Features i = Details::Detect();
+    return i;
+}
+} // namespace Core::Cpu
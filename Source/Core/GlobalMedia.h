@@ -24,13 +24,13 @@
 
 namespace Core::GlobalMedia {
 
-inline void Play()
+inline Helper::Task<> Play()
 {
-    Controller::GetInstance().Play();
+    return Controller::GetInstance().Play();
 }
 
-inline void Pause()
+inline Helper::Task<> Pause()
 {
-    Controller::GetInstance().Pause();
+    return Controller::GetInstance().Pause();
 }
 } // namespace Core::GlobalMedia
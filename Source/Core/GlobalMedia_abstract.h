@@ -20,6 +20,8 @@
 
 #include <optional>
 
+#include "../Helper.h"
+
 namespace Core::GlobalMedia::Details {
 
 class ControllerAbstract
@@ -28,7 +30,7 @@ public:
     ControllerAbstract() = default;
     virtual ~ControllerAbstract() = default;
 
-    virtual void Play() = 0;
-    virtual void Pause() = 0;
+    virtual Helper::Task<> Play() = 0;
+    virtual Helper::Task<> Pause() = 0;
 };
 } // namespace Core::GlobalMedia::Details
@@ -41,19 +41,19 @@ public:
 
     virtual inline ~MediaProgramThroughVirtualKeyAbstract() {}
 
-    bool IsAvailable() override
+    Helper::Task<bool> IsAvailableAsync([[maybe_unused]] Helper::CancellationToken token) override
     {
         if (_windowProcess.has_value()) {
-            return true;
+            co_return true;
         }
 
         _windowProcess = FindWindowAndProcess();
         if (!_windowProcess.has_value()) {
-            return false;
+            co_return false;
         }
 
         _audioMeterInfo = GetProcessAudioMeterInfo();
-        return true;
+        co_return true;
     }
 
     bool IsPlaying() const override
@@ -62,26 +62,26 @@ public:
         return optAudioVolume.has_value() && optAudioVolume.value() != 0.f;
     }
 
-    bool Play() override
+    Helper::Task<bool> PlayAsync([[maybe_unused]] Helper::CancellationToken token) override
     {
         LOG(Trace, "Do play.");
 
         if (IsPlaying()) {
             LOG(Trace, "The media program is already playing.");
-            return true;
+            co_return true;
         }
-        return Switch();
+        co_return co_await SwitchAsync();
     }
 
-    bool Pause() override
+    Helper::Task<bool> PauseAsync([[maybe_unused]] Helper::CancellationToken token) override
     {
         LOG(Trace, "Do pause.");
 
         if (!IsPlaying()) {
             LOG(Trace, "The media program nothing is playing.");
-            return true;
+            co_return true;
         }
-        return Switch();
+        co_return co_await SwitchAsync();
     }
 
 protected:
@@ -268,20 +268,22 @@ private:
         return std::nullopt;
     }
 
-    bool Switch()
+    // Not cancellable, the key must not be left pressed
+    //
+    Helper::Task<bool> SwitchAsync()
     {
         bool postDown = PostMessageW(_windowProcess->first, WM_KEYDOWN, VK_SPACE, 0) != 0;
 
-        std::this_thread::sleep_for(50ms);
+        co_await Helper::Delay(50ms, Helper::BlockingExecutor::GetInstance());
 
         bool postUp = PostMessageW(_windowProcess->first, WM_KEYUP, VK_SPACE, 0) != 0;
 
         if (!postDown || !postUp) {
             LOG(Trace, "Switch failed. Post messages failed: hwnd '{}' down '{}' up '{}'",
                 (void *)_windowProcess->first, postDown, postUp);
-            return false;
+            co_return false;
         }
-        return true;
+        co_return true;
     }
 };
 
@@ -296,24 +298,24 @@ class UniversalSystemSession final : public MediaProgramAbstract
 public:
     UniversalSystemSession() = default;
 
-    bool IsAvailable() override
+    Helper::Task<bool> IsAvailableAsync(Helper::CancellationToken token) override
     {
         try {
-            _currentSession = GetCurrentSession();
+            _currentSession = co_await GetCurrentSessionAsync(std::move(token));
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
             LOG(Warn, "UniversalSystemSession get current session failed. Code: {:#x}, Message: {}",
                 ex.code(), winrt::to_string(ex.message()));
-            return false;
+            co_return false;
         }
 
         if (!_currentSession.value()) {
             _currentSession.reset();
             LOG(Trace, "UniversalSystemSession current session is unavailable.");
-            return false;
+            co_return false;
         }
 
-        return true;
+        co_return true;
     }
 
     bool IsPlaying() const override
@@ -321,28 +323,28 @@ public:
         return IsPlaying(_currentSession.value());
     }
 
-    bool Play() override
+    Helper::Task<bool> PlayAsync(Helper::CancellationToken token) override
     {
         try {
-            _currentSession->TryPlayAsync().get();
-            return true;
+            co_await OS::Windows::Winrt::Await(_currentSession->TryPlayAsync(), std::move(token));
+            co_return true;
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
             LOG(Warn, "_currentSession->TryPlayAsync() failed. {}", Helper::ToString(ex));
-            return false;
         }
+        co_return false;
     }
 
-    bool Pause() override
+    Helper::Task<bool> PauseAsync(Helper::CancellationToken token) override
     {
         try {
-            _currentSession->TryPauseAsync().get();
-            return true;
+            co_await OS::Windows::Winrt::Await(_currentSession->TryPauseAsync(), std::move(token));
+            co_return true;
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
             LOG(Warn, "_currentSession->TryPauseAsync() failed. {}", Helper::ToString(ex));
-            return false;
         }
+        co_return false;
     }
 
     std::wstring GetProgramName() const override
@@ -359,17 +361,20 @@ protected:
 private:
     std::optional<GlobalSystemMediaTransportControlsSession> _currentSession;
 
-    static GlobalSystemMediaTransportControlsSession GetCurrentSession()
+    static Helper::Task<GlobalSystemMediaTransportControlsSession>
+    GetCurrentSessionAsync(Helper::CancellationToken token)
     {
-        return GlobalSystemMediaTransportControlsSessionManager::RequestAsync()
-            .get()
-            .GetCurrentSession();
+        const auto manager = co_await OS::Windows::Winrt::Await(
+            GlobalSystemMediaTransportControlsSessionManager::RequestAsync(), std::move(token));
+        co_return manager.GetCurrentSession();
     }
 
-    static auto GetSessions()
+    static Helper::Task<std::vector<GlobalSystemMediaTransportControlsSession>>
+    GetSessionsAsync(Helper::CancellationToken token)
     {
-        auto sessions =
-            GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get().GetSessions();
+        const auto manager = co_await OS::Windows::Winrt::Await(
+            GlobalSystemMediaTransportControlsSessionManager::RequestAsync(), std::move(token));
+        const auto sessions = manager.GetSessions();
 
         std::vector<GlobalSystemMediaTransportControlsSession> result;
         result.reserve(sessions.Size());
@@ -378,7 +383,7 @@ private:
             result.emplace_back(sessions.GetAt(i));
         }
 
-        return result;
+        co_return result;
     }
 
     static bool IsPlaying(const GlobalSystemMediaTransportControlsSession &gsmtcs)
@@ -476,14 +481,15 @@ protected:
     }
 };
 
-auto GetAvailablePrograms()
+Helper::Task<std::vector<std::unique_ptr<MediaProgramAbstract>>>
+GetAvailableProgramsAsync(Helper::CancellationToken token)
 {
     std::vector<std::unique_ptr<MediaProgramAbstract>> result;
 
 #define PUSH_IF_AVAILABLE(type)                                                                    \
     {                                                                                              \
         auto ptr = std::make_unique<type>();                                                       \
-        if (ptr->IsAvailable()) {                                                                  \
+        if (co_await ptr->IsAvailableAsync(token)) {                                               \
             result.emplace_back(std::move(ptr));                                                   \
         }                                                                                          \
     }
@@ -496,7 +502,7 @@ auto GetAvailablePrograms()
 #undef PUSH_IF_AVAILABLE
 
     if (result.empty()) {
-        return result;
+        co_return result;
     }
 
     // Sort by priority
@@ -505,21 +511,90 @@ auto GetAvailablePrograms()
         return first->GetPriority() < second->GetPriority();
     });
 
-    return result;
+    co_return result;
 }
 } // namespace Details
 
-void Controller::Play()
+Helper::Task<> Controller::Play()
+{
+    co_await AcquireTurn();
+
+    Helper::CancellationSource cancellation;
+    cancellation.CancelAfter(kTimeout);
+    try {
+        co_await PlayAsync(cancellation.GetToken());
+    }
+    catch (const Helper::OperationCancelled &) {
+        LOG(Warn, "Playing media timed out.");
+    }
+
+    ReleaseTurn();
+}
+
+Helper::Task<> Controller::Pause()
 {
-    std::lock_guard<std::mutex> lock{_mutex};
+    co_await AcquireTurn();
+
+    Helper::CancellationSource cancellation;
+    cancellation.CancelAfter(kTimeout);
+    try {
+        co_await PauseAsync(cancellation.GetToken());
+    }
+    catch (const Helper::OperationCancelled &) {
+        LOG(Warn, "Pausing media timed out.");
+    }
 
+    ReleaseTurn();
+}
+
+auto Controller::AcquireTurn() -> TurnAwaiter
+{
+    return TurnAwaiter{*this};
+}
+
+// Doesn't suspend if no one has the turn
+//
+bool Controller::TurnAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock{controller._mutex};
+
+    if (!controller._busy) {
+        controller._busy = true;
+        return false;
+    }
+    controller._waiting.push_back(handle);
+    return true;
+}
+
+// The turn is handed to the next waiter directly, it resumes on the calling thread
+//
+void Controller::ReleaseTurn()
+{
+    std::coroutine_handle<> next;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        if (_waiting.empty()) {
+            _busy = false;
+            return;
+        }
+        next = _waiting.front();
+        _waiting.pop_front();
+    }
+    next.resume();
+}
+
+// The programs are only touched by the caller that has the turn
+//
+Helper::Task<> Controller::PlayAsync(Helper::CancellationToken token)
+{
     if (_pausedPrograms.empty()) {
         LOG(Trace, L"Paused programs vector is empty.");
-        return;
+        co_return;
     }
 
     for (const auto &program : _pausedPrograms) {
-        if (!program->Play()) {
+        if (!co_await program->PlayAsync(token)) {
             LOG(Warn, L"Failed to play media. Program name: {}", program->GetProgramName());
         }
         else {
@@ -530,15 +605,13 @@ void Controller::Play()
     _pausedPrograms.clear();
 }
 
-void Controller::Pause()
+Helper::Task<> Controller::PauseAsync(Helper::CancellationToken token)
 {
-    std::lock_guard<std::mutex> lock{_mutex};
-
-    auto programs = Details::GetAvailablePrograms();
+    auto programs = co_await Details::GetAvailableProgramsAsync(token);
 
     for (auto &&program : programs) {
         if (program->IsPlaying()) {
-            if (!program->Pause()) {
+            if (!co_await program->PauseAsync(token)) {
                 LOG(Warn, L"Failed to pause media. Program name: {}", program->GetProgramName());
             }
             else {
@@ -29,6 +29,7 @@
 #include <winrt/Windows.Foundation.Collections.h>
 #include <winrt/Windows.Media.Control.h>
 
+#include <deque>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -57,10 +58,10 @@ public:
 
     virtual inline ~MediaProgramAbstract(){};
 
-    virtual bool IsAvailable() = 0;
+    virtual Helper::Task<bool> IsAvailableAsync(Helper::CancellationToken token) = 0;
     virtual bool IsPlaying() const = 0;
-    virtual bool Play() = 0;
-    virtual bool Pause() = 0;
+    virtual Helper::Task<bool> PlayAsync(Helper::CancellationToken token) = 0;
+    virtual Helper::Task<bool> PauseAsync(Helper::CancellationToken token) = 0;
 
     virtual std::wstring GetProgramName() const = 0;
     virtual Priority GetPriority() const = 0;
@@ -74,11 +75,37 @@ protected:
     friend Helper::Singleton<Controller>;
 
 public:
-    void Play() override;
-    void Pause() override;
+    // Run one at a time in the order they are started, a call that is started while another one
+    // is running resumes once it has finished
+    //
+    Helper::Task<> Play() override;
+    Helper::Task<> Pause() override;
 
 private:
+    constexpr static auto kTimeout = std::chrono::seconds{5};
+
+    struct TurnAwaiter {
+        Controller &controller;
+
+        inline bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle);
+
+        inline void await_resume() const noexcept {}
+    };
+
     std::mutex _mutex;
+    bool _busy{false};
+    std::deque<std::coroutine_handle<>> _waiting;
     std::vector<std::unique_ptr<Details::MediaProgramAbstract>> _pausedPrograms;
+
+    TurnAwaiter AcquireTurn();
+    void ReleaseTurn();
+
+    Helper::Task<> PlayAsync(Helper::CancellationToken token);
+    Helper::Task<> PauseAsync(Helper::CancellationToken token);
 };
 } // namespace Core::GlobalMedia
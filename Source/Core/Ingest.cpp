@@ -0,0 +1,175 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Ingest.h"
+
+#include <algorithm>
+
+#include "../Logger.h"
+
+namespace Core::Ingest {
+
+Queue::Queue(Config config) : _config{std::move(config)}, _queue{_config.capacity}
+{
+    _batch.reserve(_config.batchSize);
+    _coalesced.reserve(_config.batchSize);
+}
+
+Queue::~Queue()
+{
+    Stop();
+}
+
+void Queue::Start(FnBatch onBatch, FnBatch onDrained)
+{
+    Stop();
+
+    _stop = false;
+    _thread = std::thread{&Queue::Thread, this, std::move(onBatch), std::move(onDrained)};
+}
+
+void Queue::Stop()
+{
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    _stop = true;
+    _signal.fetch_add(1);
+    _signal.notify_one();
+    _thread.join();
+
+    LOG(Info, "Ingest: Stopped. {}", Helper::ToString(GetCounters()));
+}
+
+void Queue::Push(const ReceivedData &data)
+{
+    bool pushed = _queue.TryPush(data);
+
+    if (!pushed && _config.overflowPolicy == OverflowPolicy::DropOldest) {
+        // Another producer may refill the freed cell first, then the incoming one is dropped
+        //
+        ReceivedData oldest;
+        if (_queue.TryPop(oldest)) {
+            _counters.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        pushed = _queue.TryPush(data);
+    }
+
+    if (!pushed) {
+        _counters.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    _counters.pushed.fetch_add(1, std::memory_order_relaxed);
+
+    // Waking the processing thread costs a system call, so only do it when it is asleep
+    //
+    _signal.fetch_add(1);
+    if (_waiting) {
+        _signal.notify_one();
+    }
+}
+
+Counters Queue::GetCounters() const
+{
+    return Counters{
+        .pushed = _counters.pushed.load(std::memory_order_relaxed),
+        .dropped = _counters.dropped.load(std::memory_order_relaxed),
+        .coalesced = _counters.coalesced.load(std::memory_order_relaxed),
+        .processed = _counters.processed.load(std::memory_order_relaxed),
+        .batches = _counters.batches.load(std::memory_order_relaxed),
+    };
+}
+
+// The thread only waits once the batch it has popped is handled
+//
+bool Queue::IsIdle() const
+{
+    return _waiting && _queue.ApproxSize() == 0;
+}
+
+void Queue::Thread(FnBatch onBatch, FnBatch onDrained)
+{
+    while (!_stop) {
+        _batch.clear();
+
+        // Pop straight into the batch, a `ReceivedData` is a few hundred bytes
+        //
+        while (_batch.size() < _config.batchSize) {
+            if (!_queue.TryPop(_batch.emplace_back())) {
+                _batch.pop_back();
+                break;
+            }
+        }
+
+        if (_batch.empty()) {
+            Wait();
+            continue;
+        }
+
+        if (onDrained) {
+            onDrained(_batch);
+        }
+
+        Coalesce();
+
+        _counters.coalesced.fetch_add(_batch.size() - _coalesced.size(), std::memory_order_relaxed);
+        _counters.processed.fetch_add(_coalesced.size(), std::memory_order_relaxed);
+        _counters.batches.fetch_add(1, std::memory_order_relaxed);
+
+        onBatch(_coalesced);
+    }
+}
+
+// Walks the batch backwards so that the newest advertisement of each address wins, then restores
+// the arrival order. A batch is small, a linear search is faster than hashing here.
+//
+void Queue::Coalesce()
+{
+    _coalesced.clear();
+
+    for (auto iter = _batch.rbegin(); iter != _batch.rend(); ++iter) {
+        const bool superseded =
+            std::any_of(_coalesced.begin(), _coalesced.end(), [&](const ReceivedData &newer) {
+                return newer.address == iter->address;
+            });
+
+        if (!superseded) {
+            _coalesced.push_back(*iter);
+        }
+    }
+
+    std::reverse(_coalesced.begin(), _coalesced.end());
+}
+
+// A producer bumps `_signal` after pushing and checks `_waiting` afterwards, so either it sees
+// `_waiting` and wakes us up, or `_signal` has changed before we go to sleep on it.
+//
+void Queue::Wait()
+{
+    const auto signal = _signal.load();
+
+    _waiting = true;
+    if (_queue.ApproxSize() == 0 && !_stop) {
+        _signal.wait(signal);
+    }
+    _waiting = false;
+}
+
+} // namespace Core::Ingest
@@ -0,0 +1,120 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#include "Bluetooth.h"
+#include "../Helper.h"
+
+// Decouples the watcher callbacks from the processing of advertisements.
+//
+// The watcher thread only copies the advertisement into a lock-free bounded queue and returns. A
+// dedicated thread drains the queue in batches, keeps only the newest advertisement of each
+// address in a batch and hands the rest to the handler.
+//
+namespace Core::Ingest {
+
+using ReceivedData = Bluetooth::AdvertisementWatcher::ReceivedData;
+
+enum class OverflowPolicy : uint32_t {
+    DropNewest, // The incoming advertisement is dropped
+    DropOldest, // The oldest queued advertisement is dropped to make room
+};
+
+// Every queue cell holds a whole `ReceivedData`, whose manufacturer data is stored inline. So the
+// queue takes about `capacity * sizeof(ReceivedData)` bytes, ~320 KiB with the default capacity,
+// in exchange for never allocating on the receive path.
+//
+struct Config {
+    size_t capacity{1024};
+    size_t batchSize{64};
+    OverflowPolicy overflowPolicy{OverflowPolicy::DropOldest};
+};
+
+struct Counters {
+    uint64_t pushed{0};
+    uint64_t dropped{0};   // By the overflow policy
+    uint64_t coalesced{0}; // Superseded by a newer advertisement of the same address
+    uint64_t processed{0};
+    uint64_t batches{0};
+};
+
+class Queue
+{
+public:
+    using FnBatch = std::function<void(std::span<const ReceivedData>)>;
+
+    explicit Queue(Config config = {});
+    ~Queue();
+
+    // Both are called on the processing thread. `onDrained`, if any, first sees every
+    // advertisement drained from the queue, e.g. to record them, then `onBatch` the coalesced ones.
+    //
+    void Start(FnBatch onBatch, FnBatch onDrained = {});
+    void Stop();
+
+    // Never blocks, safe to call from any number of threads
+    //
+    void Push(const ReceivedData &data);
+
+    Counters GetCounters() const;
+
+    // Whether everything pushed so far has been handled. It's only exact when nothing is being
+    // pushed meanwhile.
+    //
+    bool IsIdle() const;
+
+private:
+    Config _config;
+    Helper::BoundedQueue<ReceivedData> _queue;
+    std::atomic<bool> _stop{false};
+    std::atomic<bool> _waiting{false};
+    std::atomic<uint32_t> _signal{0};
+    std::thread _thread;
+
+    // Only touched by the processing thread
+    //
+    std::vector<ReceivedData> _batch, _coalesced;
+
+    struct {
+        std::atomic<uint64_t> pushed{0}, dropped{0}, coalesced{0}, processed{0}, batches{0};
+    } _counters;
+
+    void Thread(FnBatch onBatch, FnBatch onDrained);
+    void Coalesce();
+    void Wait();
+};
+
+} // namespace Core::Ingest
+
+template <>
+inline QString Helper::ToString<Core::Ingest::Counters>(const Core::Ingest::Counters &value)
+{
+    return QString{"pushed: %1 dropped: %2 coalesced: %3 processed: %4 batches: %5"}
+        .arg(value.pushed)
+        .arg(value.dropped)
+        .arg(value.coalesced)
+        .arg(value.processed)
+        .arg(value.batches);
+}
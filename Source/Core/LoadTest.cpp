@@ -0,0 +1,321 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "LoadTest.h"
+
+#include <algorithm>
+
+#include "../Logger.h"
+
+using namespace std::chrono_literals;
+
+namespace Core::LoadTest {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+LatencyStats Summarize(std::vector<std::chrono::nanoseconds> &samples)
+{
+    LatencyStats result;
+    if (samples.empty()) {
+        return result;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    std::chrono::nanoseconds sum{};
+    for (const auto &sample : samples) {
+        sum += sample;
+    }
+
+    result.min = samples.front();
+    result.max = samples.back();
+    result.avg = sum / samples.size();
+    result.p50 = samples[samples.size() / 2];
+    result.p99 = samples[samples.size() * 99 / 100];
+    return result;
+}
+
+template <class Fn>
+std::chrono::nanoseconds Measure(Fn &&function)
+{
+    const auto begin = Clock::now();
+    function();
+    return Clock::now() - begin;
+}
+} // namespace
+
+Generator::Generator(Config config) : _config{std::move(config)}, _random{_config.seed}
+{
+    _devices.reserve(_config.devices);
+    for (uint32_t i = 0; i < _config.devices; ++i) {
+        _devices.push_back(NewDevice());
+    }
+}
+
+Generator::~Generator()
+{
+    Stop();
+}
+
+void Generator::Start(AirPods::Manager &manager, std::function<void(const Report &)> onFinished)
+{
+    Stop();
+
+    _stop = false;
+    _thread = std::thread{[this, &manager, onFinished = std::move(onFinished)] {
+        const auto report = Run(manager);
+        if (onFinished) {
+            onFinished(report);
+        }
+    }};
+}
+
+void Generator::Stop()
+{
+    _stop = true;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+Report Generator::Run(AirPods::Manager &manager)
+{
+    Report result;
+
+    if (_devices.empty() || _config.advertisementsPerSecond <= 0) {
+        return result;
+    }
+
+    // Devices take turns, so each of them advertises once per `1 / advertisementsPerSecond`
+    //
+    const double interval = 1.0 / (_config.advertisementsPerSecond * _devices.size());
+    const double perDeviceInterval = interval * _devices.size();
+    const auto total = static_cast<uint64_t>(_config.duration.count() / interval);
+
+    std::vector<std::chrono::nanoseconds> build, decode, queue, dispatch;
+    build.reserve(total);
+    decode.reserve(total);
+    queue.reserve(total);
+
+    LOG(Info, "LoadTest: Started. devices: {} advertisements: {}", _devices.size(), total);
+
+    const auto counters = [&] {
+        std::lock_guard<std::mutex> lock{manager._mutex};
+        return manager._repeatFilter.GetCounters();
+    };
+    const auto beginCounters = counters();
+
+    using WatcherClock = decltype(Bluetooth::AdvertisementWatcher::ReceivedData::timestamp)::clock;
+
+    // The same path as the live watcher's, only the ingest thread also takes the samples. They
+    // are read once it's stopped.
+    //
+    Ingest::Queue ingest;
+    ingest.Start([&](std::span<const Bluetooth::AdvertisementWatcher::ReceivedData> batch) {
+        const auto pickedUp = WatcherClock::now();
+        for (const auto &data : batch) {
+            queue.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(pickedUp - data.timestamp));
+        }
+
+        size_t accepted = 0;
+        dispatch.push_back(Measure([&] { accepted = manager.OnIngestBatch(batch); }));
+        result.accepted += accepted;
+    });
+
+    const auto begin = Clock::now();
+
+    for (uint64_t i = 0; i < total && !_stop; ++i) {
+        const double now = i * interval;
+        if (!_config.maxSpeed) {
+            std::this_thread::sleep_until(
+                begin + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>{now}));
+        }
+
+        auto &device = _devices[i % _devices.size()];
+        Simulate(device, now, perDeviceInterval);
+
+        Bluetooth::AdvertisementWatcher::ReceivedData data;
+        build.push_back(Measure([&] { data = Build(device); }));
+        decode.push_back(Measure([&] { (void)AirPods::Details::Advertisement::TryDecode(data); }));
+
+        ingest.Push(data);
+        result.advertisements += 1;
+    }
+
+    while (!ingest.IsIdle() && !_stop) {
+        std::this_thread::sleep_for(1ms);
+    }
+    ingest.Stop();
+
+    result.elapsed = Clock::now() - begin;
+    result.throughput = result.advertisements /
+                        std::chrono::duration<double>{result.elapsed}.count();
+    result.build = Summarize(build);
+    result.decode = Summarize(decode);
+    result.queue = Summarize(queue);
+    result.manager = Summarize(dispatch);
+    result.ingest = ingest.GetCounters();
+
+    const auto endCounters = counters();
+    result.repeatFilter.hits = endCounters.hits - beginCounters.hits;
+    result.repeatFilter.misses = endCounters.misses - beginCounters.misses;
+
+    LOG(Info, "LoadTest: Finished. {}", Helper::ToString(result));
+    return result;
+}
+
+auto Generator::NewDevice() -> Device
+{
+    std::vector<AirPods::Model> models;
+    for (const auto &descriptor : AirPods::Details::kModelDescriptors) {
+        if (descriptor.modelId != 0 && descriptor.capabilities.chargingCase) {
+            models.push_back(descriptor.model);
+        }
+    }
+
+    std::uniform_int_distribution<size_t> modelDist{0, models.size() - 1};
+    std::uniform_real_distribution<double> rssiDist{-95.0, -40.0};
+    std::uniform_real_distribution<double> batteryDist{20.0, 100.0};
+    std::uniform_real_distribution<double> phaseDist{0.0, 120.0};
+
+    Device device;
+    device.model = models.at(modelDist(_random));
+    device.address = _random() & 0xFFFF'FFFF'FFFF;
+    device.nextAddressRotation = static_cast<double>(_config.addressRotation.count());
+    device.baseRssi = rssiDist(_random);
+    device.phase = Phase::Worn;
+    device.phaseEnd = phaseDist(_random);
+    device.leftBattery = batteryDist(_random);
+    device.rightBattery = batteryDist(_random);
+    device.caseBattery = batteryDist(_random);
+    device.lidSwitchCount = 0;
+    device.stateKey = 0;
+    device.side = AirPods::Side::Left;
+    device.payload = {};
+    return device;
+}
+
+// The script of each device: worn for a while, the lid opens to stow the pods, they charge in the
+// closed case for a while, the lid opens to take them out again, and so on.
+//
+void Generator::Simulate(Device &device, double now, double elapsed)
+{
+    if (now >= device.nextAddressRotation) {
+        device.address = _random() & 0xFFFF'FFFF'FFFF;
+        device.nextAddressRotation = now + static_cast<double>(_config.addressRotation.count());
+        device.stateKey = 0; // Broadcasts a new payload along with the new address
+    }
+
+    if (now >= device.phaseEnd) {
+        std::uniform_real_distribution<double> longPhase{30.0, 300.0};
+        std::uniform_real_distribution<double> shortPhase{1.0, 5.0};
+
+        switch (device.phase) {
+        case Phase::Worn:
+            device.phase = Phase::Stowing;
+            device.phaseEnd = now + shortPhase(_random);
+            break;
+        case Phase::Stowing:
+            device.phase = Phase::InCase;
+            device.phaseEnd = now + longPhase(_random);
+            break;
+        case Phase::InCase:
+            device.phase = Phase::Taking;
+            device.phaseEnd = now + shortPhase(_random);
+            break;
+        case Phase::Taking:
+            device.phase = Phase::Worn;
+            device.phaseEnd = now + longPhase(_random);
+            break;
+        }
+
+        // Every phase change opens or closes the lid, except putting the pods in ears
+        //
+        if (device.phase != Phase::Worn) {
+            device.lidSwitchCount = (device.lidSwitchCount + 1) % 8;
+        }
+    }
+
+    const double drain = _config.drainPerMinute * elapsed / 60;
+    const auto clamp = [](double value) { return std::clamp(value, 0.0, 100.0); };
+
+    if (device.phase == Phase::Worn) {
+        device.leftBattery = clamp(device.leftBattery - drain);
+        device.rightBattery = clamp(device.rightBattery - drain);
+    }
+    else if (device.caseBattery > 0) {
+        device.leftBattery = clamp(device.leftBattery + drain * 4);
+        device.rightBattery = clamp(device.rightBattery + drain * 4);
+        device.caseBattery = clamp(device.caseBattery - drain);
+    }
+}
+
+Bluetooth::AdvertisementWatcher::ReceivedData Generator::Build(Device &device)
+{
+    const bool worn = device.phase == Phase::Worn;
+    const bool charging = !worn && device.caseBattery > 0;
+
+    AppleCP::AirPods::Content content;
+    content.model = device.model;
+    content.leftBattery = static_cast<AirPods::Battery::ValueType>(device.leftBattery / 10);
+    content.rightBattery = static_cast<AirPods::Battery::ValueType>(device.rightBattery / 10);
+    content.caseBattery = static_cast<AirPods::Battery::ValueType>(device.caseBattery / 10);
+    content.leftCharging = charging && device.leftBattery < 100;
+    content.rightCharging = charging && device.rightBattery < 100;
+    content.leftInEar = worn;
+    content.rightInEar = worn;
+    content.bothPodsInCase = !worn;
+    content.lidOpened = device.phase == Phase::Stowing || device.phase == Phase::Taking;
+    content.lidSwitchCount = device.lidSwitchCount;
+
+    // Rebroadcasts the same frame until the state changes, then the other pod may take over. The
+    // key is never 0, which marks a device that must change its payload.
+    //
+    const auto step = [](double percent) { return static_cast<uint64_t>(percent / 10); };
+    const uint64_t stateKey = 1 | uint64_t{Helper::ToUnderlying(device.phase)} << 1 |
+                              uint64_t{device.lidSwitchCount} << 4 | uint64_t{charging} << 7 |
+                              step(device.leftBattery) << 8 | step(device.rightBattery) << 16 |
+                              step(device.caseBattery) << 24;
+    if (stateKey != device.stateKey) {
+        device.stateKey = stateKey;
+        device.side = _random() % 2 == 0 ? AirPods::Side::Left : AirPods::Side::Right;
+        for (auto &byte : device.payload) {
+            byte = static_cast<uint8_t>(_random());
+        }
+    }
+    content.broadcastedSide = device.side;
+    content.encryptedPayload = device.payload;
+
+    const auto frame = AppleCP::AirPods::Encode(content);
+    const auto bytes = frame.Bytes();
+
+    std::normal_distribution<double> noise{0.0, _config.rssiNoise};
+
+    Bluetooth::AdvertisementWatcher::ReceivedData result;
+    result.rssi = static_cast<int16_t>(std::clamp(device.baseRssi + noise(_random), -127.0, 20.0));
+    result.timestamp = decltype(result.timestamp)::clock::now();
+    result.address = device.address;
+    result.manufacturerDataMap.TryEmplace(AppleCP::VendorId, bytes);
+    return result;
+}
+
+} // namespace Core::LoadTest
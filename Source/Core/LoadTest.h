@@ -0,0 +1,144 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <functional>
+
+#include "AirPods.h"
+
+// Simulates many AirPods around the user, like in an open office, and feeds their advertisements
+// into `AirPods::Manager` through an ingest queue, as if they were received by the watcher.
+//
+// Like real AirPods, a device rebroadcasts the same frame until its state changes, only the RSSI
+// varies in between. The encrypted payload is random but stable for each state.
+//
+namespace Core::LoadTest {
+
+struct Config {
+    uint32_t devices{200};
+    double advertisementsPerSecond{10.0}; // Per device
+    std::chrono::seconds duration{60};
+    std::chrono::seconds addressRotation{60};
+    double rssiNoise{6.0}; // Standard deviation in dBm
+    double drainPerMinute{1.0};
+    bool maxSpeed{false}; // Ignores the rate and feeds advertisements as fast as possible
+    uint64_t seed{0};
+};
+
+struct LatencyStats {
+    std::chrono::nanoseconds min{}, avg{}, p50{}, p99{}, max{};
+};
+
+struct Report {
+    uint64_t advertisements{0};
+    uint64_t accepted{0};
+    std::chrono::nanoseconds elapsed{};
+    double throughput{0}; // Advertisements per second
+
+    LatencyStats build;   // `AppleCP::AirPods::Encode` and the `ReceivedData`
+    LatencyStats decode;  // `Advertisement::TryDecode` alone
+    LatencyStats queue;   // From the push to the ingest thread picking it up, per advertisement
+    LatencyStats manager; // `Manager::OnIngestBatch`, per batch
+
+    Ingest::Counters ingest;
+    AirPods::Details::RepeatFilter::Counters repeatFilter;
+};
+
+class Generator
+{
+public:
+    explicit Generator(Config config);
+    ~Generator();
+
+    // Runs on a separate thread, `onFinished` is called on that thread.
+    //
+    void Start(AirPods::Manager &manager, std::function<void(const Report &)> onFinished);
+    void Stop();
+
+    Report Run(AirPods::Manager &manager);
+
+private:
+    enum class Phase : uint32_t { Worn, Stowing, InCase, Taking };
+
+    struct Device {
+        AirPods::Model model;
+        uint64_t address;
+        double nextAddressRotation;
+        double baseRssi;
+
+        Phase phase;
+        double phaseEnd;
+        double leftBattery, rightBattery, caseBattery; // In percent
+        uint8_t lidSwitchCount;
+
+        // What it broadcasts, changed only with the state it encodes
+        //
+        uint64_t stateKey;
+        AirPods::Side side;
+        Aes::Block payload;
+    };
+
+    Config _config;
+    std::mt19937_64 _random;
+    std::vector<Device> _devices;
+    std::atomic<bool> _stop{false};
+    std::thread _thread;
+
+    Device NewDevice();
+    void Simulate(Device &device, double now, double elapsed);
+    Bluetooth::AdvertisementWatcher::ReceivedData Build(Device &device);
+};
+
+} // namespace Core::LoadTest
+
+template <>
+inline QString Helper::ToString<Core::LoadTest::LatencyStats>(
+    const Core::LoadTest::LatencyStats &value)
+{
+    return QString{"min: %1ns avg: %2ns p50: %3ns p99: %4ns max: %5ns"}
+        .arg(value.min.count())
+        .arg(value.avg.count())
+        .arg(value.p50.count())
+        .arg(value.p99.count())
+        .arg(value.max.count());
+}
+
+template <>
+inline QString Helper::ToString<Core::LoadTest::Report>(const Core::LoadTest::Report &value)
+{
+    return QString{"advertisements: %1 accepted: %2 elapsed: %3ms throughput: %4/s\n"
+                   "build: {%5}\ndecode: {%6}\nqueue: {%7}\nmanager: {%8}\n"
+                   "ingest: {%9}\nrepeat filter: {hits: %10 misses: %11}"}
+        .arg(value.advertisements)
+        .arg(value.accepted)
+        .arg(std::chrono::duration_cast<std::chrono::milliseconds>(value.elapsed).count())
+        .arg(value.throughput, 0, 'f', 0)
+        .arg(ToString(value.build))
+        .arg(ToString(value.decode))
+        .arg(ToString(value.queue))
+        .arg(ToString(value.manager))
+        .arg(ToString(value.ingest))
+        .arg(value.repeatFilter.hits)
+        .arg(value.repeatFilter.misses);
+}
@@ -182,6 +182,45 @@ inline void Initialize()
         }
     });
 }
+
+// Awaits an async operation or action in a `Helper::Task` without blocking a thread.
+//
+// The coroutine resumes on the thread that completes the operation. Unlike the C++/WinRT awaiter
+// it doesn't switch back to the apartment it was awaited from, so a thread blocked in
+// `Helper::SyncWait` can't deadlock it. Cancelling the token cancels the operation, which then
+// throws `winrt::hresult_canceled`.
+//
+template <class Async>
+inline auto Await(Async async, Helper::CancellationToken token = {})
+{
+    struct Awaiter {
+        Async async;
+        Helper::CancellationToken token;
+        Helper::CbHandle cancelHandle{0};
+
+        inline bool await_ready() const
+        {
+            return async.Status() != winrt::Windows::Foundation::AsyncStatus::Started;
+        }
+
+        inline void await_suspend(std::coroutine_handle<> handle)
+        {
+            // The awaiter may be gone as soon as the handler is set
+            //
+            const auto pending = async;
+
+            cancelHandle = token.Register([pending] { pending.Cancel(); });
+            pending.Completed([handle](auto &&, auto &&) { handle.resume(); });
+        }
+
+        inline auto await_resume()
+        {
+            token.Unregister(cancelHandle);
+            return async.GetResults();
+        }
+    };
+    return Awaiter{std::move(async), std::move(token)};
+}
 } // namespace Winrt
 
 namespace Com {
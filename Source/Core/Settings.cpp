@@ -118,6 +118,13 @@ void OnApply_battery_on_taskbar(const Fields &newFields)
     ApdApp->GetTaskbarStatus()->OnSettingsChangedSafely(newFields.battery_on_taskbar);
 }
 
+void OnApply_proximity_key(const Fields &newFields)
+{
+    LOG(Info, "OnApply_proximity_key: {}", LogSensitiveData(newFields.proximity_key));
+
+    ApdApp->GetMainWindow()->GetApdMgr().OnProximityKeyChanged(newFields.proximity_key);
+}
+
 class Manager : public Helper::Singleton<Manager>
 {
 protected:
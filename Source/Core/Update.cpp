@@ -378,13 +378,38 @@ AsyncChecker::~AsyncChecker()
 void AsyncChecker::Start()
 {
     // clang-format off
-    _timer.Start(kInterval, [this] { Checker(); }, true);
+    _timer.Start(kInterval, [this] { StartChecker(); }, true);
     // clang-format on
 }
 
 void AsyncChecker::Stop()
 {
     _timer.Stop();
+    if (_checker.valid()) {
+        _checker.wait();
+    }
+}
+
+void AsyncChecker::StartChecker()
+{
+    if (_checking.exchange(true)) {
+        LOG(Info, "The last update check is still running.");
+        return;
+    }
+    _checker = Helper::Spawn(CheckerAsync());
+}
+
+// Only a thread hop, not an asynchronous fetch. The cpr calls block a `BlockingExecutor` worker
+// for the whole check, which keeps them off the shared timer thread. cpr 1.7 can't complete a
+// request without a thread waiting on it, its callback API runs on a `std::async` thread whose
+// future blocks when it's dropped.
+//
+Helper::Task<> AsyncChecker::CheckerAsync()
+{
+    co_await Helper::ResumeOn(Helper::BlockingExecutor::GetInstance());
+
+    Checker();
+    _checking = false;
 }
 
 void AsyncChecker::Checker()
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <string>
 #include <optional>
 
@@ -69,8 +71,12 @@ private:
 
     FnCallback _callback;
     Helper::Timer _timer;
+    std::future<void> _checker;
+    std::atomic<bool> _checking{false};
     bool _isFirst = true;
 
+    void StartChecker();
+    Helper::Task<> CheckerAsync();
     void Checker();
 };
 
@@ -216,14 +216,10 @@ MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
     connect(_closeButton, &CloseButton::Clicked, this, &MainWindow::DoHide);
     connect(_mediaPlayer, &QMediaPlayer::stateChanged, this, &MainWindow::OnPlayerStateChanged);
 
-    connect(this, &MainWindow::UpdateStateSafely, this, &MainWindow::UpdateState);
     connect(this, &MainWindow::AvailableSafely, this, &MainWindow::Available);
     connect(this, &MainWindow::UnavailableSafely, this, &MainWindow::Unavailable);
-    connect(this, &MainWindow::DisconnectSafely, this, &MainWindow::Disconnect);
     connect(this, &MainWindow::BindSafely, this, &MainWindow::Bind);
     connect(this, &MainWindow::UnbindSafely, this, &MainWindow::Unbind);
-    connect(this, &MainWindow::ShowSafely, this, &MainWindow::show);
-    connect(this, &MainWindow::HideSafely, this, &MainWindow::DoHide);
     connect(
         this, &MainWindow::VersionUpdateAvailableSafely, this, &MainWindow::VersionUpdateAvailable);
 
@@ -246,6 +242,36 @@ MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
     _updateChecker.Start();
 }
 
+void MainWindow::PostState(std::optional<Core::AirPods::PackedState> state)
+{
+    if (_stateMailbox.Post(state)) {
+        Utils::Qt::Dispatch([this] { ConsumeState(); }, Utils::Qt::Priority::Normal);
+    }
+}
+
+// Critical tasks run before the normal ones that are already queued, so a state posted before
+// must be applied here, or the popup would show the previous state for a moment
+//
+void MainWindow::ShowSafely()
+{
+    Utils::Qt::Dispatch(
+        [this] {
+            ConsumeState();
+            show();
+        },
+        Utils::Qt::Priority::Critical);
+}
+
+void MainWindow::HideSafely()
+{
+    Utils::Qt::Dispatch(
+        [this] {
+            ConsumeState();
+            DoHide();
+        },
+        Utils::Qt::Priority::Critical);
+}
+
 void MainWindow::UpdateState(const Core::AirPods::State &state)
 {
     LOG(Info, "MainWindow::UpdateState");
@@ -257,6 +283,24 @@ void MainWindow::UpdateState(const Core::AirPods::State &state)
     ApdApp->GetTaskbarStatus()->UpdateState(state);
 }
 
+// States posted while the previous wake-up is still queued are coalesced, so a burst of changes
+// renders only once
+//
+void MainWindow::ConsumeState()
+{
+    const auto optState = _stateMailbox.Take();
+    if (!optState.has_value()) {
+        return;
+    }
+
+    if (optState->has_value()) {
+        UpdateState(optState->value().Unpack());
+    }
+    else {
+        Disconnect();
+    }
+}
+
 void MainWindow::Available()
 {
     LOG(Info, "MainWindow::Available");
@@ -398,55 +442,15 @@ void MainWindow::SetAnimation(std::optional<Core::AirPods::Model> model)
         _mediaPlayer->setMedia(QMediaContent{});
     }
     else {
-        QString media;
-
-        // It's not possible to set video padding background color or get video resolution just
-        // through Qt, so we hardcode it here
-        QSize videoSize{};
-
-        switch (model.value()) {
-        case Core::AirPods::Model::AirPods_1:
-            media = "qrc:/Resource/Video/AirPods_1.avi";
-            videoSize = QSize{800, 400};
-            break;
-        case Core::AirPods::Model::AirPods_2:
-            media = "qrc:/Resource/Video/AirPods_2.avi";
-            videoSize = QSize{800, 400};
-            break;
-        case Core::AirPods::Model::AirPods_3:
-            media = "qrc:/Resource/Video/AirPods_3.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Pro:
-            media = "qrc:/Resource/Video/AirPods_Pro.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Pro_2:
-            media = "qrc:/Resource/Video/AirPods_Pro_2.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Max:
-            media = "qrc:/Resource/Video/AirPods_Max.avi";
-            videoSize = QSize{600, 650};
-            break;
-        case Core::AirPods::Model::Beats_Fit_Pro:
-            media = "qrc:/Resource/Video/Beats_Fit_Pro.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::Powerbeats_3:
-        case Core::AirPods::Model::Beats_X:
-        case Core::AirPods::Model::Beats_Solo3:
-        default:
-            media = "qrc:/Resource/Video/AirPods_1.avi";
-            videoSize = QSize{800, 400};
-            break;
-        }
+        const auto &descriptor = Core::AirPods::GetModelDescriptor(model.value());
 
-        auto aspectRatio = (float)videoSize.width() / (float)videoSize.height();
+        auto aspectRatio =
+            (float)descriptor.videoSize.width / (float)descriptor.videoSize.height;
         auto widgetWidth = _videoWidget->height() * aspectRatio;
         _videoWidget->setFixedWidth(widgetWidth);
 
-        _mediaPlayer->setMedia(QUrl{media});
+        _mediaPlayer->setMedia(QUrl{QString{"qrc:/Resource/Video/%1.avi"}.arg(QString::fromUtf8(
+            descriptor.animation.data(), static_cast<int>(descriptor.animation.size())))});
 
         PlayAnimation();
     }
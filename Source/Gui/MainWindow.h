@@ -55,6 +55,15 @@ public:
         return _apdMgr;
     }
 
+    // Thread-safe. Only the latest state is rendered, `std::nullopt` means disconnected.
+    //
+    void PostState(std::optional<Core::AirPods::PackedState> state);
+
+    // Thread-safe, run ahead of any pending repaint
+    //
+    void ShowSafely();
+    void HideSafely();
+
     void UpdateState(const Core::AirPods::State &state);
     void Available();
     void Unavailable();
@@ -64,14 +73,10 @@ public:
     void AskUserUpdate(const Core::Update::ReleaseInfo &releaseInfo);
 
 Q_SIGNALS:
-    void UpdateStateSafely(const Core::AirPods::State &state);
     void AvailableSafely();
     void UnavailableSafely();
-    void DisconnectSafely();
     void BindSafely();
     void UnbindSafely();
-    void ShowSafely();
-    void HideSafely();
     bool VersionUpdateAvailableSafely(const Core::Update::ReleaseInfo &releaseInfo, bool silent);
 
 private:
@@ -96,6 +101,7 @@ private:
     ButtonAction _buttonAction{ButtonAction::NoButton};
     Status _status{Status::Unavailable};
     std::optional<Core::AirPods::State> _cachedState;
+    Helper::Mailbox<std::optional<Core::AirPods::PackedState>> _stateMailbox;
     bool _isVisible{false};
     bool _isAnimationPlaying{false};
 
@@ -107,6 +113,7 @@ private:
     void ControlAutoHideTimer(bool start);
     void VersionUpdateAvailable(const Core::Update::ReleaseInfo &releaseInfo, bool silent);
     void Repaint();
+    void ConsumeState();
 
     void OnAppStateChanged(Qt::ApplicationState state);
     void OnPosMoveFinished();
@@ -18,11 +18,21 @@
 
 #pragma once
 
+#include <bit>
+#include <array>
+#include <deque>
+#include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <utility>
+#include <optional>
 #include <future>
+#include <coroutine>
+#include <exception>
 #include <functional>
 #include <condition_variable>
 
@@ -168,51 +178,254 @@ struct Sides {
 
 //////////////////////////////////////////////////
 
+// A lock-free bounded queue for any number of producers and consumers (Dmitry Vyukov's bounded
+// MPMC queue). Each cell carries a sequence number that tells whose turn it is, so pushing and
+// popping is a CAS on the position plus a copy, and never blocks.
+//
+template <class T>
+class BoundedQueue : NonCopyable
+{
+public:
+    static_assert(std::is_nothrow_copy_assignable_v<T>);
+
+    // The capacity is rounded up to a power of 2
+    //
+    inline explicit BoundedQueue(size_t capacity)
+        : _capacity{std::bit_ceil(std::max<size_t>(capacity, 2))},
+          _cells{std::make_unique<Cell[]>(_capacity)}
+    {
+        for (size_t i = 0; i < _capacity; ++i) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    inline bool TryPush(const T &value)
+    {
+        size_t pos = _pushPos.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        while (true) {
+            cell = &_cells[pos & (_capacity - 1)];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false; // Full
+            }
+            else {
+                pos = _pushPos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool TryPop(T &value)
+    {
+        size_t pos = _popPos.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        while (true) {
+            cell = &_cells[pos & (_capacity - 1)];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false; // Empty
+            }
+            else {
+                pos = _popPos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = cell->value;
+        cell->sequence.store(pos + _capacity, std::memory_order_release);
+        return true;
+    }
+
+    // Only a hint while other threads are pushing or popping
+    //
+    inline size_t ApproxSize() const
+    {
+        const size_t push = _pushPos.load(std::memory_order_relaxed);
+        const size_t pop = _popPos.load(std::memory_order_relaxed);
+        return push > pop ? push - pop : 0;
+    }
+
+    inline size_t Capacity() const
+    {
+        return _capacity;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t _capacity;
+    std::unique_ptr<Cell[]> _cells;
+
+    // On separate cache lines, producers and consumers don't slow each other down
+    //
+    alignas(64) std::atomic<size_t> _pushPos{0};
+    alignas(64) std::atomic<size_t> _popPos{0};
+};
+
+//////////////////////////////////////////////////
+
+// A single slot holding the latest value. Posting overwrites a value that hasn't been taken yet,
+// so a slow consumer skips the intermediate values instead of falling behind.
+//
+template <class T>
+class Mailbox : NonCopyable
+{
+public:
+    Mailbox() = default;
+
+    // Returns true if the mailbox was empty, the consumer then has to be woken up. Otherwise a
+    // wake-up is already on its way and will take this value.
+    //
+    inline bool Post(T value)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        const bool wasEmpty = !_value.has_value();
+        _value = std::move(value);
+        return wasEmpty;
+    }
+
+    inline std::optional<T> Take()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return std::exchange(_value, std::nullopt);
+    }
+
+private:
+    std::mutex _mutex;
+    std::optional<T> _value;
+};
+
+//////////////////////////////////////////////////
+
+// Publishes immutable snapshots of a value, each with a monotonically increasing version. A
+// snapshot can be kept as long as the reader wants, and readers never wait while the writer
+// builds the next one.
+//
+// `std::atomic<std::shared_ptr>` is not lock-free in the common standard libraries, so `Load` and
+// `Publish` may briefly contend on swapping the pointer itself. Only one thread may publish at a
+// time.
+//
+template <class T>
+class Published : NonCopyable
+{
+public:
+    struct Snapshot {
+        uint64_t version{0};
+        T value{};
+    };
+
+    inline std::shared_ptr<const Snapshot> Load() const
+    {
+        return _snapshot.load(std::memory_order_acquire);
+    }
+
+    // Cheaper than `Load` for readers that poll for changes
+    //
+    inline uint64_t GetVersion() const
+    {
+        return _version.load(std::memory_order_acquire);
+    }
+
+    inline void Publish(T value)
+    {
+        const uint64_t version = _version.load(std::memory_order_relaxed) + 1;
+
+        _snapshot.store(
+            std::make_shared<const Snapshot>(Snapshot{version, std::move(value)}),
+            std::memory_order_release);
+        _version.store(version, std::memory_order_release);
+    }
+
+private:
+    std::atomic<std::shared_ptr<const Snapshot>> _snapshot{std::make_shared<const Snapshot>()};
+    std::atomic<uint64_t> _version{0};
+};
+
+//////////////////////////////////////////////////
+
 using CbHandle = uint64_t;
 
+// `Invoke` holds no lock while the callbacks run. It runs the callbacks of an immutable list
+// published through an atomic shared pointer, while `Register` and `Unregister` copy the list and
+// publish a new one. So a callback may register or unregister re-entrantly, and registrations
+// never wait for running callbacks. An unregistered callback may still be running in an `Invoke`
+// that started earlier.
+//
+// Loading the list isn't lock-free, `std::atomic<std::shared_ptr>` takes a short internal lock
+// in the common standard libraries. That lock only covers the pointer and the reference count.
+//
 template <class Function>
 class Callback
 {
 public:
     inline CbHandle Register(Function &&callback)
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<std::mutex> lock{_writeMutex};
 
         auto thisHandle = _nextHandle++;
-        _callbacks.emplace_back(thisHandle, std::move(callback));
+        auto callbacks = std::make_shared<List>(*_callbacks.load(std::memory_order_relaxed));
+        callbacks->emplace_back(thisHandle, std::move(callback));
+        _callbacks.store(std::move(callbacks), std::memory_order_release);
         return thisHandle;
     }
 
     inline bool Unregister(CbHandle handle)
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<std::mutex> lock{_writeMutex};
+
+        const auto current = _callbacks.load(std::memory_order_relaxed);
 
         auto iter =
-            std::find_if(_callbacks.begin(), _callbacks.end(), [handle](const auto &callbackInfo) {
+            std::find_if(current->begin(), current->end(), [handle](const auto &callbackInfo) {
                 return callbackInfo.first == handle;
             });
 
-        if (iter == _callbacks.end()) {
+        if (iter == current->end()) {
             return false;
         }
 
-        _callbacks.erase(iter);
+        auto callbacks = std::make_shared<List>(*current);
+        callbacks->erase(callbacks->begin() + (iter - current->begin()));
+        _callbacks.store(std::move(callbacks), std::memory_order_release);
         return true;
     }
 
     inline void UnregisterAll()
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<std::mutex> lock{_writeMutex};
 
-        _callbacks.clear();
+        _callbacks.store(std::make_shared<const List>(), std::memory_order_release);
     }
 
     template <class... Args>
     inline void Invoke(Args &&...args) const
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        const auto callbacks = _callbacks.load(std::memory_order_acquire);
 
-        for (const auto &callbackInfo : _callbacks) {
+        for (const auto &callbackInfo : *callbacks) {
             callbackInfo.second(args...);
         }
     }
@@ -224,148 +437,1253 @@ public:
     }
 
 private:
-    mutable std::mutex _mutex;
+    using List = std::vector<std::pair<CbHandle, Function>>;
+
+    std::mutex _writeMutex;
     CbHandle _nextHandle{1};
-    std::vector<std::pair<CbHandle, Function>> _callbacks;
+    std::atomic<std::shared_ptr<const List>> _callbacks{std::make_shared<const List>()};
 };
 
-class ConWorker
+//////////////////////////////////////////////////
+
+// Where a coroutine resumes after `co_await ResumeOn(...)`
+//
+class Scheduler
 {
 public:
-    using FnCallback = std::function<bool()>;
+    virtual ~Scheduler() = default;
 
-    ConWorker() = default;
+    virtual void Post(std::function<void()> work) = 0;
+};
 
-    inline ConWorker(std::chrono::milliseconds interval, FnCallback callback)
+// Runs the posted work only when `RunPending` is called, on the calling thread. It's portable and
+// deterministic, meant for tests and replays.
+//
+class ManualScheduler final : public Scheduler
+{
+public:
+    inline void Post(std::function<void()> work) override
     {
-        Start(std::move(interval), std::move(callback));
+        std::lock_guard<std::mutex> lock{_mutex};
+        _queue.push_back(std::move(work));
     }
 
-    inline ~ConWorker()
+    // Including the work posted meanwhile. Returns how many were run.
+    //
+    inline size_t RunPending()
     {
-        Stop();
+        size_t count = 0;
+
+        while (true) {
+            std::function<void()> work;
+            {
+                std::lock_guard<std::mutex> lock{_mutex};
+                if (_queue.empty()) {
+                    break;
+                }
+                work = std::move(_queue.front());
+                _queue.pop_front();
+            }
+            work();
+            ++count;
+        }
+        return count;
     }
 
-    inline void Start(std::chrono::milliseconds interval, FnCallback callback)
+private:
+    std::mutex _mutex;
+    std::deque<std::function<void()>> _queue;
+};
+
+//////////////////////////////////////////////////
+
+// Runs blocking calls, e.g. a WinRT `.get()` that must not be made on an STA thread, on a fixed
+// pool of long-lived threads.
+//
+// A job can be cancelled until a worker picks it up. A call that hangs keeps its worker, but the
+// caller can stop waiting for it with a timeout.
+//
+// The workers are detached and share the queue with it. At exit it waits for them at most
+// `kShutdownTimeout`, so a hung call can't hold up the exit of the process.
+//
+class BlockingExecutor : public Singleton<BlockingExecutor>, public Scheduler
+{
+public:
+    constexpr static size_t kWorkers = 4;
+    constexpr static auto kShutdownTimeout = std::chrono::seconds{1};
+
+    template <class T>
+    class Job
     {
-        Stop();
-        _interval = std::move(interval);
-        _callback = std::move(callback);
-        _destroyFlag = false;
-        _thread = std::thread{[this] { Thread(); }};
+    public:
+        // Whether it's dropped for good. It can't be once it has started, and its future is
+        // broken if it is.
+        //
+        inline bool Cancel()
+        {
+            return !_claimed->exchange(true);
+        }
+
+        inline std::future<T> &GetFuture()
+        {
+            return _future;
+        }
+
+    private:
+        friend BlockingExecutor;
+
+        std::future<T> _future;
+        std::shared_ptr<std::atomic<bool>> _claimed;
+    };
+
+    inline ~BlockingExecutor()
+    {
+        std::unique_lock<std::mutex> lock{_state->mutex};
+        _state->stop = true;
+        _state->conVar.notify_all();
+        _state->conVar.wait_for(lock, kShutdownTimeout, [this] { return _state->alive == 0; });
     }
 
-    inline void Stop()
+    template <class Fn>
+    inline auto Submit(Fn &&fn) -> Job<std::invoke_result_t<Fn>>
     {
-        _destroyFlag = true;
-        Notify();
-        if (_thread.joinable()) {
-            _thread.join();
+        using Result = std::invoke_result_t<Fn>;
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+
+        Job<Result> job;
+        job._future = task->get_future();
+        job._claimed = std::make_shared<std::atomic<bool>>(false);
+
+        {
+            std::lock_guard<std::mutex> lock{_state->mutex};
+            _state->queue.push_back(Work{[task] { (*task)(); }, job._claimed});
         }
+        _state->conVar.notify_one();
+        return job;
     }
 
-    inline void Notify()
+    // Like `Submit` without a job, the work can't be cancelled or waited for
+    //
+    inline void Post(std::function<void()> work) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{_state->mutex};
+            _state->queue.push_back(
+                Work{std::move(work), std::make_shared<std::atomic<bool>>(false)});
+        }
+        _state->conVar.notify_one();
+    }
+
+    // Submits the call and waits for its result. `std::nullopt` if it hasn't finished in time, it
+    // is cancelled then if it hasn't started yet. The call must not refer to the caller's locals.
+    //
+    template <class Fn, class Rep, class Period>
+    inline auto Run(std::chrono::duration<Rep, Period> timeout, Fn &&fn)
+        -> std::optional<std::invoke_result_t<Fn>>
     {
-        _destroyConVar.notify_all();
+        auto job = Submit(std::forward<Fn>(fn));
+
+        if (job.GetFuture().wait_for(timeout) != std::future_status::ready) {
+            job.Cancel();
+            return std::nullopt;
+        }
+        return job.GetFuture().get();
     }
 
 private:
-    std::chrono::milliseconds _interval{};
-    FnCallback _callback;
-    std::thread _thread;
-    std::mutex _mutex;
-    std::condition_variable _destroyConVar;
-    std::atomic<bool> _destroyFlag{false};
+    friend Singleton<BlockingExecutor>;
+
+    struct Work {
+        std::function<void()> run;
+        std::shared_ptr<std::atomic<bool>> claimed;
+    };
+
+    // Outlives the executor if a worker is still stuck in a call when it's destroyed
+    //
+    struct State {
+        std::mutex mutex;
+        std::condition_variable conVar;
+        std::deque<Work> queue;
+        bool stop{false};
+        size_t alive{kWorkers};
+    };
+
+    std::shared_ptr<State> _state{std::make_shared<State>()};
+
+    inline BlockingExecutor()
+    {
+        for (size_t i = 0; i < kWorkers; ++i) {
+            std::thread{&BlockingExecutor::Thread, _state}.detach();
+        }
+    }
 
-    void Thread()
+    static inline void Thread(std::shared_ptr<State> state)
     {
-        while (!_destroyFlag) {
-            if (!_callback()) {
+        std::unique_lock<std::mutex> lock{state->mutex};
+
+        while (true) {
+            state->conVar.wait(lock, [&] { return state->stop || !state->queue.empty(); });
+            if (state->stop) {
                 break;
             }
-            std::unique_lock<std::mutex> lock{_mutex};
-            _destroyConVar.wait_for(lock, _interval);
+
+            Work work = std::move(state->queue.front());
+            state->queue.pop_front();
+
+            if (work.claimed->exchange(true)) {
+                continue; // Cancelled
+            }
+
+            lock.unlock();
+            work.run();
+            work = {};
+            lock.lock();
         }
+
+        --state->alive;
+        state->conVar.notify_all();
     }
 };
 
-class Timer
+//////////////////////////////////////////////////
+
+// The time source of `TimerWheel` and everything built on it.
+//
+// The app always runs on `RealClock`. A test or replay driver can install a `VirtualClock` with
+// `SetClock` and move it forward as fast as it likes, the timeouts still fire as they would have
+// in real time.
+//
+class ClockSource : NonCopyable
 {
 public:
-    using FnTrigger = std::function<void()>;
+    using TimePoint = std::chrono::steady_clock::time_point;
+    using Duration = std::chrono::steady_clock::duration;
 
-    Timer() = default;
+    virtual ~ClockSource() = default;
 
-    template <class... Args>
-    inline Timer(Args &&...args)
+    virtual TimePoint Now() const = 0;
+    virtual void SleepUntil(TimePoint deadline) = 0;
+
+    // Whether the time only moves when a driver moves it. The timer wheel then has no thread of
+    // its own and runs the callbacks on the driver thread.
+    //
+    virtual bool IsVirtual() const = 0;
+
+    inline void SleepFor(Duration duration)
     {
-        Start(std::forward<Args>(args)...);
+        SleepUntil(Now() + duration);
     }
+};
 
-    inline ~Timer()
+class RealClock final : public ClockSource
+{
+public:
+    inline TimePoint Now() const override
     {
-        Stop();
+        return std::chrono::steady_clock::now();
     }
 
-    inline void
-    Start(std::chrono::milliseconds interval, FnTrigger callback, bool immediatelyOnce = false)
+    inline void SleepUntil(TimePoint deadline) override
     {
-        Stop();
-        _destroyFlag = false;
-        _interval = std::move(interval);
-        _thread =
-            std::thread{&Timer::Thread, this, std::move(callback), immediatelyOnce};
+        std::this_thread::sleep_until(deadline);
     }
 
-    inline void Stop()
+    inline bool IsVirtual() const override
+    {
+        return false;
+    }
+};
+
+namespace Details {
+inline std::atomic<ClockSource *> &CurrentClock()
+{
+    static std::atomic<ClockSource *> i{nullptr};
+    return i;
+}
+} // namespace Details
+
+inline ClockSource &GetClock()
+{
+    static RealClock realClock;
+
+    ClockSource *clock = Details::CurrentClock().load(std::memory_order_acquire);
+    return clock != nullptr ? *clock : realClock;
+}
+
+// It must be called before the first timer is created, the wheel sticks to the clock it's created
+// with. The clock must outlive everything that uses it.
+//
+inline void SetClock(ClockSource &clock)
+{
+    Details::CurrentClock().store(&clock, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////
+
+// Serves every `Timer` and `ConWorker` of the app on a single thread.
+//
+// It is a hierarchical timing wheel with 4 levels of 64 slots and a 1 ms tick, covering about
+// 4.6 hours. Farther deadlines are parked in the last level and re-inserted when their slot comes
+// up. Arming and cancelling unlink and link an entry, and the thread only wakes up when a slot is
+// due. Deadlines that only move later are re-checked when their slot comes up, so they can be
+// postponed without taking the lock.
+//
+// The callbacks run on the wheel thread one after another, a slow one delays every timer of the
+// process. They must not block, nor take a lock that can be held for long. Post such work to an
+// executor, e.g. `BlockingExecutor`. On a virtual clock there is no wheel thread, the callbacks run
+// on the thread that moves the clock.
+//
+class TimerWheel : public Singleton<TimerWheel>
+{
+public:
+    using TimePoint = ClockSource::TimePoint;
+    using Duration = ClockSource::Duration;
+
+    class Entry : Helper::NonCopyable
+    {
+    public:
+        Entry() = default;
+
+        std::function<void()> callback;
+        std::atomic<TimePoint> deadline{};
+        std::atomic<Duration> interval{}; // Re-armed with it before firing if non-zero
+
+    private:
+        friend TimerWheel;
+
+        Entry *prev{nullptr}, *next{nullptr};
+        uint32_t level{0}, slot{0};
+        bool linked{false};
+    };
+
+    inline ~TimerWheel()
     {
-        _destroyFlag = true;
-        _destroyConVar.notify_all();
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stop = true;
+        }
+        _conVar.notify_all();
         if (_thread.joinable()) {
             _thread.join();
         }
     }
 
-    inline void Reset()
+    // Arms the entry, or re-arms it if it's armed already
+    //
+    inline void Schedule(Entry &entry, TimePoint deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            Disarm(entry);
+            entry.deadline = deadline;
+            Insert(entry);
+        }
+        _conVar.notify_all();
+    }
+
+    // Like `Schedule`, but does nothing if the entry isn't armed
+    //
+    inline bool Reschedule(Entry &entry, TimePoint deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (!entry.linked) {
+                return false;
+            }
+            Disarm(entry);
+            entry.deadline = deadline;
+            Insert(entry);
+        }
+        _conVar.notify_all();
+        return true;
+    }
+
+    // When it returns the callback isn't running and won't run again, unless it's called from the
+    // callback itself
+    //
+    inline void Cancel(Entry &entry)
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+
+        Disarm(entry);
+        _conVar.wait(lock, [&] {
+            return _running != &entry || _runningOn == std::this_thread::get_id();
+        });
+    }
+
+    // Only for a virtual clock. Processes the slots due up to the target one after another, moving
+    // the clock to each of them with `advance` before running their callbacks.
+    //
+    inline void RunUntil(TimePoint target, const std::function<void(TimePoint)> &advance)
     {
-        _deadline = Clock::now() + _interval.load();
+        std::unique_lock<std::mutex> lock{_mutex};
+
+        if (!_clock.IsVirtual()) {
+            return;
+        }
+
+        const uint64_t targetTick = ToTick(target, false);
+
+        for (auto next = NextTick(); next.has_value() && next.value() <= targetTick && !_stop;
+             next = NextTick())
+        {
+            advance(_epoch + Tick{next.value()});
+            ProcessTick(next.value());
+            RunDue(lock);
+        }
+        _now = std::max(_now, targetTick);
     }
 
 private:
-    using Clock = std::chrono::steady_clock;
-    using TimePoint = Clock::time_point;
+    friend Singleton<TimerWheel>;
+
+    constexpr static uint32_t kLevels = 4;
+    constexpr static uint32_t kSlotBits = 6;
+    constexpr static uint32_t kSlots = 1 << kSlotBits;
+    constexpr static uint64_t kRange = uint64_t{1} << (kSlotBits * kLevels);
+    using Tick = std::chrono::milliseconds;
 
-    std::atomic<bool> _destroyFlag{false};
     std::mutex _mutex;
-    std::condition_variable _destroyConVar;
-    std::atomic<std::chrono::milliseconds> _interval;
-    std::atomic<TimePoint> _deadline;
+    std::condition_variable _conVar;
+    std::array<std::array<Entry *, kSlots>, kLevels> _slots{};
+    std::array<uint64_t, kLevels> _occupied{};
+    std::deque<Entry *> _due;
+    Entry *_running{nullptr};
+    std::thread::id _runningOn;
+    ClockSource &_clock{GetClock()};
+    const TimePoint _epoch{_clock.Now()};
+    uint64_t _now{0}; // In ticks since `_epoch`, every slot before it has been processed
+    bool _stop{false};
     std::thread _thread;
 
-    inline void Thread(FnTrigger callback, bool immediatelyOnce)
+    inline TimerWheel()
     {
-        if (immediatelyOnce) {
-            callback();
+        if (!_clock.IsVirtual()) {
+            _thread = std::thread{&TimerWheel::Thread, this};
         }
+    }
 
-        Reset();
+    inline uint64_t ToTick(TimePoint timePoint, bool roundUp) const
+    {
+        if (timePoint <= _epoch) {
+            return 0;
+        }
+        const auto elapsed = timePoint - _epoch;
+        return roundUp ? std::chrono::ceil<Tick>(elapsed).count()
+                       : std::chrono::floor<Tick>(elapsed).count();
+    }
 
-        while (true) {
-            std::unique_lock<std::mutex> lock{_mutex};
-            {
-                _destroyConVar.wait_until(lock, _deadline.load());
-            }
-            lock.unlock();
+    inline void Insert(Entry &entry)
+    {
+        uint64_t tick = std::max(ToTick(entry.deadline.load(), true), _now + 1);
+        uint64_t delta = tick - _now;
+        if (delta >= kRange) {
+            tick = _now + kRange - 1;
+            delta = kRange - 1;
+        }
 
-            if (_destroyFlag) {
-                break;
-            }
-            if (_deadline.load() > Clock::now()) {
-                continue;
-            }
-            Reset();
-            callback();
+        uint32_t level = 0;
+        while (delta >= (uint64_t{1} << (kSlotBits * (level + 1)))) {
+            ++level;
         }
+
+        const uint32_t slot = (tick >> (kSlotBits * level)) & (kSlots - 1);
+        Entry *&head = _slots[level][slot];
+
+        entry.level = level;
+        entry.slot = slot;
+        entry.prev = nullptr;
+        entry.next = head;
+        entry.linked = true;
+        if (head != nullptr) {
+            head->prev = &entry;
+        }
+        head = &entry;
+        _occupied[level] |= uint64_t{1} << slot;
     }
-};
+
+    inline void Disarm(Entry &entry)
+    {
+        std::erase(_due, &entry);
+
+        if (!entry.linked) {
+            return;
+        }
+
+        if (entry.prev != nullptr) {
+            entry.prev->next = entry.next;
+        }
+        else {
+            _slots[entry.level][entry.slot] = entry.next;
+        }
+        if (entry.next != nullptr) {
+            entry.next->prev = entry.prev;
+        }
+        if (_slots[entry.level][entry.slot] == nullptr) {
+            _occupied[entry.level] &= ~(uint64_t{1} << entry.slot);
+        }
+        entry.linked = false;
+    }
+
+    // The tick at which the next occupied slot is processed. A slot of level > 0 is processed
+    // when the lower levels wrap around, so its entries can be re-inserted with finer slots.
+    //
+    inline std::optional<uint64_t> NextTick() const
+    {
+        std::optional<uint64_t> result;
+
+        for (uint32_t level = 0; level < kLevels; ++level) {
+            if (_occupied[level] == 0) {
+                continue;
+            }
+
+            const uint32_t shift = kSlotBits * level;
+            const uint64_t base = _now >> shift;
+            const uint64_t rotated = std::rotr(_occupied[level], base & (kSlots - 1));
+
+            uint64_t distance;
+            if (level == 0) {
+                distance = std::countr_zero(rotated);
+            }
+            else {
+                const uint64_t ahead = rotated & ~uint64_t{1};
+                distance = ahead != 0 ? std::countr_zero(ahead) : kSlots;
+            }
+
+            const uint64_t tick = (base + distance) << shift;
+            result = std::min(result.value_or(tick), tick);
+        }
+        return result;
+    }
+
+    inline void ProcessTick(uint64_t tick)
+    {
+        _now = tick;
+
+        for (uint32_t level = kLevels; level-- > 0;) {
+            const uint32_t shift = kSlotBits * level;
+            if (level > 0 && (tick & ((uint64_t{1} << shift) - 1)) != 0) {
+                continue;
+            }
+
+            const uint32_t slot = (tick >> shift) & (kSlots - 1);
+            Entry *entry = std::exchange(_slots[level][slot], nullptr);
+            _occupied[level] &= ~(uint64_t{1} << slot);
+
+            while (entry != nullptr) {
+                Entry *next = entry->next;
+                entry->linked = false;
+
+                if (ToTick(entry->deadline.load(), true) > tick) {
+                    Insert(*entry); // Postponed, or a coarse slot of a higher level
+                }
+                else {
+                    const auto interval = entry->interval.load();
+                    if (interval != Duration::zero()) {
+                        entry->deadline = _clock.Now() + interval;
+                        Insert(*entry);
+                    }
+                    _due.push_back(entry);
+                }
+                entry = next;
+            }
+        }
+    }
+
+    inline void RunDue(std::unique_lock<std::mutex> &lock)
+    {
+        while (!_due.empty() && !_stop) {
+            _running = _due.front();
+            _runningOn = std::this_thread::get_id();
+            _due.pop_front();
+
+            lock.unlock();
+            _running->callback();
+            lock.lock();
+
+            _running = nullptr;
+            _conVar.notify_all();
+        }
+    }
+
+    inline void Thread()
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+
+        while (!_stop) {
+            const uint64_t nowTick = ToTick(_clock.Now(), false);
+
+            for (auto next = NextTick(); next.has_value() && next.value() <= nowTick;
+                 next = NextTick())
+            {
+                ProcessTick(next.value());
+            }
+            _now = std::max(_now, nowTick);
+
+            RunDue(lock);
+
+            if (_stop) {
+                break;
+            }
+
+            const auto next = NextTick();
+            if (next.has_value()) {
+                _conVar.wait_until(lock, _epoch + Tick{next.value()});
+            }
+            else {
+                _conVar.wait(lock);
+            }
+        }
+    }
+};
+
+// Time that only moves when it's told to. Moving it runs the timers due meanwhile on the calling
+// thread, in the order of their deadlines and with `Now()` returning each deadline in turn, so a
+// replay behaves the same on every run however fast it goes.
+//
+// Like on the real clock, a timer armed for the current time fires on the next tick, i.e. it needs
+// the clock to move 1 ms further.
+//
+class VirtualClock final : public ClockSource
+{
+public:
+    explicit VirtualClock(TimePoint start = TimePoint{}) : _now{start} {}
+
+    inline TimePoint Now() const override
+    {
+        return _now.load();
+    }
+
+    // Blocks until another thread moves the time past the deadline
+    //
+    inline void SleepUntil(TimePoint deadline) override
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _conVar.wait(lock, [&] { return _now.load() >= deadline; });
+    }
+
+    inline bool IsVirtual() const override
+    {
+        return true;
+    }
+
+    // It must not be called from a timer callback
+    //
+    inline void AdvanceTo(TimePoint target)
+    {
+        TimerWheel::GetInstance().RunUntil(target, [this](TimePoint now) { Set(now); });
+        Set(target);
+    }
+
+    inline void AdvanceBy(Duration duration)
+    {
+        AdvanceTo(Now() + duration);
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _conVar;
+    std::atomic<TimePoint> _now;
+
+    inline void Set(TimePoint now)
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (now > _now.load()) {
+                _now = now;
+            }
+        }
+        _conVar.notify_all();
+    }
+};
+
+class ConWorker
+{
+public:
+    using FnCallback = std::function<bool()>;
+
+    ConWorker() = default;
+
+    inline ConWorker(std::chrono::milliseconds interval, FnCallback callback)
+    {
+        Start(std::move(interval), std::move(callback));
+    }
+
+    inline ~ConWorker()
+    {
+        Stop();
+    }
+
+    inline void Start(std::chrono::milliseconds interval, FnCallback callback)
+    {
+        Stop();
+        _callback = std::move(callback);
+        _entry.interval = interval;
+        _entry.callback = [this] {
+            if (!_callback()) {
+                TimerWheel::GetInstance().Cancel(_entry);
+            }
+        };
+        _started = true;
+        TimerWheel::GetInstance().Schedule(_entry, GetClock().Now());
+    }
+
+    inline void Stop()
+    {
+        if (_started) {
+            TimerWheel::GetInstance().Cancel(_entry);
+        }
+    }
+
+    // Runs the callback right away instead of waiting for the interval
+    //
+    inline void Notify()
+    {
+        if (_started) {
+            TimerWheel::GetInstance().Reschedule(_entry, GetClock().Now());
+        }
+    }
+
+private:
+    FnCallback _callback;
+    TimerWheel::Entry _entry;
+    bool _started{false};
+};
+
+class Timer
+{
+public:
+    using FnTrigger = std::function<void()>;
+
+    Timer() = default;
+
+    template <class... Args>
+    inline Timer(Args &&...args)
+    {
+        Start(std::forward<Args>(args)...);
+    }
+
+    inline ~Timer()
+    {
+        Stop();
+    }
+
+    inline void
+    Start(std::chrono::milliseconds interval, FnTrigger callback, bool immediatelyOnce = false)
+    {
+        Stop();
+        _entry.callback = std::move(callback);
+        _entry.interval = interval;
+        _started = true;
+
+        const auto now = GetClock().Now();
+        TimerWheel::GetInstance().Schedule(_entry, immediatelyOnce ? now : now + interval);
+    }
+
+    inline void Stop()
+    {
+        if (_started) {
+            TimerWheel::GetInstance().Cancel(_entry);
+        }
+    }
+
+    // Postpones the trigger by a whole interval. It's lock-free, the wheel notices the new
+    // deadline when the old one is due.
+    //
+    inline void Reset()
+    {
+        _entry.deadline = GetClock().Now() + _entry.interval.load();
+    }
+
+private:
+    TimerWheel::Entry _entry;
+    bool _started{false};
+};
+
+//////////////////////////////////////////////////
+
+// Thrown when a cancelled token is noticed
+//
+class OperationCancelled : public std::exception
+{
+public:
+    inline const char *what() const noexcept override
+    {
+        return "The operation was cancelled.";
+    }
+};
+
+namespace Details {
+struct CancellationState {
+    std::mutex mutex;
+    std::condition_variable conVar;
+    bool cancelled{false};
+    CbHandle nextHandle{1}, running{0};
+    std::thread::id runningOn;
+    std::vector<std::pair<CbHandle, std::function<void()>>> callbacks;
+};
+} // namespace Details
+
+// A default-constructed token is never cancelled
+//
+class CancellationToken
+{
+public:
+    CancellationToken() = default;
+
+    inline bool IsCancelled() const
+    {
+        if (_state == nullptr) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock{_state->mutex};
+        return _state->cancelled;
+    }
+
+    inline void ThrowIfCancelled() const
+    {
+        if (IsCancelled()) {
+            throw OperationCancelled{};
+        }
+    }
+
+    // The callback runs once on the thread that cancels, or right away if it's cancelled already.
+    // When `Unregister` returns it isn't running and won't run, unless it's called from the
+    // callback itself.
+    //
+    inline CbHandle Register(std::function<void()> callback)
+    {
+        if (_state == nullptr) {
+            return 0;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{_state->mutex};
+            if (!_state->cancelled) {
+                const auto handle = _state->nextHandle++;
+                _state->callbacks.emplace_back(handle, std::move(callback));
+                return handle;
+            }
+        }
+        callback();
+        return 0;
+    }
+
+    inline void Unregister(CbHandle handle)
+    {
+        if (_state == nullptr || handle == 0) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock{_state->mutex};
+
+        std::erase_if(_state->callbacks, [handle](const auto &callbackInfo) {
+            return callbackInfo.first == handle;
+        });
+        _state->conVar.wait(lock, [&] {
+            return _state->running != handle ||
+                   _state->runningOn == std::this_thread::get_id();
+        });
+    }
+
+private:
+    friend class CancellationSource;
+
+    std::shared_ptr<Details::CancellationState> _state;
+
+    explicit CancellationToken(std::shared_ptr<Details::CancellationState> state)
+        : _state{std::move(state)}
+    {
+    }
+};
+
+class CancellationSource : NonCopyable
+{
+public:
+    inline CancellationSource()
+    {
+        _timeout.callback = [this] { Cancel(); };
+    }
+
+    inline ~CancellationSource()
+    {
+        if (_timeoutArmed) {
+            TimerWheel::GetInstance().Cancel(_timeout);
+        }
+    }
+
+    inline CancellationToken GetToken() const
+    {
+        return CancellationToken{_state};
+    }
+
+    inline void Cancel()
+    {
+        std::unique_lock<std::mutex> lock{_state->mutex};
+
+        if (_state->cancelled) {
+            return;
+        }
+        _state->cancelled = true;
+
+        while (!_state->callbacks.empty()) {
+            auto callback = std::move(_state->callbacks.front().second);
+            _state->running = _state->callbacks.front().first;
+            _state->runningOn = std::this_thread::get_id();
+            _state->callbacks.erase(_state->callbacks.begin());
+
+            lock.unlock();
+            callback();
+            lock.lock();
+
+            _state->running = 0;
+            _state->conVar.notify_all();
+        }
+    }
+
+    // A timeout, counted on the installed clock
+    //
+    inline void CancelAfter(ClockSource::Duration timeout)
+    {
+        _timeoutArmed = true;
+        TimerWheel::GetInstance().Schedule(_timeout, GetClock().Now() + timeout);
+    }
+
+private:
+    std::shared_ptr<Details::CancellationState> _state{
+        std::make_shared<Details::CancellationState>()};
+    TimerWheel::Entry _timeout;
+    bool _timeoutArmed{false};
+};
+
+//////////////////////////////////////////////////
+
+// A lazy coroutine. It starts when it's awaited, and resumes its awaiter when it finishes, on
+// whatever thread it finishes on. Use `Spawn` or `SyncWait` to start one from a plain function.
+//
+// Neither the coroutines nor the code awaiting them are tied to a platform. The platform
+// awaitables are adapted in the OS headers, see `OS::Windows::Winrt::Await`.
+//
+template <class T = void>
+class Task;
+
+namespace Details {
+
+class TaskPromiseBase
+{
+public:
+    struct FinalAwaiter {
+        inline bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template <class Promise>
+        inline std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+        {
+            const auto continuation = handle.promise().GetContinuation();
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        inline void await_resume() const noexcept {}
+    };
+
+    inline std::suspend_always initial_suspend() const noexcept
+    {
+        return {};
+    }
+
+    inline FinalAwaiter final_suspend() const noexcept
+    {
+        return {};
+    }
+
+    inline void unhandled_exception() noexcept
+    {
+        _exception = std::current_exception();
+    }
+
+    inline std::coroutine_handle<> GetContinuation() const noexcept
+    {
+        return _continuation;
+    }
+
+    inline void SetContinuation(std::coroutine_handle<> continuation) noexcept
+    {
+        _continuation = continuation;
+    }
+
+protected:
+    inline void RethrowIfFailed() const
+    {
+        if (_exception) {
+            std::rethrow_exception(_exception);
+        }
+    }
+
+private:
+    std::coroutine_handle<> _continuation;
+    std::exception_ptr _exception;
+};
+
+template <class T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+
+    template <class U>
+    inline void return_value(U &&value)
+    {
+        _value.emplace(std::forward<U>(value));
+    }
+
+    inline T TakeResult()
+    {
+        RethrowIfFailed();
+        return std::move(_value.value());
+    }
+
+private:
+    std::optional<T> _value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+
+    inline void return_void() noexcept {}
+
+    inline void TakeResult() const
+    {
+        RethrowIfFailed();
+    }
+};
+} // namespace Details
+
+template <class T>
+class [[nodiscard]] Task
+{
+public:
+    using promise_type = Details::TaskPromise<T>;
+
+    inline Task(Task &&rhs) noexcept : _handle{std::exchange(rhs._handle, nullptr)} {}
+
+    inline Task &operator=(Task &&rhs) noexcept
+    {
+        if (this != &rhs) {
+            Destroy();
+            _handle = std::exchange(rhs._handle, nullptr);
+        }
+        return *this;
+    }
+
+    inline ~Task()
+    {
+        Destroy();
+    }
+
+    inline bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        _handle.promise().SetContinuation(continuation);
+        return _handle;
+    }
+
+    inline T await_resume()
+    {
+        return _handle.promise().TakeResult();
+    }
+
+private:
+    friend promise_type;
+
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle{handle} {}
+
+    inline void Destroy()
+    {
+        if (_handle) {
+            _handle.destroy();
+            _handle = nullptr;
+        }
+    }
+};
+
+namespace Details {
+
+template <class T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+// Owns itself and is destroyed when it finishes
+//
+struct DetachedTask {
+    struct promise_type {
+        inline DetachedTask get_return_object() const noexcept
+        {
+            return {};
+        }
+
+        inline std::suspend_never initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        inline std::suspend_never final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        inline void return_void() const noexcept {}
+
+        inline void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+template <class T>
+inline DetachedTask RunDetached(Task<T> task, std::promise<T> promise)
+{
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            promise.set_value();
+        }
+        else {
+            promise.set_value(co_await task);
+        }
+    }
+    catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+} // namespace Details
+
+// Starts the task on the calling thread, where it runs until it first suspends. The future is
+// ready once it finishes.
+//
+template <class T>
+inline std::future<T> Spawn(Task<T> task)
+{
+    std::promise<T> promise;
+    auto future = promise.get_future();
+    Details::RunDetached(std::move(task), std::move(promise));
+    return future;
+}
+
+// It must not be called on a thread that the task needs in order to resume, e.g. the one draining
+// the `ManualScheduler` the task is on.
+//
+template <class T>
+inline T SyncWait(Task<T> task)
+{
+    return Spawn(std::move(task)).get();
+}
+
+inline auto ResumeOn(Scheduler &scheduler)
+{
+    struct Awaiter {
+        Scheduler &scheduler;
+
+        inline bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        inline void await_suspend(std::coroutine_handle<> handle) const
+        {
+            scheduler.Post([handle] { handle.resume(); });
+        }
+
+        inline void await_resume() const noexcept {}
+    };
+    return Awaiter{scheduler};
+}
+
+// Resumes on the scheduler once the duration has passed on the installed clock, or right after
+// the token is cancelled, throwing `OperationCancelled` then.
+//
+inline auto
+Delay(ClockSource::Duration duration, Scheduler &scheduler, CancellationToken token = {})
+{
+    class Awaiter
+    {
+    public:
+        inline Awaiter(
+            ClockSource::Duration duration, Scheduler &scheduler, CancellationToken token)
+            : _duration{duration}, _scheduler{scheduler}, _token{std::move(token)}
+        {
+        }
+
+        inline bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        inline void await_suspend(std::coroutine_handle<> handle)
+        {
+            // The awaiter may be gone as soon as the entry is scheduled, the state is kept alive
+            // until this function returns
+            //
+            auto state = _state;
+            auto &wheel = TimerWheel::GetInstance();
+
+            state->entry.callback = [&scheduler = _scheduler, handle] {
+                scheduler.Post([handle] { handle.resume(); });
+            };
+            _cancelHandle = _token.Register([state] {
+                state->cancelled = true;
+                TimerWheel::GetInstance().Reschedule(state->entry, GetClock().Now());
+            });
+
+            wheel.Schedule(state->entry, GetClock().Now() + _duration);
+            if (state->cancelled) {
+                wheel.Reschedule(state->entry, GetClock().Now());
+            }
+        }
+
+        inline void await_resume()
+        {
+            _token.Unregister(_cancelHandle);
+            TimerWheel::GetInstance().Cancel(_state->entry);
+
+            if (_state->cancelled) {
+                throw OperationCancelled{};
+            }
+        }
+
+    private:
+        struct State {
+            TimerWheel::Entry entry;
+            std::atomic<bool> cancelled{false};
+        };
+
+        ClockSource::Duration _duration;
+        Scheduler &_scheduler;
+        CancellationToken _token;
+        CbHandle _cancelHandle{0};
+        std::shared_ptr<State> _state{std::make_shared<State>()};
+    };
+    return Awaiter{duration, scheduler, std::move(token)};
+}
 } // namespace Helper
@@ -40,7 +40,31 @@ const LaunchOpts &LaunchOptsManager::Parse(int argc, char *argv[])
 
         parser.add_options()          //
             ("help", "Print options") //
-            ("trace", "Enable trace level logging.", value<bool>()->default_value("false"));
+            ("trace", "Enable trace level logging.", value<bool>()->default_value("false")) //
+            ("import-proximity-key",
+             "Import the key for decrypting advertisements of your device. [32 hex digits]",
+             value<std::string>());
+
+        parser.add_options("Capture")                                                        //
+            ("record", "Record received advertisements to this capture file.",                //
+             value<std::string>())                                                          //
+            ("replay", "Replay this capture or btsnoop HCI log instead of scanning.",          //
+             value<std::string>())                                                          //
+            ("replay-speed", "Replay speed, 1 is real time, 0 is as fast as possible.",       //
+             value<double>()->default_value("1"))                                           //
+            ("stats", "Print the bit statistics of the AirPods frames in this capture or btsnoop "
+                      "HCI log, then exit.",
+             value<std::string>());
+
+        parser.add_options("Load test")                                                  //
+            ("load-test", "Simulate this many devices around, 0 to disable.",           //
+             value<uint32_t>()->default_value("0"))                                     //
+            ("load-test-rate", "Advertisements per second of each simulated device.",   //
+             value<double>()->default_value("10"))                                      //
+            ("load-test-seconds", "How long the load test lasts.",                      //
+             value<uint32_t>()->default_value("60"))                                    //
+            ("load-test-max-speed", "Ignore the rate and feed advertisements as fast as possible.",
+             value<bool>()->default_value("false"));
 
         auto names = enum_names<PrintAllLocales>();
         auto namesStr = std::accumulate(
@@ -65,6 +89,25 @@ const LaunchOpts &LaunchOptsManager::Parse(int argc, char *argv[])
         }
 
         _opts.enableTrace = args["trace"].as<bool>();
+        if (args.count("import-proximity-key")) {
+            _opts.proximityKey = args["import-proximity-key"].as<std::string>();
+        }
+
+        if (args.count("record")) {
+            _opts.record = args["record"].as<std::string>();
+        }
+        if (args.count("replay")) {
+            _opts.replay = args["replay"].as<std::string>();
+        }
+        _opts.replaySpeed = args["replay-speed"].as<double>();
+        if (args.count("stats")) {
+            _opts.stats = args["stats"].as<std::string>();
+        }
+
+        _opts.loadTest.devices = args["load-test"].as<uint32_t>();
+        _opts.loadTest.rate = args["load-test-rate"].as<double>();
+        _opts.loadTest.seconds = args["load-test-seconds"].as<uint32_t>();
+        _opts.loadTest.maxSpeed = args["load-test-max-speed"].as<bool>();
 
         auto printAllLocales =
             enum_cast<PrintAllLocales>(args["print-all-locales"].as<std::string>());
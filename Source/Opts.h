@@ -30,11 +30,30 @@ enum class PrintAllLocales { None, Complete, LangOnly };
 
 struct LaunchOpts {
     bool enableTrace{false};
+    std::optional<std::string> proximityKey;
+    std::optional<std::string> record, replay, stats;
+    double replaySpeed{1.0};
+
+    struct {
+        uint32_t devices{0};
+        double rate{10.0};
+        uint32_t seconds{60};
+        bool maxSpeed{false};
+    } loadTest;
 
     template <class OutStream>
     friend inline OutStream &operator<<(OutStream &outStream, const Opts::LaunchOpts &opts)
     {
-        return outStream << std::format("{{ trace: {} }}", opts.enableTrace);
+        // The key is sensitive, only log whether it is present
+        //
+        return outStream << std::format(
+                   "{{ trace: {}, import-proximity-key: {}, record: {}, replay: {}, "
+                   "replay-speed: {}, stats: {}, load-test: {{ devices: {}, rate: {}, "
+                   "seconds: {}, max-speed: {} }} }}",
+                   opts.enableTrace, opts.proximityKey.has_value(), opts.record.value_or(""),
+                   opts.replay.value_or(""), opts.replaySpeed, opts.stats.value_or(""),
+                   opts.loadTest.devices,
+                   opts.loadTest.rate, opts.loadTest.seconds, opts.loadTest.maxSpeed);
     }
 };
 
@@ -18,7 +18,9 @@
 
 #pragma once
 
+#include <array>
 #include <mutex>
+#include <atomic>
 #include <format>
 #include <vector>
 #include <cwctype>
@@ -28,6 +30,7 @@
 #include <QTimer>
 #include <QWidget>
 #include <QDialog>
+#include <QEvent>
 #include <QBitmap>
 #include <QPainter>
 #include <QKeyEvent>
@@ -102,16 +105,171 @@ inline QColor InvertColor(const QColor &color)
     return result;
 }
 
-inline void Dispatch(std::function<void()> callback)
+enum class Priority : uint32_t {
+    Critical, // Visible to the user right away, e.g. showing the popup
+    Normal,   // Cosmetic, e.g. repainting
+    _Count,
+};
+
+// Runs tasks on the main thread.
+//
+// Posting pushes the task onto a lock-free stack of its priority. Only the first task after the
+// queue was drained posts a wake-up event, the main thread then takes the whole stacks at once
+// and runs them in posting order, critical tasks first.
+//
+class TaskQueue final : public QObject, public Helper::Singleton<TaskQueue>
 {
-    QTimer *timer = new QTimer;
-    timer->moveToThread(qApp->thread());
-    timer->setSingleShot(true);
-    QObject::connect(timer, &QTimer::timeout, [timer, callback = std::move(callback)]() {
-        callback();
-        timer->deleteLater();
-    });
-    QMetaObject::invokeMethod(timer, "start", ::Qt::QueuedConnection, Q_ARG(int, 0));
+protected:
+    friend Helper::Singleton<TaskQueue>;
+
+    inline TaskQueue()
+    {
+        moveToThread(qApp->thread());
+    }
+
+public:
+    inline ~TaskQueue()
+    {
+        for (auto &head : _heads) {
+            Delete(head.exchange(nullptr));
+        }
+    }
+
+    template <class Fn>
+    inline void Post(Fn &&function, Priority priority = Priority::Normal)
+    {
+        auto *node = new NodeImpl<std::decay_t<Fn>>{std::forward<Fn>(function)};
+        auto &head = _heads[Helper::ToUnderlying(priority)];
+
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(
+            node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+
+        const size_t depth = _depth.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t maxDepth = _maxDepth.load(std::memory_order_relaxed);
+        while (depth > maxDepth && !_maxDepth.compare_exchange_weak(maxDepth, depth)) {
+        }
+
+        if (!_wakePending.exchange(true, std::memory_order_acq_rel)) {
+            QCoreApplication::postEvent(this, new QEvent{kWakeEvent});
+        }
+    }
+
+    // Tasks posted but not run yet
+    //
+    inline size_t GetDepth() const
+    {
+        return _depth.load(std::memory_order_relaxed);
+    }
+
+    inline size_t GetMaxDepth() const
+    {
+        return _maxDepth.load(std::memory_order_relaxed);
+    }
+
+protected:
+    inline bool event(QEvent *event) override
+    {
+        if (event->type() != kWakeEvent) {
+            return QObject::event(event);
+        }
+
+        // Tasks posted from now on need another wake-up
+        //
+        _wakePending.store(false, std::memory_order_release);
+
+        Node *normal = Take(Priority::Normal);
+        while (true) {
+            RunAll(Take(Priority::Critical));
+
+            if (normal == nullptr) {
+                break;
+            }
+            // Critical tasks posted while running the normal ones jump the queue
+            //
+            Node *next = normal->next;
+            Run(normal);
+            normal = next;
+        }
+        return true;
+    }
+
+private:
+    struct Node {
+        Node *next{nullptr};
+
+        virtual ~Node() = default;
+        virtual void Invoke() = 0;
+    };
+
+    template <class Fn>
+    struct NodeImpl final : Node {
+        Fn function;
+
+        inline NodeImpl(Fn &&function) : function{std::move(function)} {}
+        inline NodeImpl(const Fn &function) : function{function} {}
+
+        inline void Invoke() override
+        {
+            function();
+        }
+    };
+
+    static inline const QEvent::Type kWakeEvent =
+        static_cast<QEvent::Type>(QEvent::registerEventType());
+
+    std::array<std::atomic<Node *>, Helper::ToUnderlying(Priority::_Count)> _heads{};
+    std::atomic<size_t> _depth{0}, _maxDepth{0};
+    std::atomic<bool> _wakePending{false};
+
+    // The stack is newest first, reverse it to run in posting order
+    //
+    inline Node *Take(Priority priority)
+    {
+        Node *node = _heads[Helper::ToUnderlying(priority)].exchange(
+            nullptr, std::memory_order_acquire);
+
+        Node *reversed = nullptr;
+        while (node != nullptr) {
+            Node *next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        return reversed;
+    }
+
+    inline void Run(Node *node)
+    {
+        node->Invoke();
+        delete node;
+        _depth.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    inline void RunAll(Node *node)
+    {
+        while (node != nullptr) {
+            Node *next = node->next;
+            Run(node);
+            node = next;
+        }
+    }
+
+    static inline void Delete(Node *node)
+    {
+        while (node != nullptr) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+};
+
+template <class Fn>
+inline void Dispatch(Fn &&function, Priority priority = Priority::Normal)
+{
+    TaskQueue::GetInstance().Post(std::forward<Fn>(function), priority);
 }
 } // namespace Qt
 
@@ -0,0 +1,100 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string_view>
+
+// A minimal benchmark registry, the counterpart of `Test.h`. Benchmarks print their own results
+// through `Report`, they never fail.
+//
+namespace Benchmark {
+
+namespace Details {
+
+using FnBenchmark = void (*)();
+
+struct Case {
+    std::string_view name;
+    FnBenchmark function;
+};
+
+inline std::vector<Case> &GetCases()
+{
+    static std::vector<Case> i;
+    return i;
+}
+
+struct Registrar {
+    Registrar(std::string_view name, FnBenchmark function)
+    {
+        GetCases().push_back(Case{name, function});
+    }
+};
+} // namespace Details
+
+constexpr inline auto kDuration = std::chrono::milliseconds{500};
+
+void Report(std::string_view label, double value, std::string_view unit);
+
+// Keeps the compiler from optimizing away the computation of `value`
+//
+inline void Consume(uint64_t value)
+{
+    thread_local volatile uint64_t sink;
+    sink = sink + value;
+}
+
+// Runs `work(stop)` on `threads` threads until `kDuration` elapses. `work` returns how many
+// operations it did. Returns the operations per second of all threads together.
+//
+template <class Work>
+double RunThreads(size_t threads, Work &&work)
+{
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> operations{0};
+    std::vector<std::thread> workers;
+
+    const auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&] { operations += work(stop); });
+    }
+
+    std::this_thread::sleep_for(kDuration);
+    stop = true;
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<double>(operations.load()) / elapsed.count();
+}
+
+int RunAll();
+
+} // namespace Benchmark
+
+#define APD_BENCHMARK(name)                                                                        \
+    static void ApdBenchmark_##name();                                                             \
+    static const Benchmark::Details::Registrar ApdBenchmarkRegistrar_##name{                       \
+        #name, &ApdBenchmark_##name};                                                              \
+    static void ApdBenchmark_##name()
@@ -0,0 +1,130 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include <Helper.h>
+
+#include "Benchmark.h"
+
+// Invoke throughput of `Helper::Callback` while another thread keeps registering and
+// unregistering, compared with the implementation it replaced, which held a mutex for the whole
+// `Invoke`.
+//
+namespace {
+
+template <class Function>
+class MutexCallback
+{
+public:
+    inline Helper::CbHandle Register(Function &&callback)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto thisHandle = _nextHandle++;
+        _callbacks.emplace_back(thisHandle, std::move(callback));
+        return thisHandle;
+    }
+
+    inline bool Unregister(Helper::CbHandle handle)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto iter =
+            std::find_if(_callbacks.begin(), _callbacks.end(), [handle](const auto &callbackInfo) {
+                return callbackInfo.first == handle;
+            });
+
+        if (iter == _callbacks.end()) {
+            return false;
+        }
+
+        _callbacks.erase(iter);
+        return true;
+    }
+
+    template <class... Args>
+    inline void Invoke(Args &&...args) const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        for (const auto &callbackInfo : _callbacks) {
+            callbackInfo.second(args...);
+        }
+    }
+
+private:
+    mutable std::mutex _mutex;
+    Helper::CbHandle _nextHandle{1};
+    std::vector<std::pair<Helper::CbHandle, Function>> _callbacks;
+};
+
+using FnCallback = std::function<void(uint64_t)>;
+
+template <class CallbackT>
+void Run(std::string_view name)
+{
+    for (size_t invokers : {1, 4}) {
+        CallbackT callback;
+
+        // Like the watcher callbacks, a couple of long-lived ones
+        //
+        callback.Register([](uint64_t value) { Benchmark::Consume(value); });
+        callback.Register([](uint64_t value) { Benchmark::Consume(value + 1); });
+
+        std::atomic<bool> stopRegistrar{false};
+        uint64_t registrations = 0;
+
+        std::thread registrar{[&] {
+            while (!stopRegistrar.load(std::memory_order_relaxed)) {
+                const auto handle = callback.Register([](uint64_t) {});
+                callback.Unregister(handle);
+                ++registrations;
+            }
+        }};
+
+        const auto begin = std::chrono::steady_clock::now();
+        const double invokes = Benchmark::RunThreads(invokers, [&](const std::atomic<bool> &stop) {
+            uint64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                callback.Invoke(count++);
+            }
+            return count;
+        });
+        stopRegistrar = true;
+        registrar.join();
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        const auto label = std::string{name} + ", invokers: " + std::to_string(invokers);
+        Benchmark::Report(label + ", invokes", invokes, "/s");
+        Benchmark::Report(
+            label + ", registrations", static_cast<double>(registrations) / elapsed.count(), "/s");
+    }
+}
+} // namespace
+
+APD_BENCHMARK(Callback_InvokeWhileRegistering)
+{
+    Run<Helper::Callback<FnCallback>>("Copy-on-write");
+    Run<MutexCallback<FnCallback>>("Mutex");
+}
@@ -0,0 +1,57 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Benchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <Assert.h>
+
+namespace Benchmark {
+
+void Report(std::string_view label, double value, std::string_view unit)
+{
+    std::printf(
+        "    %-48.*s %14.0f %.*s\n", static_cast<int>(label.size()), label.data(), value,
+        static_cast<int>(unit.size()), unit.data());
+}
+
+int RunAll()
+{
+    for (const auto &benchmark : Details::GetCases()) {
+        std::printf("%.*s\n", static_cast<int>(benchmark.name.size()), benchmark.name.data());
+        benchmark.function();
+    }
+    return 0;
+}
+} // namespace Benchmark
+
+void Assert::Trigger(const std::string &condition, const std::source_location &srcloc)
+{
+    std::fprintf(
+        stderr, "%s(%u): assertion failed: %s\n", srcloc.file_name(),
+        static_cast<unsigned>(srcloc.line()), condition.c_str());
+    std::abort();
+}
+
+int main()
+{
+    return Benchmark::RunAll();
+}
@@ -0,0 +1,118 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <mutex>
+#include <array>
+#include <string>
+#include <optional>
+
+#include <Helper.h>
+
+#include "Benchmark.h"
+
+// Readers of the current AirPods state against a writer that keeps publishing, as the ingest
+// thread does under load. `Helper::Published` is compared with what `StateManager` did before,
+// a mutex shared by the readers and the writer.
+//
+namespace {
+
+// The size of `Core::AirPods::PackedState`
+//
+using Value = std::optional<std::array<uint64_t, 2>>;
+
+class MutexPublished
+{
+public:
+    inline Value Load() const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _value;
+    }
+
+    inline void Publish(Value value)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _value = std::move(value);
+    }
+
+private:
+    mutable std::mutex _mutex;
+    Value _value;
+};
+
+template <class Published, class FnRead>
+void Run(std::string_view name, FnRead &&read)
+{
+    for (size_t readers : {1, 2, 4, 8, 16}) {
+        Published published;
+        std::atomic<bool> stopWriter{false};
+        uint64_t writes = 0;
+
+        std::thread writer{[&] {
+            for (uint64_t i = 0; !stopWriter.load(std::memory_order_relaxed); ++i) {
+                published.Publish(Value{std::array<uint64_t, 2>{i, i}});
+                ++writes;
+            }
+        }};
+
+        const auto begin = std::chrono::steady_clock::now();
+        const double reads = Benchmark::RunThreads(readers, [&](const std::atomic<bool> &stop) {
+            uint64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                Benchmark::Consume(read(published));
+                ++count;
+            }
+            return count;
+        });
+        stopWriter = true;
+        writer.join();
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        const auto label = std::string{name} + ", readers: " + std::to_string(readers);
+        Benchmark::Report(label + ", reads", reads, "/s");
+        Benchmark::Report(label + ", writes", static_cast<double>(writes) / elapsed.count(), "/s");
+    }
+}
+} // namespace
+
+APD_BENCHMARK(PublishedSnapshot_Contention)
+{
+    Run<Helper::Published<Value>>("Published", [](const Helper::Published<Value> &published) {
+        const auto snapshot = published.Load();
+        return snapshot->value.has_value() ? snapshot->value->at(0) : 0;
+    });
+    Run<MutexPublished>("Mutex", [](const MutexPublished &published) {
+        const auto value = published.Load();
+        return value.has_value() ? value->at(0) : 0;
+    });
+}
+
+APD_BENCHMARK(PublishedSnapshot_PollVersion)
+{
+    Helper::Published<Value> published;
+
+    const double reads = Benchmark::RunThreads(8, [&](const std::atomic<bool> &stop) {
+        uint64_t count = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            count += published.GetVersion() == 0;
+        }
+        return count;
+    });
+    Benchmark::Report("GetVersion, readers: 8", reads, "/s");
+}
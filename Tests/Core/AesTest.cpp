@@ -0,0 +1,56 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <random>
+
+#include <Core/Aes.h>
+
+#include "../Test.h"
+
+using namespace Core::Aes;
+
+// The portable path is checked against the FIPS-197 vectors at compile time. `Encrypt` and
+// `Decrypt` dispatch at runtime, to AES-NI if the CPU supports it, so they are checked here.
+//
+APD_TEST_CASE(Aes_DispatchedMatchesTestVectors)
+{
+    const Aes128 aes{Details::kTestKey};
+
+    APD_CHECK(aes.Encrypt(Details::kTestPlaintext) == Details::kTestCiphertext);
+    APD_CHECK(aes.Decrypt(Details::kTestCiphertext) == Details::kTestPlaintext);
+}
+
+APD_TEST_CASE(Aes_DispatchedMatchesPortable)
+{
+    std::mt19937 random{1};
+
+    for (size_t i = 0; i < 10'000; ++i) {
+        Key128 key;
+        Block block;
+        for (auto &byte : key) {
+            byte = static_cast<uint8_t>(random());
+        }
+        for (auto &byte : block) {
+            byte = static_cast<uint8_t>(random());
+        }
+
+        const Aes128 aes{key};
+        APD_CHECK(aes.Encrypt(block) == aes.EncryptPortable(block));
+        APD_CHECK(aes.Decrypt(block) == aes.DecryptPortable(block));
+    }
+}
@@ -0,0 +1,121 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <random>
+#include <vector>
+
+#include <Core/Cpu.h>
+#include <Core/AppleCPBatch.h>
+
+#include "../Test.h"
+
+using namespace Core::AppleCP;
+
+namespace {
+
+struct OwnedColumns {
+    explicit OwnedColumns(size_t count) :
+        model(count), leftBattery(count), rightBattery(count), caseBattery(count),
+        charging(count), inEar(count), bothInCase(count), lidOpened(count), side(count)
+    {
+    }
+
+    Batch::Columns Get()
+    {
+        return Batch::Columns{
+            model.data(),       leftBattery.data(), rightBattery.data(),
+            caseBattery.data(), charging.data(),    inEar.data(),
+            bothInCase.data(),  lidOpened.data(),   side.data(),
+        };
+    }
+
+    bool operator==(const OwnedColumns &rhs) const = default;
+
+    std::vector<Core::AirPods::Model> model;
+    std::vector<uint8_t> leftBattery, rightBattery, caseBattery;
+    std::vector<uint8_t> charging, inEar, bothInCase, lidOpened;
+    std::vector<Core::AirPods::Side> side;
+};
+
+// Random frames, a third of which carry a known model id. The count is deliberately not a
+// multiple of any vector width, so the scalar tail is covered as well.
+//
+std::vector<uint8_t> MakeFrames(size_t count)
+{
+    std::mt19937 random{1};
+    std::vector<uint8_t> result(count * sizeof(AirPods));
+
+    for (auto &byte : result) {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    const auto &descriptors = Core::AirPods::Details::kModelDescriptors;
+    for (size_t i = 0; i < count; ++i) {
+        auto *frame = &result[i * sizeof(AirPods)];
+        if (i % 3 == 0) {
+            const auto modelId = descriptors[i / 3 % descriptors.size()].modelId;
+            frame[AirPodsLayout::kModelId.byteOffset] = static_cast<uint8_t>(modelId);
+            frame[AirPodsLayout::kModelId.byteOffset + 1] = static_cast<uint8_t>(modelId >> 8);
+        }
+    }
+    return result;
+}
+
+void CheckKernel(Batch::Kernel kernel)
+{
+    constexpr size_t kCount = 10'007;
+
+    const auto raw = MakeFrames(kCount);
+    const std::span<const AirPods> frames{reinterpret_cast<const AirPods *>(raw.data()), kCount};
+
+    OwnedColumns expected{kCount}, actual{kCount};
+    Batch::Decode(frames, expected.Get(), Batch::Kernel::Scalar);
+    Batch::Decode(frames, actual.Get(), kernel);
+
+    APD_CHECK(actual == expected);
+}
+} // namespace
+
+APD_TEST_CASE(AppleCPBatch_ScalarMatchesAccessors)
+{
+    const auto raw = MakeFrames(6);
+    const std::span<const AirPods> frames{reinterpret_cast<const AirPods *>(raw.data()), 6};
+
+    OwnedColumns columns{frames.size()};
+    Batch::Decode(frames, columns.Get(), Batch::Kernel::Scalar);
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        APD_CHECK(columns.model[i] == frames[i].GetModel());
+        APD_CHECK(columns.side[i] == frames[i].GetBroadcastedSide());
+        APD_CHECK(columns.lidOpened[i] == frames[i].IsLidOpened());
+    }
+}
+
+APD_TEST_CASE(AppleCPBatch_Sse2MatchesScalar)
+{
+    if (Core::Cpu::GetFeatures().sse2) {
+        CheckKernel(Batch::Kernel::Sse2);
+    }
+}
+
+APD_TEST_CASE(AppleCPBatch_Avx2MatchesScalar)
+{
+    if (Core::Cpu::GetFeatures().avx2) {
+        CheckKernel(Batch::Kernel::Avx2);
+    }
+}
@@ -0,0 +1,164 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <random>
+#include <algorithm>
+#include <vector>
+
+#include <Core/AppleCPStats.h>
+
+#include "../Test.h"
+
+using namespace Core::AppleCP;
+using namespace Core::AppleCP::Stats;
+
+namespace {
+
+std::vector<uint8_t> MakeFrames(size_t count)
+{
+    std::mt19937 random{1};
+    std::vector<uint8_t> result(count * sizeof(AirPods));
+
+    for (auto &byte : result) {
+        byte = static_cast<uint8_t>(random());
+    }
+    return result;
+}
+
+std::span<const AirPods> AsFrames(const std::vector<uint8_t> &raw)
+{
+    return {reinterpret_cast<const AirPods *>(raw.data()), raw.size() / sizeof(AirPods)};
+}
+
+bool IsSet(const AirPods &frame, size_t bit)
+{
+    return ((frame.Bytes()[bit / 8] >> (bit % 8)) & 1) != 0;
+}
+
+Bits ToBits(const AirPods &frame)
+{
+    Bits result{};
+    for (size_t bit = 0; bit < kBits; ++bit) {
+        if (IsSet(frame, bit)) {
+            result[bit / 64] |= uint64_t{1} << (bit % 64);
+        }
+    }
+    return result;
+}
+
+std::array<uint64_t, kBits> NaiveSet(std::span<const AirPods> frames)
+{
+    std::array<uint64_t, kBits> result{};
+    for (const auto &frame : frames) {
+        for (size_t bit = 0; bit < kBits; ++bit) {
+            result[bit] += IsSet(frame, bit);
+        }
+    }
+    return result;
+}
+} // namespace
+
+// The planes are flushed every `kFlushThreshold` (255) additions, so the counts are checked on
+// both sides of the first flushes as well
+//
+APD_TEST_CASE(AppleCPStats_BitCounterMatchesNaive)
+{
+    const auto raw = MakeFrames(1000);
+    const auto frames = AsFrames(raw);
+
+    BitCounter counter;
+    size_t added = 0;
+
+    for (const size_t count : {0, 1, 254, 255, 256, 509, 510, 511, 1000}) {
+        for (; added < count; ++added) {
+            counter.Add(ToBits(frames[added]));
+        }
+
+        APD_CHECK(counter.GetTotal() == count);
+        APD_CHECK(counter.GetCounts() == NaiveSet(frames.first(count)));
+    }
+}
+
+APD_TEST_CASE(AppleCPStats_BitCounterAllSet)
+{
+    Bits bits;
+    bits.fill(~uint64_t{0});
+
+    BitCounter counter;
+    for (size_t i = 0; i < 600; ++i) {
+        counter.Add(bits);
+    }
+
+    const auto counts = counter.GetCounts();
+    APD_CHECK(std::all_of(counts.begin(), counts.end(), [](uint64_t count) {
+        return count == 600;
+    }));
+}
+
+APD_TEST_CASE(AppleCPStats_AggregatorMatchesNaive)
+{
+    constexpr size_t kCount = 700;
+    constexpr uint64_t kAddresses = 3;
+
+    const auto raw = MakeFrames(kCount);
+    const auto frames = AsFrames(raw);
+
+    std::vector<uint64_t> addresses(kCount);
+    for (size_t i = 0; i < kCount; ++i) {
+        addresses[i] = i % kAddresses;
+    }
+
+    Aggregator aggregator;
+    aggregator.Add(addresses, frames);
+    const auto report = aggregator.GetReport();
+
+    APD_CHECK(report.frames == kCount);
+    APD_CHECK(report.set == NaiveSet(frames));
+
+    // Flips are only counted between consecutive frames of the same address
+    //
+    std::array<uint64_t, kBits> flipped{};
+    std::array<uint64_t, kAddresses> flippedBits{};
+    for (size_t i = kAddresses; i < kCount; ++i) {
+        for (size_t bit = 0; bit < kBits; ++bit) {
+            const bool flip = IsSet(frames[i], bit) != IsSet(frames[i - kAddresses], bit);
+            flipped[bit] += flip;
+            flippedBits[i % kAddresses] += flip;
+        }
+    }
+
+    APD_CHECK(report.transitions == kCount - kAddresses);
+    APD_CHECK(report.flipped == flipped);
+
+    APD_CHECK(report.addresses.size() == kAddresses);
+    for (uint64_t address = 0; address < kAddresses; ++address) {
+        const auto &stats = report.addresses.at(address);
+        APD_CHECK(stats.frames == (kCount - address + kAddresses - 1) / kAddresses);
+        APD_CHECK(stats.flippedBits == flippedBits[address]);
+    }
+
+    // Every condition only counts frames it holds for, and the bits set under it
+    //
+    for (size_t c = 0; c < kConditionCount; ++c) {
+        APD_CHECK(report.conditionFrames[c] <= report.frames);
+        for (size_t bit = 0; bit < kBits; ++bit) {
+            APD_CHECK(report.setWithCondition[c][bit] <= report.set[bit]);
+            APD_CHECK(report.setWithCondition[c][bit] <= report.conditionFrames[c]);
+        }
+    }
+}
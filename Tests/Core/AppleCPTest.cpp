@@ -0,0 +1,92 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <random>
+
+#include <Core/AppleCP.h>
+
+#include "../Test.h"
+
+using namespace Core::AppleCP;
+
+namespace {
+
+namespace PL = AirPodsPayloadLayout;
+
+AirPods MakeFrame()
+{
+    AirPods::Content content;
+    content.model = Core::AirPods::Model::AirPods_Pro;
+    content.leftBattery = 8;
+    content.rightBattery = 7;
+    content.caseBattery = 5;
+    content.rightCharging = true;
+    return AirPods::Encode(content);
+}
+
+Core::Aes::Block MakePlaintext(uint32_t left, uint32_t right, uint32_t caseBox)
+{
+    Core::Aes::Block result{};
+    Layout::Insert(PL::kLeftBattery, result, left);
+    Layout::Insert(PL::kRightBattery, result, right);
+    Layout::Insert(PL::kRightCharging, result, 1);
+    Layout::Insert(PL::kCaseBattery, result, caseBox);
+    return result;
+}
+} // namespace
+
+APD_TEST_CASE(AppleCP_ConsistentPayloadIsAccepted)
+{
+    const auto frame = MakeFrame();
+
+    APD_CHECK(frame.IsConsistentPayload(MakePlaintext(80, 70, 50)));
+    APD_CHECK(frame.IsConsistentPayload(MakePlaintext(75, 79, 41)));
+}
+
+APD_TEST_CASE(AppleCP_InconsistentPayloadIsRejected)
+{
+    const auto frame = MakeFrame();
+
+    APD_CHECK(!frame.IsConsistentPayload(MakePlaintext(60, 70, 50)));
+    APD_CHECK(!frame.IsConsistentPayload(MakePlaintext(80, 70, PL::kBatteryUnavailable)));
+
+    auto notCharging = MakePlaintext(80, 70, 50);
+    Layout::Insert(PL::kRightCharging, notCharging, 0);
+    APD_CHECK(!frame.IsConsistentPayload(notCharging));
+}
+
+// A payload decrypted with a wrong key is random bytes, which must hardly ever pass
+//
+APD_TEST_CASE(AppleCP_RandomPayloadIsRejected)
+{
+    constexpr size_t kTries = 100'000;
+
+    const auto frame = MakeFrame();
+    std::mt19937 random{1};
+
+    size_t accepted = 0;
+    for (size_t i = 0; i < kTries; ++i) {
+        Core::Aes::Block plaintext;
+        for (auto &byte : plaintext) {
+            byte = static_cast<uint8_t>(random());
+        }
+        accepted += frame.IsConsistentPayload(plaintext);
+    }
+
+    APD_CHECK(accepted < kTries / 1000);
+}
@@ -0,0 +1,122 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <new>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include <Core/Bluetooth_abstract.h>
+
+#include "../Test.h"
+
+using namespace Core::Bluetooth;
+
+//
+// Counts the heap allocations of this program, so the receive path can be proven not to allocate
+//
+
+namespace {
+
+std::atomic<size_t> gAllocations{0};
+
+size_t CountAllocations(const auto &function)
+{
+    const size_t before = gAllocations.load();
+    function();
+    return gAllocations.load() - before;
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    gAllocations.fetch_add(1);
+    if (void *result = std::malloc(size == 0 ? 1 : size)) {
+        return result;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+namespace {
+
+// The same as `AdvertisementWatcherAbstract::ReceivedData`, which needs a concrete watcher
+//
+struct ReceivedData {
+    int16_t rssi{};
+    int64_t timestamp{};
+    uint64_t address{};
+    ManufacturerDataMap manufacturerDataMap;
+};
+} // namespace
+
+APD_TEST_CASE(ManufacturerDataMap_StoresEntries)
+{
+    const std::array<uint8_t, 3> apple{0x07, 0x19, 0x01};
+    const std::array<uint8_t, 2> other{0xAA, 0xBB};
+
+    ManufacturerDataMap map;
+    APD_CHECK(map.Empty());
+    APD_CHECK(map.TryEmplace(0x004C, apple));
+    APD_CHECK(map.TryEmplace(0x0006, other));
+    APD_CHECK(!map.TryEmplace(0x004C, other));
+    APD_CHECK(map.Size() == 2);
+
+    const auto found = map.Find(0x004C);
+    APD_CHECK(found.has_value() && std::ranges::equal(found.value(), apple));
+    APD_CHECK(!map.Find(0x1234).has_value());
+
+    const std::array<uint8_t, ManufacturerDataMap::kMaxBytes> full{};
+    APD_CHECK(!map.TryEmplace(0x1234, full));
+}
+
+APD_TEST_CASE(ManufacturerDataMap_ReceivePathDoesNotAllocate)
+{
+    const std::array<uint8_t, 27> payload{0x07, 0x19};
+    Helper::BoundedQueue<ReceivedData> queue{16};
+
+    const size_t allocations = CountAllocations([&] {
+        for (uint64_t i = 0; i < 64; ++i) {
+            // What the watcher does for each advertisement
+            //
+            ReceivedData data;
+            data.address = i;
+            data.manufacturerDataMap.TryEmplace(0x004C, payload);
+            queue.TryPush(data);
+
+            // What the ingest thread does
+            //
+            ReceivedData popped;
+            if (queue.TryPop(popped)) {
+                const auto found = popped.manufacturerDataMap.Find(0x004C);
+                APD_CHECK(found.has_value() && found->size() == payload.size());
+            }
+        }
+    });
+
+    APD_CHECK(allocations == 0);
+}
@@ -0,0 +1,269 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+
+#include <Core/BtSnoop.h>
+
+#include "../Test.h"
+
+using namespace Core::Capture;
+
+namespace {
+
+constexpr uint32_t kH1 = 1001, kH4 = 1002, kMonitor = 2001;
+
+constexpr uint64_t kAddress = 0x0000'1122'3344'5566;
+constexpr int8_t kRssi = -60;
+
+// One second after the Unix epoch, in microseconds since January 1st, 0 AD
+//
+constexpr uint64_t kTimestamp = 0x00DC'DDB3'0F2F'8000 + 1'000'000;
+
+const std::vector<uint8_t> kAppleData{0x07, 0x19, 0x01, 0x0E, 0x20};
+
+void AppendBE32(std::vector<uint8_t> &buffer, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        buffer.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+void AppendAddress(std::vector<uint8_t> &buffer, uint64_t address)
+{
+    for (size_t i = 0; i < 6; ++i) {
+        buffer.push_back(static_cast<uint8_t>(address >> (i * 8)));
+    }
+}
+
+// A single manufacturer data AD structure of Apple
+//
+std::vector<uint8_t> MakeAdData()
+{
+    std::vector<uint8_t> result{static_cast<uint8_t>(3 + kAppleData.size()), 0xFF, 0x4C, 0x00};
+    result.insert(result.end(), kAppleData.begin(), kAppleData.end());
+    return result;
+}
+
+std::vector<uint8_t> MakeEvent(uint8_t subevent, const std::vector<uint8_t> &report)
+{
+    std::vector<uint8_t> result{0x3E, static_cast<uint8_t>(2 + report.size()), subevent, 1};
+    result.insert(result.end(), report.begin(), report.end());
+    return result;
+}
+
+// event_type:1 address_type:1 address:6 data_length:1 data rssi:1
+//
+std::vector<uint8_t>
+MakeLegacyEvent(uint64_t address, int8_t rssi, const std::vector<uint8_t> &adData)
+{
+    std::vector<uint8_t> report{0x00, 0x01};
+    AppendAddress(report, address);
+    report.push_back(static_cast<uint8_t>(adData.size()));
+    report.insert(report.end(), adData.begin(), adData.end());
+    report.push_back(static_cast<uint8_t>(rssi));
+    return MakeEvent(0x02, report);
+}
+
+// event_type:2 address_type:1 address:6 primary_phy:1 secondary_phy:1 sid:1 tx_power:1 rssi:1
+// interval:2 direct_address_type:1 direct_address:6 data_length:1 data
+//
+std::vector<uint8_t>
+MakeExtendedEvent(uint64_t address, int8_t rssi, const std::vector<uint8_t> &adData)
+{
+    std::vector<uint8_t> report{0x13, 0x00, 0x01};
+    AppendAddress(report, address);
+    report.insert(report.end(), {0x01, 0x00, 0xFF, 0x7F, static_cast<uint8_t>(rssi), 0, 0, 0});
+    AppendAddress(report, 0);
+    report.push_back(static_cast<uint8_t>(adData.size()));
+    report.insert(report.end(), adData.begin(), adData.end());
+    return MakeEvent(0x0D, report);
+}
+
+class BtSnoopFile
+{
+public:
+    explicit BtSnoopFile(uint32_t dataLink)
+    {
+        _bytes = {'b', 't', 's', 'n', 'o', 'o', 'p', '\0'};
+        AppendBE32(_bytes, 1);
+        AppendBE32(_bytes, dataLink);
+    }
+
+    // `includedLength` is the length in the packet header, it defaults to the actual size
+    //
+    void AddPacket(
+        uint32_t flags, const std::vector<uint8_t> &packet,
+        std::optional<uint32_t> includedLength = std::nullopt)
+    {
+        const auto length = includedLength.value_or(static_cast<uint32_t>(packet.size()));
+
+        AppendBE32(_bytes, length);
+        AppendBE32(_bytes, length);
+        AppendBE32(_bytes, flags);
+        AppendBE32(_bytes, 0);
+        AppendBE32(_bytes, static_cast<uint32_t>(kTimestamp >> 32));
+        AppendBE32(_bytes, static_cast<uint32_t>(kTimestamp));
+        _bytes.insert(_bytes.end(), packet.begin(), packet.end());
+    }
+
+    // Wrapped as a received HCI event of the datalink
+    //
+    void AddEvent(uint32_t dataLink, const std::vector<uint8_t> &event)
+    {
+        switch (dataLink) {
+        case kH1:
+            AddPacket(0b11, event);
+            break;
+        case kH4: {
+            std::vector<uint8_t> packet{0x04};
+            packet.insert(packet.end(), event.begin(), event.end());
+            AddPacket(0b11, packet);
+            break;
+        }
+        case kMonitor:
+            AddPacket(0x0003, event);
+            break;
+        }
+    }
+
+    QString Save() const
+    {
+        const auto path = QDir::temp().filePath("AirPodsDesktopTests.btsnoop");
+
+        QFile file{path};
+        file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        file.write(reinterpret_cast<const char *>(_bytes.data()), _bytes.size());
+        file.close();
+        return path;
+    }
+
+private:
+    std::vector<uint8_t> _bytes;
+};
+
+bool IsExpected(const ReceivedData &data, uint64_t address, int8_t rssi)
+{
+    const auto appleData = data.manufacturerDataMap.Find(0x004C);
+
+    return data.address == address && data.rssi == rssi &&
+           ToUnixMicroseconds(data.timestamp) == 1'000'000 && appleData.has_value() &&
+           std::equal(appleData->begin(), appleData->end(), kAppleData.begin(), kAppleData.end());
+}
+} // namespace
+
+APD_TEST_CASE(BtSnoop_ImportsEachDataLink)
+{
+    for (const uint32_t dataLink : {kH1, kH4, kMonitor}) {
+        // A sent command or an ACL packet, whichever the datalink tells apart, is skipped
+        //
+        BtSnoopFile file{dataLink};
+        file.AddPacket(dataLink == kMonitor ? 0x0002 : 0b10, {0x02, 0x00, 0x00});
+        file.AddEvent(dataLink, MakeLegacyEvent(kAddress, kRssi, MakeAdData()));
+
+        const auto path = file.Save();
+        APD_CHECK(BtSnoopImporter::IsBtSnoop(path));
+
+        BtSnoopImporter importer;
+        APD_CHECK(importer.Open(path));
+
+        const auto data = importer.Next();
+        APD_CHECK(data.has_value() && IsExpected(data.value(), kAddress, kRssi));
+        APD_CHECK(!importer.Next().has_value());
+
+        APD_CHECK(importer.GetStats().packets == 2);
+        APD_CHECK(importer.GetStats().reports == 1);
+        APD_CHECK(importer.GetStats().malformed == 0);
+    }
+}
+
+APD_TEST_CASE(BtSnoop_ReadsLegacyAndExtendedReports)
+{
+    BtSnoopFile file{kH4};
+    file.AddEvent(kH4, MakeLegacyEvent(kAddress, kRssi, MakeAdData()));
+    file.AddEvent(kH4, MakeExtendedEvent(kAddress + 1, kRssi - 1, MakeAdData()));
+
+    BtSnoopImporter importer;
+    APD_CHECK(importer.Open(file.Save()));
+
+    const auto legacy = importer.Next();
+    APD_CHECK(legacy.has_value() && IsExpected(legacy.value(), kAddress, kRssi));
+
+    const auto extended = importer.Next();
+    APD_CHECK(extended.has_value() && IsExpected(extended.value(), kAddress + 1, kRssi - 1));
+
+    APD_CHECK(!importer.Next().has_value());
+}
+
+APD_TEST_CASE(BtSnoop_StopsAtTruncatedPacket)
+{
+    const auto event = MakeLegacyEvent(kAddress, kRssi, MakeAdData());
+
+    BtSnoopFile file{kMonitor};
+    file.AddEvent(kMonitor, event);
+    file.AddPacket(0x0003, event, static_cast<uint32_t>(event.size() + 1));
+
+    BtSnoopImporter importer;
+    APD_CHECK(importer.Open(file.Save()));
+
+    APD_CHECK(importer.Next().has_value());
+    APD_CHECK(!importer.Next().has_value());
+    APD_CHECK(importer.GetStats().packets == 1);
+}
+
+APD_TEST_CASE(BtSnoop_SkipsOversizedDataLength)
+{
+    for (const bool extended : {false, true}) {
+        auto event = extended ? MakeExtendedEvent(kAddress, kRssi, MakeAdData())
+                              : MakeLegacyEvent(kAddress, kRssi, MakeAdData());
+        event[4 + (extended ? 23 : 8)] += 1;
+
+        BtSnoopFile file{kH1};
+        file.AddEvent(kH1, event);
+        file.AddEvent(kH1, MakeLegacyEvent(kAddress, kRssi, MakeAdData()));
+
+        BtSnoopImporter importer;
+        APD_CHECK(importer.Open(file.Save()));
+
+        // The malformed report is dropped, the next packet is still imported
+        //
+        const auto data = importer.Next();
+        APD_CHECK(data.has_value() && IsExpected(data.value(), kAddress, kRssi));
+        APD_CHECK(!importer.Next().has_value());
+
+        APD_CHECK(importer.GetStats().packets == 2);
+        APD_CHECK(importer.GetStats().reports == 1);
+        APD_CHECK(importer.GetStats().malformed == 1);
+    }
+}
+
+APD_TEST_CASE(BtSnoop_RejectsOtherFiles)
+{
+    BtSnoopFile file{1003};
+
+    const auto path = file.Save();
+    APD_CHECK(BtSnoopImporter::IsBtSnoop(path));
+
+    BtSnoopImporter importer;
+    APD_CHECK(!importer.Open(path));
+}
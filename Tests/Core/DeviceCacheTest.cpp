@@ -0,0 +1,144 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+#include <optional>
+
+#include <Core/Bluetooth_abstract.h>
+
+#include "../Test.h"
+
+using namespace Core::Bluetooth;
+
+namespace {
+
+using TestCache = Details::DeviceCache<int>;
+
+// Enumerates what it's given, and counts how many times it's asked
+//
+struct FakeEnumeration {
+    std::vector<TestCache::Item> items;
+    size_t count{0};
+
+    TestCache::FnEnumerate Bind()
+    {
+        return [this](Helper::CancellationToken) -> Helper::Task<std::vector<TestCache::Item>> {
+            ++count;
+            co_return items;
+        };
+    }
+};
+
+std::optional<int> Find(TestCache &cache, uint64_t address)
+{
+    return Helper::SyncWait(cache.Find(address));
+}
+} // namespace
+
+APD_TEST_CASE(DeviceCache_FilledByTheWatcher)
+{
+    FakeEnumeration enumeration;
+    TestCache cache{enumeration.Bind()};
+
+    // The devices that were already paired, the watcher enumerates them once
+    //
+    cache.OnAdded(TestCache::Item{"a", 0x0A, 1});
+    cache.OnAdded(TestCache::Item{"b", 0x0B, 2});
+    cache.OnEnumerationCompleted();
+
+    APD_CHECK(Find(cache, 0x0A) == 1);
+    APD_CHECK(Find(cache, 0x0B) == 2);
+    APD_CHECK(!Find(cache, 0x0C).has_value());
+    APD_CHECK(enumeration.count == 0);
+
+    // Newly paired, or re-reported with a new address
+    //
+    cache.OnAdded(TestCache::Item{"c", 0x0C, 3});
+    cache.OnAdded(TestCache::Item{"a", 0x1A, 4});
+    APD_CHECK(Find(cache, 0x0C) == 3);
+    APD_CHECK(Find(cache, 0x1A) == 4);
+    APD_CHECK(!Find(cache, 0x0A).has_value());
+
+    cache.OnRemoved("b");
+    APD_CHECK(!Find(cache, 0x0B).has_value());
+    APD_CHECK(Find(cache, 0x0C) == 3);
+    APD_CHECK(enumeration.count == 0);
+
+    APD_CHECK(Helper::SyncWait(cache.GetAll()) == (std::vector<int>{4, 3}));
+    APD_CHECK(enumeration.count == 0);
+}
+
+APD_TEST_CASE(DeviceCache_UpdatedEntryIsEnumeratedAgain)
+{
+    FakeEnumeration enumeration;
+    enumeration.items = {TestCache::Item{"a", 0x0A, 1}, TestCache::Item{"b", 0x0B, 2}};
+    TestCache cache{enumeration.Bind()};
+
+    // Looked up before the watcher is done
+    //
+    cache.OnAdded(TestCache::Item{"a", 0x0A, 1});
+    APD_CHECK(Find(cache, 0x0B) == 2);
+    APD_CHECK(enumeration.count == 1);
+
+    cache.OnAdded(TestCache::Item{"b", 0x0B, 2});
+    cache.OnEnumerationCompleted();
+    APD_CHECK(Find(cache, 0x0A) == 1);
+    APD_CHECK(enumeration.count == 1);
+
+    // Only a lookup of the updated entry enumerates
+    //
+    enumeration.items[1].record = 20;
+    cache.OnUpdated("b");
+    APD_CHECK(Find(cache, 0x0A) == 1);
+    APD_CHECK(enumeration.count == 1);
+    APD_CHECK(Find(cache, 0x0B) == 20);
+    APD_CHECK(enumeration.count == 2);
+    APD_CHECK(Find(cache, 0x0B) == 20);
+    APD_CHECK(enumeration.count == 2);
+
+    const auto counters = cache.GetCounters();
+    APD_CHECK(counters.enumerations == 2 && counters.misses == 2 && counters.hits == 3);
+}
+
+APD_TEST_CASE(DeviceCache_AddressMovesToAnotherDevice)
+{
+    FakeEnumeration enumeration;
+    TestCache cache{enumeration.Bind()};
+
+    cache.OnAdded(TestCache::Item{"a", 0x0A, 1});
+    cache.OnEnumerationCompleted();
+
+    // Paired again under a new id before the old one is removed
+    //
+    cache.OnAdded(TestCache::Item{"b", 0x0A, 2});
+    APD_CHECK(Find(cache, 0x0A) == 2);
+
+    // The old device moving away doesn't take the address with it
+    //
+    cache.OnAdded(TestCache::Item{"a", 0x1A, 3});
+    APD_CHECK(Find(cache, 0x0A) == 2);
+    APD_CHECK(Find(cache, 0x1A) == 3);
+
+    cache.OnRemoved("a");
+    APD_CHECK(Find(cache, 0x0A) == 2);
+    APD_CHECK(!Find(cache, 0x1A).has_value());
+
+    cache.OnRemoved("b");
+    APD_CHECK(!Find(cache, 0x0A).has_value());
+    APD_CHECK(enumeration.count == 0);
+}
@@ -0,0 +1,145 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <array>
+#include <vector>
+#include <chrono>
+
+#include <Helper.h>
+
+#include "Test.h"
+
+using namespace std::chrono_literals;
+
+//
+// The timer tests run on a virtual clock, so they are deterministic and don't sleep
+//
+
+namespace {
+
+using TimePoint = Helper::ClockSource::TimePoint;
+
+// The wheel sticks to the clock it's created with, so it's installed before any case runs
+//
+Helper::VirtualClock gClock;
+const bool gClockInstalled = (Helper::SetClock(gClock), true);
+
+struct Fired {
+    int id;
+    TimePoint at;
+};
+} // namespace
+
+APD_TEST_CASE(TimerWheel_FiresInDeadlineOrder)
+{
+    auto &wheel = Helper::TimerWheel::GetInstance();
+    const auto start = gClock.Now();
+
+    std::vector<Fired> fired;
+    std::array<Helper::TimerWheel::Entry, 4> entries;
+    const std::array<std::chrono::milliseconds, 4> delays{30ms, 10ms, 20ms, 10ms};
+
+    for (int i = 0; i < static_cast<int>(entries.size()); ++i) {
+        entries[i].callback = [&, i] { fired.push_back(Fired{i, gClock.Now()}); };
+        wheel.Schedule(entries[i], start + delays[i]);
+    }
+
+    gClock.AdvanceTo(start + 9ms);
+    APD_CHECK(fired.empty());
+
+    gClock.AdvanceTo(start + 50ms);
+    APD_CHECK(fired.size() == 4);
+    if (fired.size() == 4) {
+        APD_CHECK(fired[0].at == start + 10ms && fired[1].at == start + 10ms);
+        APD_CHECK((fired[0].id == 1 && fired[1].id == 3) || (fired[0].id == 3 && fired[1].id == 1));
+        APD_CHECK(fired[2].id == 2 && fired[2].at == start + 20ms);
+        APD_CHECK(fired[3].id == 0 && fired[3].at == start + 30ms);
+    }
+    APD_CHECK(gClock.Now() == start + 50ms);
+
+    // A cancelled entry doesn't fire
+    //
+    fired.clear();
+    wheel.Schedule(entries[0], gClock.Now() + 5ms);
+    wheel.Cancel(entries[0]);
+    gClock.AdvanceBy(10ms);
+    APD_CHECK(fired.empty());
+}
+
+APD_TEST_CASE(Timer_ResetPostponesTheTrigger)
+{
+    const auto start = gClock.Now();
+    std::vector<TimePoint> fired;
+
+    Helper::Timer timer{100ms, [&] { fired.push_back(gClock.Now()); }};
+
+    gClock.AdvanceTo(start + 60ms);
+    timer.Reset();
+
+    // The old deadline passes without firing
+    //
+    gClock.AdvanceTo(start + 159ms);
+    APD_CHECK(fired.empty());
+
+    gClock.AdvanceTo(start + 160ms);
+    APD_CHECK(fired.size() == 1 && fired.back() == start + 160ms);
+
+    // And it keeps its interval from there
+    //
+    gClock.AdvanceTo(start + 360ms);
+    APD_CHECK(fired.size() == 3 && fired.back() == start + 360ms);
+
+    timer.Stop();
+    gClock.AdvanceBy(1s);
+    APD_CHECK(fired.size() == 3);
+}
+
+APD_TEST_CASE(TimerWheel_CascadesAcrossLevels)
+{
+    auto &wheel = Helper::TimerWheel::GetInstance();
+    const auto start = gClock.Now();
+
+    // One per level of 64 ms, 4.1 s, 4.4 min and 4.6 h, and one parked beyond the range
+    //
+    const std::array<std::chrono::milliseconds, 5> delays{
+        std::chrono::milliseconds{37}, std::chrono::milliseconds{1'234},
+        std::chrono::milliseconds{98'765}, std::chrono::milliseconds{7'654'321},
+        std::chrono::milliseconds{6h + 7ms}};
+
+    std::vector<Fired> fired;
+    std::array<Helper::TimerWheel::Entry, 5> entries;
+
+    for (int i = 0; i < static_cast<int>(entries.size()); ++i) {
+        entries[i].callback = [&, i] { fired.push_back(Fired{i, gClock.Now()}); };
+        wheel.Schedule(entries[i], start + delays[i]);
+    }
+
+    for (size_t i = 0; i < delays.size(); ++i) {
+        // Not a tick early
+        //
+        gClock.AdvanceTo(start + delays[i] - 1ms);
+        APD_CHECK(fired.size() == i);
+
+        gClock.AdvanceTo(start + delays[i]);
+        APD_CHECK(fired.size() == i + 1);
+        if (fired.size() == i + 1) {
+            APD_CHECK(fired.back().id == static_cast<int>(i));
+            APD_CHECK(fired.back().at == start + delays[i]);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Test.h"
+
+#include <cstdio>
+#include <string>
+
+#include <Assert.h>
+
+namespace Test {
+
+namespace Details {
+
+static size_t gFailures = 0;
+
+void Fail(std::string_view condition, const std::source_location &srcloc)
+{
+    ++gFailures;
+    std::fprintf(
+        stderr, "%s(%u): check failed: %.*s\n", srcloc.file_name(),
+        static_cast<unsigned>(srcloc.line()), static_cast<int>(condition.size()),
+        condition.data());
+}
+} // namespace Details
+
+int RunAll()
+{
+    size_t failedCases = 0;
+
+    for (const auto &testCase : Details::GetCases()) {
+        const auto failuresBefore = Details::gFailures;
+        testCase.function();
+
+        const bool passed = Details::gFailures == failuresBefore;
+        failedCases += !passed;
+
+        std::printf(
+            "[%s] %.*s\n", passed ? "PASS" : "FAIL", static_cast<int>(testCase.name.size()),
+            testCase.name.data());
+    }
+
+    std::printf(
+        "%zu of %zu cases passed\n", Details::GetCases().size() - failedCases,
+        Details::GetCases().size());
+    return failedCases == 0 ? 0 : 1;
+}
+} // namespace Test
+
+// The real one pops up a fatal error dialog, which is useless in tests
+//
+void Assert::Trigger(const std::string &condition, const std::source_location &srcloc)
+{
+    Test::Details::Fail(condition, srcloc);
+}
+
+int main()
+{
+    return Test::RunAll();
+}
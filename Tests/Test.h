@@ -0,0 +1,76 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <vector>
+#include <string_view>
+#include <source_location>
+
+// A minimal test registry, so the tests don't pull in another third party dependency.
+//
+// Usage:
+//
+//      APD_TEST_CASE(Name)
+//      {
+//          APD_CHECK(1 + 1 == 2);
+//      }
+//
+namespace Test {
+
+namespace Details {
+
+using FnTest = void (*)();
+
+struct Case {
+    std::string_view name;
+    FnTest function;
+};
+
+inline std::vector<Case> &GetCases()
+{
+    static std::vector<Case> i;
+    return i;
+}
+
+struct Registrar {
+    Registrar(std::string_view name, FnTest function)
+    {
+        GetCases().push_back(Case{name, function});
+    }
+};
+
+void Fail(std::string_view condition, const std::source_location &srcloc);
+
+} // namespace Details
+
+int RunAll();
+
+} // namespace Test
+
+#define APD_TEST_CASE(name)                                                                        \
+    static void ApdTest_##name();                                                                  \
+    static const Test::Details::Registrar ApdTestRegistrar_##name{#name, &ApdTest_##name};         \
+    static void ApdTest_##name()
+
+#define APD_CHECK(condition)                                                                       \
+    do {                                                                                           \
+        if (!(condition)) {                                                                        \
+            Test::Details::Fail(#condition, std::source_location::current());                      \
+        }                                                                                          \
+    } while (false)